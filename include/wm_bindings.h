@@ -0,0 +1,70 @@
+#ifndef __WM_BINDINGS_H
+#define __WM_BINDINGS_H
+
+#include <stdint.h>
+#include <wayland-server.h>
+#include <xkbcommon/xkbcommon.h>
+
+#define WM_BINDING_MOD_SHIFT (1 << 0)
+#define WM_BINDING_MOD_CTRL (1 << 1)
+#define WM_BINDING_MOD_ALT (1 << 2)
+#define WM_BINDING_MOD_LOGO (1 << 3)
+#define WM_BINDING_MODS 4
+
+#define WM_BINDING_EXEC 0
+#define WM_BINDING_MAXIMIZE 1
+#define WM_BINDING_SWITCH_WINDOW 2
+#define WM_BINDING_DEBUG_CYCLE 3
+#define WM_BINDING_HUD_TOGGLE 4
+#define WM_BINDING_TERMINATE 5
+#define WM_BINDING_WORKSPACE 6
+#define WM_BINDING_MOVE_TO_WORKSPACE 7
+#define WM_BINDING_BREAK_CONSTRAINT 8
+
+#define WM_BINDINGS_SLOTS 256
+
+struct wm_seat;
+
+struct wm_binding {
+  uint32_t mask;
+  xkb_keysym_t sym;
+  bool release;
+
+  int action;
+  char *command;
+  int workspace;
+
+  bool used;
+};
+
+// Open addressed on (mask, keysym, release), the slot count is a power of
+// two kept at most half full
+struct wm_bindings {
+  struct wm_binding *slots;
+  int capacity;
+  int count;
+};
+
+// Translates a keymap's modifier state into WM_BINDING_MOD_* bits
+struct wm_binding_mods {
+  xkb_mod_mask_t masks[WM_BINDING_MODS];
+};
+
+struct wm_bindings* wm_bindings_create();
+
+void wm_bindings_destroy(struct wm_bindings* bindings);
+
+void wm_bindings_load(struct wm_bindings* bindings, const char* path);
+
+void wm_binding_mods_init(struct wm_binding_mods* mods,
+  struct xkb_keymap* keymap);
+
+uint32_t wm_binding_mods_mask(struct wm_binding_mods* mods,
+  xkb_mod_mask_t depressed);
+
+struct wm_binding* wm_bindings_find(struct wm_bindings* bindings,
+  uint32_t mask, xkb_keysym_t sym, bool release);
+
+void wm_binding_run(struct wm_binding* binding, struct wm_seat* seat);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __WM_BUFFER_H
+#define __WM_BUFFER_H
+
+#include <wayland-server.h>
+
+struct wlr_surface;
+
+struct wm_buffer_release {
+  struct wlr_surface *surface;
+
+  // The last buffer released, cleared when the client destroys it
+  struct wl_resource *buffer;
+
+  struct wl_listener commit;
+  struct wl_listener destroy;
+  struct wl_listener buffer_destroy;
+};
+
+bool wm_buffer_release_enabled();
+
+struct wm_buffer_release* wm_buffer_release_create(struct wlr_surface *surface);
+
+void wm_buffer_release_destroy(struct wm_buffer_release *release);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef __WM_CONSTRAINTS_H
+#define __WM_CONSTRAINTS_H
+
+#include <pixman.h>
+#include <stdint.h>
+#include <wayland-server.h>
+
+#define WM_CONSTRAINT_LOCK 0
+#define WM_CONSTRAINT_CONFINE 1
+
+struct wm_pointer;
+struct wm_seat;
+struct wm_window;
+struct wm_server;
+struct wlr_seat;
+struct wlr_surface;
+
+// Relative pointer and pointer constraint globals
+struct wm_constraints {
+  struct wm_server *server;
+  struct wl_global *relative_global;
+  struct wl_global *constraints_global;
+  struct wl_list relative_pointers;
+  struct wl_list constraints;
+};
+
+struct wm_relative_pointer {
+  struct wl_resource *resource;
+
+  // NULL once the wl_pointer has gone away
+  struct wl_resource *pointer_resource;
+  struct wl_listener pointer_destroy;
+
+  struct wl_list link;
+};
+
+struct wm_constraint {
+  struct wm_constraints *constraints;
+  struct wl_resource *resource;
+  int type;
+  uint32_t lifetime;
+
+  struct wlr_seat *seat;
+  struct wlr_surface *surface;
+  struct wl_listener surface_destroy;
+  struct wl_listener surface_commit;
+
+  // Surface local, the whole surface when there is no region
+  bool has_region;
+  pixman_region32_t region;
+
+  bool pending_has_region;
+  pixman_region32_t pending_region;
+  bool region_pending;
+
+  bool hint_set;
+  double hint_x;
+  double hint_y;
+  bool pending_hint_set;
+  double pending_hint_x;
+  double pending_hint_y;
+
+  // Set while active, a oneshot constraint never activates again
+  struct wm_pointer *pointer;
+  struct wm_window *window;
+  bool defunct;
+
+  // Broken by a binding, stays off until the pointer leaves the surface
+  bool suspended;
+
+  struct wl_list link;
+};
+
+struct wm_constraints* wm_constraints_create(struct wm_server* server);
+
+void wm_constraints_destroy(struct wm_constraints* constraints);
+
+void wm_constraints_relative_motion(struct wm_constraints* constraints,
+  struct wm_seat* seat, uint32_t time_msec, double dx, double dy);
+
+// Activates or deactivates the constraint on the pointer's focused surface
+void wm_constraints_update(struct wm_constraints* constraints,
+  struct wm_pointer* pointer);
+
+// Releases the pointer's active constraint, the client is told
+void wm_constraints_deactivate(struct wm_pointer* pointer);
+
+// Releases the active constraint and keeps it off until the pointer leaves
+void wm_constraints_break(struct wm_pointer* pointer);
+
+// Trims a motion so an active confinement keeps the cursor inside its region
+void wm_constraint_confine(struct wm_constraint* constraint,
+  double* dx, double* dy);
+
+#endif
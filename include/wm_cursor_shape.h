@@ -0,0 +1,31 @@
+#ifndef __WM_CURSOR_SHAPE_H
+#define __WM_CURSOR_SHAPE_H
+
+#include <wayland-server.h>
+
+#define WM_CURSOR_SHAPE_COUNT 35
+
+struct wm_server;
+
+struct wm_cursor_shape {
+  struct wm_server *server;
+  struct wl_global *global;
+  struct wl_list devices;
+};
+
+struct wm_cursor_shape_device {
+  struct wm_cursor_shape *cursor_shape;
+  struct wl_resource *resource;
+
+  // NULL for tablet tools and once the wl_pointer has gone away
+  struct wl_resource *pointer_resource;
+  struct wl_listener pointer_destroy;
+
+  struct wl_list link;
+};
+
+struct wm_cursor_shape* wm_cursor_shape_create(struct wm_server* server);
+
+void wm_cursor_shape_destroy(struct wm_cursor_shape* cursor_shape);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __WM_CURSORS_H
+#define __WM_CURSORS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <wayland-server.h>
+
+struct wm_server;
+struct wlr_cursor;
+
+struct wm_cursor_theme {
+  float scale;
+
+  // Written by the load thread before loaded is set under the lock
+  struct wlr_xcursor_theme *theme;
+  bool loaded;
+
+  // Main loop view, images are only taken from ready themes
+  bool ready;
+
+  struct wl_list link;
+  struct wl_list queue_link;
+};
+
+// One cursor theme per output scale, shared by every output at that scale.
+// Themes are parsed on a worker thread the first time a scale shows up so
+// startup and hotplug never block on theme files.
+struct wm_cursors {
+  struct wm_server *server;
+  char *name;
+  uint32_t size;
+
+  struct wl_list themes;
+
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct wl_list queue;
+
+  int ready_fd;
+  struct wl_event_source *ready_source;
+};
+
+struct wm_cursors* wm_cursors_create(struct wm_server* server,
+  const char* name, uint32_t size);
+
+void wm_cursors_destroy(struct wm_cursors* cursors);
+
+// Queues the theme for a scale, does nothing if it is already known
+void wm_cursors_load(struct wm_cursors* cursors, float scale);
+
+// Sets the image from every ready theme, falling back to the X cursor
+// name and then the default arrow when the theme lacks the name
+void wm_cursors_set_image(struct wm_cursors* cursors, const char* name,
+  struct wlr_cursor* cursor);
+
+#endif
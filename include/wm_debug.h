@@ -0,0 +1,30 @@
+#ifndef __WM_DEBUG_H
+#define __WM_DEBUG_H
+
+#include <wayland-server.h>
+
+struct wm_output;
+struct wm_server;
+struct wm_window;
+
+enum wm_debug_mode {
+  WM_DEBUG_OFF,
+  WM_DEBUG_DAMAGE,
+  WM_DEBUG_OVERDRAW,
+  WM_DEBUG_CULLING,
+  WM_DEBUG_MODE_COUNT
+};
+
+enum wm_debug_mode wm_debug_mode_from_env();
+
+void wm_debug_cycle_mode(struct wm_server* server);
+
+void wm_debug_render_overdraw(struct wm_output* output,
+  struct wm_window* window, double x, double y);
+
+void wm_debug_render_culled(struct wm_output* output,
+  struct wm_window* window, double x, double y);
+
+void wm_debug_render_damage(struct wm_output* output);
+
+#endif
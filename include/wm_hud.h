@@ -0,0 +1,66 @@
+#ifndef __WM_HUD_H
+#define __WM_HUD_H
+
+#include <stdint.h>
+#include <time.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_box.h>
+
+#define WM_HUD_FRAME_SAMPLES 120
+#define WM_HUD_LOOP_SAMPLES 60
+#define WM_HUD_TOP_WINDOWS 5
+#define WM_HUD_MAX_RECTS 1024
+
+struct wm_output;
+struct wm_server;
+
+struct wm_hud_frames {
+  float interval[WM_HUD_FRAME_SAMPLES];
+  float render[WM_HUD_FRAME_SAMPLES];
+  int head;
+  int missed;
+};
+
+struct wm_hud_rect {
+  struct wlr_box box;
+  const float *color;
+};
+
+struct wm_hud {
+  struct wm_server *server;
+  bool visible;
+
+  // Main loop busy percentage, one sample per period
+  float busy[WM_HUD_LOOP_SAMPLES];
+  int busy_head;
+  long busy_ns;
+  long idle_ns;
+  struct timespec period_start;
+  struct timespec busy_start;
+
+  // Commits per second of the busiest windows, refreshed once a second
+  uint32_t top_ids[WM_HUD_TOP_WINDOWS];
+  uint32_t top_rates[WM_HUD_TOP_WINDOWS];
+  int top_count;
+  struct timespec rates_start;
+
+  // Filled and drawn each frame, never reallocated
+  struct wm_hud_rect rects[WM_HUD_MAX_RECTS];
+  int rect_count;
+};
+
+struct wm_hud* wm_hud_create(struct wm_server* server);
+
+void wm_hud_destroy(struct wm_hud* hud);
+
+void wm_hud_toggle(struct wm_hud* hud);
+
+void wm_hud_loop_idle(struct wm_hud* hud, struct timespec* idle_start,
+  struct timespec* idle_end);
+
+void wm_hud_output_frame(struct wm_hud* hud, struct wm_output* output,
+  struct timespec* frame_start, struct timespec* render_end);
+
+void wm_hud_render(struct wm_hud* hud, struct wm_output* output);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __WM_INDEX_H
+#define __WM_INDEX_H
+
+#include <stdint.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_box.h>
+
+#define WM_INDEX_CELL_SIZE 256
+#define WM_INDEX_BUCKETS 512
+#define WM_INDEX_MAX_CELLS 256
+#define WM_INDEX_MAX_RESULTS 64
+
+struct wm_window;
+
+struct wm_index_entry {
+  struct wm_window *window;
+  int cell_x;
+  int cell_y;
+};
+
+struct wm_index_bucket {
+  struct wm_index_entry *entries;
+  int count;
+  int capacity;
+};
+
+// Hashed uniform grid over window bounds in layout coordinates. Windows
+// covering more than WM_INDEX_MAX_CELLS cells go on a list that every
+// query checks instead.
+struct wm_index {
+  struct wm_index_bucket buckets[WM_INDEX_BUCKETS];
+  struct wl_list oversized;
+};
+
+struct wm_index* wm_index_create();
+
+void wm_index_destroy(struct wm_index* index);
+
+void wm_index_update(struct wm_index* index, struct wm_window* window);
+
+void wm_index_remove(struct wm_index* index, struct wm_window* window);
+
+int wm_index_query(struct wm_index* index, double x, double y,
+  struct wm_window** windows, int max);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __WM_INPUT_H
+#define __WM_INPUT_H
+
+#include <stdint.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#define WM_LATENCY_BUCKET_NS 10000
+#define WM_LATENCY_BUCKETS 10000
+
+struct wm_server;
+struct wlr_input_device;
+
+struct wm_latency {
+  const char *name;
+  uint64_t count;
+  uint64_t max_ns;
+  uint32_t buckets[WM_LATENCY_BUCKETS + 1];
+};
+
+// Backend timestamp to delivery to the focused client, per device name so
+// a replugged device keeps its history
+struct wm_device_latency {
+  char *name;
+  struct wm_latency latency;
+  struct wl_list link;
+};
+
+// Input latency histograms, SIGUSR1 prints them
+struct wm_input {
+  struct wm_server *server;
+
+  struct wl_event_source *sigusr1_source;
+
+  struct wm_latency backend_latency;
+  struct wm_latency key_latency;
+  struct wl_list devices;
+};
+
+struct wm_input* wm_input_create(struct wm_server* server);
+
+void wm_input_destroy(struct wm_input* input);
+
+void wm_input_backend_event(struct wm_input* input, uint32_t time_msec);
+
+void wm_input_key_dispatched(struct wm_input* input, struct timespec* start);
+
+struct wm_device_latency* wm_input_device(struct wm_input* input,
+  struct wlr_input_device* device);
+
+void wm_input_delivered(struct wm_device_latency* device, uint32_t time_msec);
+
+void wm_latency_record(struct wm_latency* latency, uint64_t ns);
+
+uint64_t wm_latency_percentile(struct wm_latency* latency, double percentile);
+
+void wm_latency_print(struct wm_latency* latency);
+
+#endif
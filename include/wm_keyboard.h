@@ -2,26 +2,82 @@
 #define __WM_KEYBOARD_H
 
 #include <wayland-server.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_keyboard.h>
+
+#include "wm_bindings.h"
+
+// Covers every evdev keycode up to KEY_MAX
+#define WM_KEYBOARD_KEYCODES 0x300
+
+// Keyboards on a seat sharing a keymap, presented to clients as one
+// keyboard with a single xkb state so typing across devices never
+// re-sends the keymap
+struct wm_keyboard_group {
+  struct wm_seat *seat;
+  struct wm_keymap *keymap;
+
+  struct wlr_input_device device;
+  struct wlr_keyboard keyboard;
+
+  struct wl_listener key;
+  struct wl_listener modifiers;
+
+  // How many member devices hold each key down, only the first press and
+  // the last release reach the group keyboard
+  uint8_t pressed[WM_KEYBOARD_KEYCODES];
+
+  struct wl_list keyboards;
+  struct wl_list link;
+};
 
 struct wm_keyboard {
   struct wm_seat *seat;
   struct wlr_input_device *device;
   struct wl_listener key;
-  struct wl_listener modifiers;
   struct wl_listener destroy;
   struct wl_list link;
+
+  // Shared keymap, referenced from attach on. Linked on its keyboards list
+  // while it is still compiling.
+  struct wm_keymap *keymap;
+  struct wl_list keymap_link;
+
+  struct wm_keyboard_group *group;
+  struct wl_list group_link;
+
+  // Client driven input held while the keymap compiles
+  struct wl_array pending;
+
+  struct wm_device_latency *latency;
 };
 
 struct wlr_event_keyboard_key;
+struct wm_keymap;
 
 struct wm_keyboard* wm_keyboard_create(struct wlr_input_device* device,
   struct wm_seat* seat);
 
 void wm_keyboard_destroy(struct wm_keyboard* keyboard);
 
-void wm_keyboard_key_event(struct wm_keyboard *keyboard,
+void wm_keyboard_set_keymap(struct wm_keyboard* keyboard,
+  struct wm_keymap* keymap);
+
+void wm_keyboard_keymap_failed(struct wm_keyboard* keyboard);
+
+// Moves the keyboard to another keymap, e.g. one a client sent
+void wm_keyboard_use_keymap(struct wm_keyboard* keyboard,
+  struct wm_keymap* keymap);
+
+void wm_keyboard_notify_key(struct wm_keyboard* keyboard,
+  struct wlr_event_keyboard_key* event);
+
+void wm_keyboard_notify_modifiers(struct wm_keyboard* keyboard,
+  struct wlr_keyboard_modifiers* modifiers);
+
+void wm_keyboard_group_key_event(struct wm_keyboard_group *group,
   struct wlr_event_keyboard_key* event);
 
-void wm_keyboard_modifiers_event(struct wm_keyboard *keyboard);
+void wm_keyboard_group_modifiers_event(struct wm_keyboard_group *group);
 
 #endif
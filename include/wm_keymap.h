@@ -0,0 +1,82 @@
+#ifndef __WM_KEYMAP_H
+#define __WM_KEYMAP_H
+
+#include <pthread.h>
+#include <wayland-server.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "wm_bindings.h"
+
+// Compiled instead when a rule set fails, e.g. a typo in XKB_DEFAULT_LAYOUT
+#define WM_KEYMAP_FALLBACK_RULES "evdev"
+#define WM_KEYMAP_FALLBACK_MODEL "pc105"
+#define WM_KEYMAP_FALLBACK_LAYOUT "us"
+
+struct wm_server;
+
+struct wm_keymap {
+  char *rules;
+  char *model;
+  char *layout;
+  char *variant;
+  char *options;
+
+  // Keymap text sent by a client, the rule names are unused when set
+  char *string;
+
+  // Keyboards using or waiting on it. A client keymap is freed once none
+  // are left, rule keymaps stay for the next hotplug.
+  int refs;
+
+  // Written by the compile thread before compiled is set under the lock,
+  // NULL if neither the rules nor the fallback compiled
+  struct xkb_keymap *keymap;
+  bool fallback;
+  bool compiled;
+
+  // Main loop view, keyboards wait on the list until this is set
+  bool ready;
+  struct wm_binding_mods mods;
+  struct wl_list keyboards;
+
+  struct wl_list link;
+  struct wl_list queue_link;
+};
+
+// One compiled keymap per rule set or client keymap text, shared by every
+// keyboard using it.
+// Compilation happens on a worker thread so hotplugging keyboards never
+// blocks the main loop.
+struct wm_keymaps {
+  struct wm_server *server;
+  struct xkb_context *context;
+
+  struct wl_list keymaps;
+
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct wl_list queue;
+
+  int ready_fd;
+  struct wl_event_source *ready_source;
+};
+
+struct wm_keymaps* wm_keymaps_create(struct wm_server* server);
+
+void wm_keymaps_destroy(struct wm_keymaps* keymaps);
+
+void wm_keymaps_default_rules(struct xkb_rule_names* rules);
+
+struct wm_keymap* wm_keymaps_get(struct wm_keymaps* keymaps,
+  const struct xkb_rule_names* rules);
+
+struct wm_keymap* wm_keymaps_get_string(struct wm_keymaps* keymaps,
+  const char* string);
+
+void wm_keymap_ref(struct wm_keymap* keymap);
+
+void wm_keymap_unref(struct wm_keymap* keymap);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __WM_MIRROR_H
+#define __WM_MIRROR_H
+
+#include <stdint.h>
+#include <pixman.h>
+#include <wayland-server.h>
+
+struct wlr_texture;
+struct wm_output;
+struct wm_server;
+
+struct wm_mirror_rule {
+  char *output;
+  char *source;
+  struct wl_list link;
+};
+
+struct wm_mirror_source {
+  struct wm_output *output;
+
+  int width;
+  int height;
+  uint32_t *pixels;
+  struct wlr_texture *texture;
+
+  struct wl_list link;
+};
+
+struct wm_mirror {
+  struct wm_server *server;
+
+  struct wl_list rules;
+  struct wl_list sources;
+
+  uint32_t *scratch;
+  size_t scratch_size;
+};
+
+struct wm_mirror* wm_mirror_create(struct wm_server* server);
+
+void wm_mirror_destroy(struct wm_mirror* mirror);
+
+const char* wm_mirror_source_name(struct wm_mirror* mirror,
+  const char* output_name);
+
+void wm_mirror_output_frame(struct wm_mirror* mirror, struct wm_output* output);
+
+void wm_mirror_render(struct wm_mirror* mirror, struct wm_output* output);
+
+void wm_mirror_output_destroy(struct wm_mirror* mirror,
+  struct wm_output* output);
+
+#endif
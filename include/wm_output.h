@@ -2,10 +2,16 @@
 #define __WM_OUTPUT_H
 
 #include <time.h>
+#include <pixman.h>
 #include <wayland-server.h>
 
+#include "wm_hud.h"
+#include "wm_workspace.h"
+
+struct wlr_box;
 struct wlr_output;
 struct wlr_output_layout;
+struct wm_window;
 
 struct wm_output {
   struct wm_server *server;
@@ -14,12 +20,28 @@ struct wm_output {
   struct wl_listener frame;
   struct wl_list link;
   struct timespec last_frame;
+  struct wm_hud_frames frames;
+
+  pixman_region32_t damage;
+
+  struct wm_workspace workspaces[WM_WORKSPACE_COUNT];
+  struct wm_workspace *workspace;
+
+  // Name of the output shown here instead of a part of the layout
+  const char *mirror_of;
 };
 
 void wm_output_render(struct wm_output* output);
 
+void wm_output_render_window(struct wm_output* output,
+  struct wm_window* window, double x, double y, double scale);
+
 void wm_destroy(struct wm_output* output);
 
+void wm_output_damage_box(struct wm_output* output, struct wlr_box* box);
+
+void wm_output_damage_whole(struct wm_output* output);
+
 struct wm_output* wm_output_create(struct wlr_output* wlr_output,
   struct wlr_output_layout *layout, struct wm_server *server);
 
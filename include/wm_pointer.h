@@ -2,6 +2,11 @@
 #define __WM_POINTER_H
 
 #include <wayland-server.h>
+#include <wlr/types/wlr_pointer.h>
+
+struct wm_window;
+struct wm_device_latency;
+struct wlr_input_device;
 
 #define WM_POINTER_MODE_FREE 0
 #define WM_POINTER_MODE_MOVE 1
@@ -24,8 +29,32 @@ struct wm_pointer {
   struct wm_seat *seat;
   struct wm_surface *focused_surface;
 
+  // Window being moved or resized, NULL in free mode
+  struct wm_window *grabbed_window;
+
+  // Active lock or confinement on the focused surface
+  struct wm_constraint *constraint;
+
+  // Motion waiting for the once per frame window management pass
+  bool motion_pending;
+  bool motion_sent;
+  uint32_t motion_time;
+  struct wm_device_latency *motion_latency;
+
+  // Where the hovered surface was at the last pass, lets raw motion go
+  // straight to it in between
+  struct wlr_surface *motion_surface;
+  struct wm_window *motion_window;
+  int motion_window_x;
+  int motion_window_y;
+  double motion_origin_x;
+  double motion_origin_y;
+
   struct wlr_cursor *cursor;
 
+  // Theme image shown when no client surface is, static storage
+  const char *cursor_name;
+
   struct wl_listener axis;
   struct wl_listener cursor_motion_absolute;
   struct wl_listener cursor_motion;
@@ -37,10 +66,27 @@ void wm_pointer_set_mode(struct wm_pointer* pointer, int mode);
 
 void wm_pointer_set_default_cursor(struct wm_pointer* pointer);
 
+void wm_pointer_set_cursor_name(struct wm_pointer* pointer, const char* name);
+
 void wm_pointer_set_resize_edge(struct wm_pointer* pointer, int resize_edge);
 
 void wm_pointer_motion(struct wm_pointer *pointer, uint32_t time);
 
+void wm_pointer_queue_motion(struct wm_pointer *pointer,
+  struct wlr_input_device *device, uint32_t time);
+
+void wm_pointer_flush_motion(struct wm_pointer *pointer);
+
+void wm_pointer_forget_window(struct wm_pointer *pointer,
+  struct wm_window *window);
+
+void wm_pointer_button(struct wm_pointer* pointer, uint32_t time,
+  uint32_t button, enum wlr_button_state state);
+
+void wm_pointer_axis(struct wm_pointer* pointer, uint32_t time,
+  enum wlr_axis_orientation orientation, double delta,
+  enum wlr_axis_source source);
+
 struct wm_pointer* wm_pointer_create(struct wm_server* server,
   struct wm_seat* seat);
 
@@ -0,0 +1,81 @@
+#ifndef __WM_RECORD_H
+#define __WM_RECORD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <wayland-server.h>
+
+#define WM_RECORD_MAGIC "BOXYINP1"
+#define WM_RECORD_MAX_DEVICES 256
+
+#define WM_RECORD_DEVICE_ADD 0
+#define WM_RECORD_DEVICE_REMOVE 1
+#define WM_RECORD_MOTION 2
+#define WM_RECORD_MOTION_ABSOLUTE 3
+#define WM_RECORD_BUTTON 4
+#define WM_RECORD_AXIS 5
+#define WM_RECORD_KEY 6
+
+struct wm_server;
+struct wlr_input_device;
+
+// On disk every event is this header followed by type specific fields,
+// all in host byte order
+struct wm_record_header {
+  uint32_t time_msec;
+  uint8_t type;
+  uint8_t device;
+  uint16_t length;
+} __attribute__((packed));
+
+struct wm_record_device {
+  struct wm_record *record;
+  struct wlr_input_device *device;
+  uint8_t id;
+
+  struct wl_listener destroy;
+  struct wl_listener key;
+  struct wl_listener motion;
+  struct wl_listener motion_absolute;
+  struct wl_listener button;
+  struct wl_listener axis;
+
+  struct wl_list link;
+};
+
+struct wm_record {
+  struct wm_server *server;
+
+  FILE *output;
+  struct wl_list devices;
+  int next_device_id;
+
+  FILE *input;
+  double speed;
+  struct wl_event_source *timer;
+  struct wlr_input_device *replay_devices[WM_RECORD_MAX_DEVICES];
+
+  // The replay clock, recorded times are offset from the first event
+  bool started;
+  uint32_t first_time;
+  struct timespec start;
+
+  bool next_ready;
+  struct wm_record_header next;
+  uint8_t next_data[64];
+};
+
+bool wm_record_replay_enabled();
+
+// NULL unless BOXY_RECORD or BOXY_REPLAY is set
+struct wm_record* wm_record_create(struct wm_server* server);
+
+void wm_record_destroy(struct wm_record* record);
+
+void wm_record_device_added(struct wm_record* record,
+  struct wlr_input_device* device);
+
+void wm_record_start_replay(struct wm_record* record);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __WM_SCREENCOPY_H
+#define __WM_SCREENCOPY_H
+
+#include <time.h>
+#include <pixman.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_box.h>
+
+struct wm_output;
+struct wm_server;
+struct wm_window;
+
+struct wm_screencopy {
+  struct wm_server *server;
+  struct wl_global *global;
+  struct wl_global *window_global;
+  struct wl_list clients;
+  struct wl_list window_clients;
+  struct wl_list frames;
+
+  // Holds one damaged rect at a time on its way into a shadow
+  uint32_t *scratch;
+  size_t scratch_size;
+};
+
+struct wm_screencopy_client {
+  struct wm_screencopy *screencopy;
+  struct wl_resource *resource;
+  struct wl_list damages;
+  struct wl_list frames;
+  struct wl_list link;
+};
+
+struct wm_screencopy_damage {
+  struct wm_output *output;
+  struct wm_window *window;
+  pixman_region32_t region;
+  struct wlr_box cursor;
+
+  // The pixels this client was last sent, top down. Those in valid and
+  // outside region are current, so copies only read back the rest.
+  uint32_t *shadow;
+  int shadow_width;
+  int shadow_height;
+  bool shadow_cursor;
+  pixman_region32_t valid;
+
+  struct wl_list link;
+};
+
+struct wm_screencopy_frame {
+  struct wm_screencopy *screencopy;
+  struct wm_screencopy_client *client;
+  struct wl_resource *resource;
+
+  struct wm_output *output;
+  struct wm_window *window;
+  struct wlr_box box;
+
+  bool overlay_cursor;
+  bool with_damage;
+  bool used;
+
+  struct wl_resource *buffer;
+  struct wl_listener buffer_destroy;
+
+  struct wl_list client_link;
+  struct wl_list link;
+};
+
+struct wm_screencopy* wm_screencopy_create(struct wm_server* server);
+
+void wm_screencopy_destroy(struct wm_screencopy* screencopy);
+
+void wm_screencopy_render_windows(struct wm_screencopy* screencopy,
+  struct wm_output* output);
+
+void wm_screencopy_output_frame(struct wm_screencopy* screencopy,
+  struct wm_output* output, struct timespec* now);
+
+void wm_screencopy_output_destroy(struct wm_screencopy* screencopy,
+  struct wm_output* output);
+
+void wm_screencopy_window_add(struct wm_screencopy* screencopy,
+  struct wm_window* window);
+
+void wm_screencopy_window_damage(struct wm_screencopy* screencopy,
+  struct wm_window* window, struct wlr_box* box);
+
+void wm_screencopy_window_remove(struct wm_screencopy* screencopy,
+  struct wm_window* window);
+
+#endif
@@ -11,11 +11,31 @@ struct wm_seat {
   struct wm_server *server;
   struct wm_pointer *pointer;
   struct wlr_seat *seat;
+
+  // Activated window, the only one deactivated when focus moves
+  struct wm_window *focused_window;
+
+  // Most recently focused first, separate from stacking order so stepping
+  // through it never restacks anything until the switch is committed
+  struct wl_list focus_order;
+  struct wm_seat_focus *focus_switch;
+
   struct wl_list keyboards;
+  struct wl_list keyboard_groups;
   struct wl_list link;
   struct wl_listener destroy;
 };
 
+struct wm_window;
+
+// A window's place in one seat's focus order
+struct wm_seat_focus {
+  struct wm_seat *seat;
+  struct wm_window *window;
+  struct wl_list link;
+  struct wl_list window_link;
+};
+
 struct wlr_input_device;
 
 void wm_seat_destroy(struct wm_seat* seat);
@@ -30,4 +50,10 @@ void wm_seat_attach_pointing_device(struct wm_seat* seat,
 void wm_seat_attach_keyboard_device(struct wm_seat* seat,
   struct wlr_input_device* device);
 
+void wm_seat_focus_promote(struct wm_seat* seat, struct wm_window* window);
+
+void wm_seat_focus_remove(struct wm_seat* seat, struct wm_window* window);
+
+struct wm_window* wm_seat_focus_step(struct wm_seat* seat);
+
 #endif
@@ -21,52 +21,88 @@ struct wm_server {
   struct wlr_output_layout *layout;
   struct wlr_xwayland *xwayland;
 
-  struct wlr_xcursor_manager *xcursor_manager;
+  struct wm_cursors *cursors;
   struct wlr_xdg_output_manager* xdg_output_manager;
   struct wlr_data_device_manager *data_device_manager;
   struct wlr_primary_selection_device_manager *primary_selection_device_manager;
   struct wlr_server_decoration_manager *server_decoration_manager;
   struct wlr_linux_dmabuf *linux_dmabuf;
+  struct wlr_export_dmabuf_manager_v1 *export_dmabuf_manager;
+
+  struct wm_screencopy *screencopy;
+  struct wm_vnc *vnc;
+  struct wm_mirror *mirror;
+  struct wm_hud *hud;
+  struct wm_input *input;
+  struct wm_index *index;
+  struct wm_window_store *window_store;
+  struct wm_bindings *bindings;
+  struct wm_keymaps *keymaps;
+  struct wm_timestamps *timestamps;
+  struct wm_constraints *constraints;
+  struct wm_cursor_shape *cursor_shape;
+  struct wm_record *record;
+  struct wm_virtual *virtual;
 
   struct wl_listener new_input;
   struct wl_listener new_output;
+  struct wl_listener new_surface;
 
   struct wl_list seats;
   struct wl_list shells;
   struct wl_list outputs;
   struct wl_list windows;
 
-  int pending_focus_index;
+  uint32_t next_window_id;
+  uint32_t next_z;
+
+  bool release_shm_buffers;
+  int resize_snapshot;
+  int debug_mode;
+  bool running;
 };
 
+struct wlr_box;
 struct wlr_input_device;
+struct wm_seat;
 
 struct wm_server* wm_server_create();
 
-void wm_server_destroy(struct wm_server* server);
+void wm_server_terminate(struct wm_server* server);
 
-void wm_server_set_cursors(struct wm_server* server);
+void wm_server_destroy(struct wm_server* server);
 
 void wm_server_run(struct wm_server* server);
 
 struct wm_seat* wm_server_find_or_create_seat(struct wm_server* server,
   const char* seat_name);
 
+void wm_server_connect_seat_input(struct wm_server* server,
+  struct wm_seat* seat, struct wlr_input_device* device);
+
 struct wm_window* wm_server_window_at_point(struct wm_server* server,
   int x, int y);
 
-void wm_server_maximize_focused_window(struct wm_server* server);
+void wm_server_maximize_focused_window(struct wm_server* server,
+  struct wm_seat* seat);
 
-void wm_server_switch_window(struct wm_server* server);
+void wm_server_switch_window(struct wm_server* server, struct wm_seat* seat);
 
 void wm_server_commit_window_switch(struct wm_server* server,
   struct wm_seat* seat);
 
+void wm_server_focus_window(struct wm_server* server,
+  struct wm_window* window, struct wm_seat* seat);
+
+void wm_server_refocus(struct wm_server* server, struct wm_seat* seat);
+
 void wm_server_add_window(struct wm_server* server,
   struct wm_window* window, struct wm_seat* seat);
 
 void wm_server_remove_window(struct wm_window* window);
 
+void wm_server_damage_box(struct wm_server* server, struct wlr_box* box);
+
 void wm_server_focus_window_under_point(struct wm_server* server,
   struct wm_seat* seat, double x, double y);
 
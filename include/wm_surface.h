@@ -10,6 +10,9 @@ struct wm_seat;
 typedef void (*wm_surface_render_handler)(struct wlr_surface *surface,
   int sx, int sy, void *data);
 
+typedef void (*wm_surface_iterator)(struct wlr_surface *surface,
+  int sx, int sy, void *data);
+
 typedef void (*wm_surface_frame_done_handler)(struct wlr_surface *surface,
   int sx, int sy, void *data);
 
@@ -30,6 +33,9 @@ struct wm_surface {
   void (*render)(struct wm_surface* this,
     wm_surface_render_handler render_handler, void* data);
 
+  void (*for_each_surface)(struct wm_surface* this,
+    wm_surface_iterator iterator, void* data);
+
   void (*frame_done)(struct wm_surface* this,
     wm_surface_frame_done_handler frame_donew_handler, struct timespec* now);
 
@@ -37,9 +43,12 @@ struct wm_surface {
 
   void (*toplevel_set_maximized)(struct wm_surface* this, bool maximized);
 
-  void (*toplevel_constrained_set_size)(struct wm_surface* this,
+  uint32_t (*toplevel_constrained_set_size)(struct wm_surface* this,
     int width, int height);
 
+  // Serial of the last configure the client acknowledged
+  uint32_t (*configure_serial)(struct wm_surface* this);
+
   void (*toplevel_set_focused)(struct wm_surface* this,
     struct wm_seat* seat, bool focused);
 
@@ -0,0 +1,42 @@
+#ifndef __WM_TIMESTAMPS_H
+#define __WM_TIMESTAMPS_H
+
+#include <stdint.h>
+#include <wayland-server.h>
+
+#define WM_TIMESTAMPS_KEYBOARD 0
+#define WM_TIMESTAMPS_POINTER 1
+#define WM_TIMESTAMPS_TOUCH 2
+
+struct wm_server;
+struct wm_seat;
+
+struct wm_timestamps {
+  struct wm_server *server;
+  struct wl_global *global;
+  struct wl_list subscriptions;
+};
+
+struct wm_timestamps_subscription {
+  struct wl_resource *resource;
+  int type;
+
+  // NULL once the wl_keyboard, wl_pointer or wl_touch has gone away
+  struct wl_resource *input_resource;
+  struct wl_listener input_destroy;
+
+  struct wl_list link;
+};
+
+struct wm_timestamps* wm_timestamps_create(struct wm_server* server);
+
+void wm_timestamps_destroy(struct wm_timestamps* timestamps);
+
+// Sent right before the matching input event goes to the focused client
+void wm_timestamps_keyboard(struct wm_timestamps* timestamps,
+  struct wm_seat* seat, uint32_t time_msec);
+
+void wm_timestamps_pointer(struct wm_timestamps* timestamps,
+  struct wm_seat* seat, uint32_t time_msec);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __WM_VIRTUAL_H
+#define __WM_VIRTUAL_H
+
+#include <stdint.h>
+#include <wayland-server.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_pointer.h>
+
+struct wm_seat;
+struct wm_server;
+
+// Client driven devices, attached to a seat exactly like backend devices
+struct wm_virtual_keyboard {
+  struct wl_resource *resource;
+  struct wm_seat *seat;
+  struct wlr_input_device device;
+  struct wlr_keyboard keyboard;
+  bool has_keymap;
+};
+
+struct wm_virtual_pointer {
+  struct wl_resource *resource;
+  struct wlr_input_device device;
+  struct wlr_pointer pointer;
+  enum wlr_axis_source axis_source;
+};
+
+struct wm_virtual {
+  struct wm_server *server;
+  struct wl_global *keyboard_global;
+  struct wl_global *pointer_global;
+};
+
+struct wm_virtual* wm_virtual_create(struct wm_server* server);
+
+void wm_virtual_destroy(struct wm_virtual* virtual);
+
+#endif
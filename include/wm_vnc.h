@@ -0,0 +1,114 @@
+#ifndef __WM_VNC_H
+#define __WM_VNC_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <pixman.h>
+#include <zlib.h>
+#include <wayland-server.h>
+
+#define WM_VNC_CLIENT_VERSION 0
+#define WM_VNC_CLIENT_SECURITY 1
+#define WM_VNC_CLIENT_INIT 2
+#define WM_VNC_CLIENT_NORMAL 3
+
+#define WM_VNC_BUFFER_SIZE 4096
+
+struct wm_output;
+struct wm_server;
+
+struct wm_vnc_pixel_format {
+  uint8_t bits_per_pixel;
+  uint8_t depth;
+  uint8_t big_endian;
+  uint8_t true_colour;
+  uint16_t red_max;
+  uint16_t green_max;
+  uint16_t blue_max;
+  uint8_t red_shift;
+  uint8_t green_shift;
+  uint8_t blue_shift;
+};
+
+struct wm_vnc_buffer {
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+};
+
+struct wm_vnc_client {
+  struct wm_vnc *vnc;
+
+  int fd;
+  struct wl_event_source *source;
+
+  int state;
+  int minor_version;
+
+  uint8_t buffer[WM_VNC_BUFFER_SIZE];
+  size_t buffer_length;
+  size_t skip;
+
+  int width;
+  int height;
+
+  // Shared with the encoder thread, guarded by vnc->lock
+  bool update_requested;
+  bool full_update;
+  bool closed;
+  bool busy;
+  bool zlib;
+  struct wm_vnc_pixel_format format;
+  pixman_region32_t damage;
+  z_stream zstream;
+
+  // Bytes not yet taken by the non-blocking socket, also guarded by
+  // vnc->lock. Updates are only encoded once the previous one is sent.
+  struct wm_vnc_buffer output;
+
+  struct wl_list link;
+};
+
+struct wm_vnc {
+  struct wm_server *server;
+
+  int listen_fd;
+  struct wl_event_source *listen_source;
+
+  // Picked on first use, by name when output_name is set
+  struct wm_output *output;
+  const char *output_name;
+  bool stats;
+
+  uint32_t buttons;
+  struct xkb_keymap *keymap;
+  struct xkb_state *xkb_state;
+
+  uint32_t *scratch;
+  size_t scratch_size;
+
+  // Shared with the encoder thread, guarded by lock
+  int width;
+  int height;
+  uint32_t *framebuffer;
+  bool running;
+  struct wl_list clients;
+
+  pthread_t encoder;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  // Wakes the main loop to send what the encoder queued
+  int ready_fd;
+  struct wl_event_source *ready_source;
+};
+
+struct wm_vnc* wm_vnc_create(struct wm_server* server);
+
+void wm_vnc_destroy(struct wm_vnc* vnc);
+
+void wm_vnc_output_frame(struct wm_vnc* vnc, struct wm_output* output);
+
+void wm_vnc_output_destroy(struct wm_vnc* vnc, struct wm_output* output);
+
+#endif
@@ -2,10 +2,16 @@
 #define __WM_WINDOW_H
 
 #include <wayland-server.h>
+#include <wlr/types/wlr_box.h>
+
+#define WM_RESIZE_SNAPSHOT_OFF 0
+#define WM_RESIZE_SNAPSHOT_STRETCH 1
+#define WM_RESIZE_SNAPSHOT_CROP 2
 
 struct wm_pointer;
 
 struct wm_window {
+  uint32_t id;
   const char* name;
 
   int x;
@@ -31,6 +37,42 @@ struct wm_window {
 
   bool maximized;
 
+  // Interactive resize keeps one configure in flight, the newest size
+  // waits here until the client commits the previous one
+  uint32_t configure_serial;
+  bool resize_pending;
+  int resize_width;
+  int resize_height;
+
+  // Area the old buffer was last drawn into while the client caught up
+  struct wlr_box snapshot;
+
+  struct wlr_box extents;
+  // Window position the extents were computed at
+  int extents_origin_x;
+  int extents_origin_y;
+
+  // Finds the window's hot data in the server's window store, stable
+  // while the window is stored
+  int handle;
+
+  uint32_t commits;
+
+  // Stacking order, higher is nearer the top
+  uint32_t z;
+
+  struct wlr_box index_box;
+  bool index_valid;
+  bool index_oversized;
+  struct wl_list index_link;
+
+  // One wm_seat_focus for every seat that has focused the window
+  struct wl_list focus_entries;
+
+  // NULL when the window is not on any output, it is then always shown
+  struct wm_workspace *workspace;
+  struct wl_list workspace_link;
+
   struct wm_surface *surface;
   struct wl_list link;
 };
@@ -44,6 +86,14 @@ void wm_window_commit_pending_movement(struct wm_window* window,
 
 void wm_window_resize(struct wm_window* window, struct wm_pointer* pointer);
 
+void wm_window_finish_resize(struct wm_window* window);
+
+void wm_window_commit_configure(struct wm_window* window);
+
+int wm_window_resize_snapshot_mode();
+
+bool wm_window_snapshot_box(struct wm_window* window, struct wlr_box* box);
+
 void wm_window_move(struct wm_window* window, int x, int y);
 
 void wm_window_maximize(struct wm_window* window, bool maximized);
@@ -52,4 +102,10 @@ void wm_window_save_geography(struct wm_window* window);
 
 struct wlr_output* wm_window_find_output(struct wm_window* window);
 
+struct wlr_box wm_window_extents(struct wm_window* window);
+
+void wm_window_damage_whole(struct wm_window* window);
+
+void wm_window_damage_commit(struct wm_window* window);
+
 #endif
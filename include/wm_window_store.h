@@ -0,0 +1,61 @@
+#ifndef __WM_WINDOW_STORE_H
+#define __WM_WINDOW_STORE_H
+
+#include <stdbool.h>
+#include <wlr/types/wlr_box.h>
+
+#define WM_WINDOW_STORE_INITIAL_CAPACITY 64
+
+struct wm_window;
+
+// Per frame window data in parallel arrays, slot 0 at the bottom of the
+// stack. Render, cull and frame callback passes walk these linearly and
+// only touch a wm_window for windows they actually draw. A window's slot
+// moves when the stack changes, wm_window.handle stays the same from add
+// to remove and maps to the current slot.
+//
+// Raising or removing a window leaves a hole, a NULL entry in windows,
+// so focus changes cost the same with thousands of windows. Holes are
+// marked culled and passes skip them, the arrays are compacted once holes
+// make up half of them.
+struct wm_window_store {
+  int count;
+  int capacity;
+  int holes;
+
+  struct wm_window **windows;
+  struct wlr_box *geometry;
+  struct wlr_box *extents;
+  bool *culled;
+
+  // Handle to slot, -1 for handles on the free list
+  int *slots;
+  int handle_capacity;
+  int next_handle;
+  int *free_handles;
+  int free_count;
+};
+
+struct wm_window_store* wm_window_store_create();
+
+void wm_window_store_destroy(struct wm_window_store* store);
+
+// Adds the window on top of the stack
+void wm_window_store_add(struct wm_window_store* store,
+  struct wm_window* window);
+
+void wm_window_store_remove(struct wm_window_store* store,
+  struct wm_window* window);
+
+void wm_window_store_raise(struct wm_window_store* store,
+  struct wm_window* window);
+
+// Copies the window's geometry and extents into its slot
+void wm_window_store_update(struct wm_window_store* store,
+  struct wm_window* window);
+
+// The stored geometry, NULL when the window is not in the store
+struct wlr_box* wm_window_store_geometry(struct wm_window_store* store,
+  struct wm_window* window);
+
+#endif
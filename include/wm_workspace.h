@@ -0,0 +1,56 @@
+#ifndef __WM_WORKSPACE_H
+#define __WM_WORKSPACE_H
+
+#include <stdbool.h>
+#include <wayland-server.h>
+
+#define WM_WORKSPACE_COUNT 9
+
+struct wm_output;
+struct wm_seat;
+struct wm_server;
+struct wm_window;
+
+// Windows are kept per output and workspace. Only the active workspace's
+// windows are in the window store and the index, so rendering, culling,
+// frame callbacks and hit tests never see hidden ones.
+struct wm_workspace {
+  struct wm_output *output;
+  int index;
+
+  // Stacking order, topmost first
+  struct wl_list windows;
+};
+
+void wm_workspace_init(struct wm_workspace* workspace,
+  struct wm_output* output, int index);
+
+// Windows left on a disappearing output join the active workspace of the
+// first remaining output. With none left they stay visible without one.
+void wm_workspace_output_destroy(struct wm_output* output);
+
+// Gives windows without a workspace to a newly connected output
+void wm_workspace_output_added(struct wm_output* output);
+
+// Puts a newly mapped window on the active workspace of its output, or of
+// the seat's output when it is not placed yet
+void wm_workspace_add_window(struct wm_seat* seat, struct wm_window* window);
+
+void wm_workspace_remove_window(struct wm_window* window);
+
+void wm_workspace_raise_window(struct wm_window* window);
+
+// Hands a window moved onto another output, or one without a workspace, to
+// that output's active workspace
+void wm_workspace_window_moved(struct wm_window* window);
+
+bool wm_workspace_window_visible(struct wm_window* window);
+
+// Output under the seat's cursor, or the first one without a pointer
+struct wm_output* wm_workspace_seat_output(struct wm_seat* seat);
+
+void wm_workspace_switch(struct wm_output* output, int index);
+
+void wm_workspace_move_window(struct wm_window* window, int index);
+
+#endif
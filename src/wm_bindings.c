@@ -0,0 +1,377 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_bindings.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+#include "wm_constraints.h"
+#include "wm_debug.h"
+#include "wm_hud.h"
+#include "wm_seat.h"
+#include "wm_server.h"
+#include "wm_workspace.h"
+
+static const char *default_bindings =
+  "Super+Up maximize\n"
+  "Super+k switch-window\n"
+  "Alt+Tab switch-window\n"
+  "Super+b exec chrome\n"
+  "Super+s exec slack-desktop\n"
+  "Super+d debug-cycle\n"
+  "Super+t hud-toggle\n"
+  "Super+1 workspace 1\n"
+  "Super+2 workspace 2\n"
+  "Super+3 workspace 3\n"
+  "Super+4 workspace 4\n"
+  "Super+Escape break-constraint\n"
+  "F1 exec epiphany\n"
+  "release Super+Return exec gnome-terminal\n"
+  "release Super+Shift+Return exec weston-terminal\n"
+  "release Ctrl+Alt+BackSpace terminate\n";
+
+static const struct {
+  const char *name;
+  int action;
+} actions[] = {
+  { "exec", WM_BINDING_EXEC },
+  { "maximize", WM_BINDING_MAXIMIZE },
+  { "switch-window", WM_BINDING_SWITCH_WINDOW },
+  { "debug-cycle", WM_BINDING_DEBUG_CYCLE },
+  { "hud-toggle", WM_BINDING_HUD_TOGGLE },
+  { "terminate", WM_BINDING_TERMINATE },
+  { "workspace", WM_BINDING_WORKSPACE },
+  { "move-to-workspace", WM_BINDING_MOVE_TO_WORKSPACE },
+  { "break-constraint", WM_BINDING_BREAK_CONSTRAINT },
+};
+
+static const struct {
+  const char *name;
+  uint32_t mask;
+} modifiers[] = {
+  { "Shift", WM_BINDING_MOD_SHIFT },
+  { "Ctrl", WM_BINDING_MOD_CTRL },
+  { "Alt", WM_BINDING_MOD_ALT },
+  { "Super", WM_BINDING_MOD_LOGO },
+};
+
+static const char *modifier_names[WM_BINDING_MODS] = {
+  XKB_MOD_NAME_SHIFT,
+  XKB_MOD_NAME_CTRL,
+  XKB_MOD_NAME_ALT,
+  XKB_MOD_NAME_LOGO,
+};
+
+static uint32_t binding_hash(uint32_t mask, xkb_keysym_t sym, bool release) {
+  uint32_t key = (sym << 5) | (mask << 1) | release;
+  return key * 2654435761u;
+}
+
+static struct wm_binding* bindings_slot(struct wm_bindings *bindings,
+  uint32_t mask, xkb_keysym_t sym, bool release) {
+  uint32_t i = binding_hash(mask, sym, release) & (bindings->capacity - 1);
+
+  while (bindings->slots[i].used) {
+    struct wm_binding *binding = &bindings->slots[i];
+    if (binding->mask == mask && binding->sym == sym &&
+        binding->release == release) {
+      return binding;
+    }
+    i = (i + 1) & (bindings->capacity - 1);
+  }
+
+  return &bindings->slots[i];
+}
+
+static void bindings_clear(struct wm_bindings *bindings) {
+  for (int i = 0; i < bindings->capacity; i++) {
+    free(bindings->slots[i].command);
+  }
+  memset(bindings->slots, 0, bindings->capacity * sizeof(struct wm_binding));
+  bindings->count = 0;
+}
+
+static void bindings_grow(struct wm_bindings *bindings) {
+  struct wm_binding *old = bindings->slots;
+  int old_capacity = bindings->capacity;
+
+  bindings->capacity *= 2;
+  bindings->slots = calloc(bindings->capacity, sizeof(struct wm_binding));
+
+  for (int i = 0; i < old_capacity; i++) {
+    if (old[i].used) {
+      *bindings_slot(bindings, old[i].mask, old[i].sym, old[i].release) = old[i];
+    }
+  }
+
+  free(old);
+}
+
+static void bindings_add(struct wm_bindings *bindings, struct wm_binding *binding) {
+  if ((bindings->count + 1) * 2 > bindings->capacity) {
+    bindings_grow(bindings);
+  }
+
+  struct wm_binding *slot = bindings_slot(bindings,
+    binding->mask, binding->sym, binding->release);
+
+  if (slot->used) {
+    free(slot->command);
+  } else {
+    bindings->count++;
+  }
+
+  *slot = *binding;
+  slot->used = true;
+}
+
+static bool parse_combo(char *combo, uint32_t *mask, xkb_keysym_t *sym) {
+  *mask = 0;
+
+  char *key = combo;
+  char *plus;
+  while ((plus = strchr(key, '+')) != NULL && plus[1] != '\0') {
+    *plus = '\0';
+
+    bool found = false;
+    for (size_t i = 0; i < sizeof(modifiers) / sizeof(modifiers[0]); i++) {
+      if (strcasecmp(key, modifiers[i].name) == 0) {
+        *mask |= modifiers[i].mask;
+        found = true;
+      }
+    }
+
+    if (!found) {
+      return false;
+    }
+
+    key = plus + 1;
+  }
+
+  *sym = xkb_keysym_from_name(key, XKB_KEYSYM_NO_FLAGS);
+  return *sym != XKB_KEY_NoSymbol;
+}
+
+static bool parse_line(char *line, struct wm_binding *binding) {
+  memset(binding, 0, sizeof(struct wm_binding));
+
+  char *save;
+  char *token = strtok_r(line, " \t", &save);
+
+  if (token != NULL && strcmp(token, "release") == 0) {
+    binding->release = true;
+    token = strtok_r(NULL, " \t", &save);
+  }
+
+  if (token == NULL || !parse_combo(token, &binding->mask, &binding->sym)) {
+    return false;
+  }
+
+  token = strtok_r(NULL, " \t", &save);
+  if (token == NULL) {
+    return false;
+  }
+
+  binding->action = -1;
+  for (size_t i = 0; i < sizeof(actions) / sizeof(actions[0]); i++) {
+    if (strcmp(token, actions[i].name) == 0) {
+      binding->action = actions[i].action;
+    }
+  }
+
+  if (binding->action < 0) {
+    return false;
+  }
+
+  if (binding->action == WM_BINDING_EXEC) {
+    char *command = strtok_r(NULL, "", &save);
+    if (command == NULL) {
+      return false;
+    }
+    command += strspn(command, " \t");
+    binding->command = strdup(command);
+  }
+
+  if (binding->action == WM_BINDING_WORKSPACE ||
+      binding->action == WM_BINDING_MOVE_TO_WORKSPACE) {
+    token = strtok_r(NULL, " \t", &save);
+    if (token == NULL) {
+      return false;
+    }
+    int workspace = atoi(token);
+    if (workspace < 1 || workspace > WM_WORKSPACE_COUNT) {
+      return false;
+    }
+    binding->workspace = workspace - 1;
+  }
+
+  return true;
+}
+
+static void bindings_parse(struct wm_bindings *bindings, FILE *file,
+  const char *name) {
+  char *line = NULL;
+  size_t size = 0;
+  int number = 0;
+
+  while (getline(&line, &size, file) != -1) {
+    number++;
+    line[strcspn(line, "\r\n")] = '\0';
+
+    char *start = line + strspn(line, " \t");
+    if (*start == '\0' || *start == '#') {
+      continue;
+    }
+
+    struct wm_binding binding;
+    if (!parse_line(start, &binding)) {
+      wlr_log(L_ERROR, "%s:%d: invalid binding", name, number);
+      continue;
+    }
+
+    bindings_add(bindings, &binding);
+  }
+
+  free(line);
+}
+
+static char* bindings_path() {
+  const char *path = getenv("BOXY_BINDINGS");
+  if (path != NULL) {
+    return strdup(path);
+  }
+
+  const char *config = getenv("XDG_CONFIG_HOME");
+  const char *home = getenv("HOME");
+  const char *format = "%s/boxy/bindings";
+
+  if (config == NULL || config[0] == '\0') {
+    if (home == NULL) {
+      return NULL;
+    }
+    config = home;
+    format = "%s/.config/boxy/bindings";
+  }
+
+  size_t length = snprintf(NULL, 0, format, config) + 1;
+  char *result = malloc(length);
+  snprintf(result, length, format, config);
+  return result;
+}
+
+void wm_bindings_load(struct wm_bindings* bindings, const char* path) {
+  bindings_clear(bindings);
+
+  FILE *file = path != NULL ? fopen(path, "r") : NULL;
+  if (file != NULL) {
+    printf("Loading bindings from %s\n", path);
+    bindings_parse(bindings, file, path);
+    fclose(file);
+    return;
+  }
+
+  file = fmemopen((void *)default_bindings, strlen(default_bindings), "r");
+  bindings_parse(bindings, file, "default bindings");
+  fclose(file);
+}
+
+struct wm_bindings* wm_bindings_create() {
+  struct wm_bindings *bindings = calloc(1, sizeof(struct wm_bindings));
+  bindings->capacity = WM_BINDINGS_SLOTS;
+  bindings->slots = calloc(bindings->capacity, sizeof(struct wm_binding));
+
+  char *path = bindings_path();
+  wm_bindings_load(bindings, path);
+  free(path);
+
+  return bindings;
+}
+
+void wm_bindings_destroy(struct wm_bindings* bindings) {
+  bindings_clear(bindings);
+  free(bindings->slots);
+  free(bindings);
+}
+
+void wm_binding_mods_init(struct wm_binding_mods* mods,
+  struct xkb_keymap* keymap) {
+  for (int i = 0; i < WM_BINDING_MODS; i++) {
+    xkb_mod_index_t index = xkb_keymap_mod_get_index(keymap, modifier_names[i]);
+    mods->masks[i] = index == XKB_MOD_INVALID ? 0 : 1u << index;
+  }
+}
+
+uint32_t wm_binding_mods_mask(struct wm_binding_mods* mods,
+  xkb_mod_mask_t depressed) {
+  uint32_t mask = 0;
+  for (int i = 0; i < WM_BINDING_MODS; i++) {
+    if (depressed & mods->masks[i]) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+
+struct wm_binding* wm_bindings_find(struct wm_bindings* bindings,
+  uint32_t mask, xkb_keysym_t sym, bool release) {
+  struct wm_binding *binding = bindings_slot(bindings, mask, sym, release);
+  return binding->used ? binding : NULL;
+}
+
+static void exec_command(const char* shell_cmd) {
+  printf("Executing: %s\n", shell_cmd);
+  pid_t pid = fork();
+  if (pid < 0) {
+    wlr_log(L_ERROR, "cannot execute binding command: fork() failed");
+    return;
+  } else if (pid == 0) {
+    execl("/bin/sh", "/bin/sh", "-c", shell_cmd, (void *)NULL);
+    _exit(1);
+  }
+}
+
+void wm_binding_run(struct wm_binding* binding, struct wm_seat* seat) {
+  struct wm_server *server = seat->server;
+
+  switch (binding->action) {
+    case WM_BINDING_EXEC:
+      exec_command(binding->command);
+      break;
+    case WM_BINDING_MAXIMIZE:
+      wm_server_maximize_focused_window(server, seat);
+      break;
+    case WM_BINDING_SWITCH_WINDOW:
+      wm_server_switch_window(server, seat);
+      break;
+    case WM_BINDING_DEBUG_CYCLE:
+      wm_debug_cycle_mode(server);
+      break;
+    case WM_BINDING_HUD_TOGGLE:
+      wm_hud_toggle(server->hud);
+      break;
+    case WM_BINDING_TERMINATE:
+      wm_server_terminate(server);
+      break;
+    case WM_BINDING_WORKSPACE: {
+      struct wm_output *output = wm_workspace_seat_output(seat);
+      if (output) {
+        wm_workspace_switch(output, binding->workspace);
+      }
+      break;
+    }
+    case WM_BINDING_MOVE_TO_WORKSPACE:
+      if (seat->focused_window) {
+        wm_workspace_move_window(seat->focused_window, binding->workspace);
+      }
+      break;
+    case WM_BINDING_BREAK_CONSTRAINT:
+      if (seat->pointer) {
+        wm_constraints_break(seat->pointer);
+      }
+      break;
+  }
+}
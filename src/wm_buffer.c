@@ -0,0 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pixman.h>
+#include <wlr/types/wlr_surface.h>
+
+bool wm_buffer_release_enabled() {
+  const char* mode = getenv("BOXY_RELEASE_SHM_BUFFERS");
+  return mode != NULL && strcmp(mode, "0") != 0;
+}
+
+static void release_forget_buffer(struct wm_buffer_release *release) {
+  if (release->buffer != NULL) {
+    wl_list_remove(&release->buffer_destroy.link);
+    release->buffer = NULL;
+  }
+}
+
+static void handle_buffer_destroy(struct wl_listener *listener, void *data) {
+  (void)data;
+  struct wm_buffer_release *release = wl_container_of(listener, release, buffer_destroy);
+  release_forget_buffer(release);
+}
+
+static void handle_buffer_release_commit(struct wl_listener *listener, void *data) {
+  (void)data;
+  struct wm_buffer_release *release = wl_container_of(listener, release, commit);
+  struct wlr_surface *surface = release->surface;
+  struct wl_resource *buffer = surface->current->buffer;
+
+  if (buffer == NULL || wl_shm_buffer_get(buffer) == NULL) {
+    return;
+  }
+
+  // Commits that attach nothing keep the buffer already released. A client
+  // attaching that same wl_buffer again also sends damage with it.
+  if (buffer == release->buffer &&
+      !pixman_region32_not_empty(&surface->current->surface_damage)) {
+    return;
+  }
+
+  // wlroots has already copied shm contents into the surface texture by the
+  // time the commit signal fires, so the client can reuse the buffer now
+  // instead of waiting for the next attach
+  wl_buffer_send_release(buffer);
+
+  release_forget_buffer(release);
+  release->buffer = buffer;
+  wl_resource_add_destroy_listener(buffer, &release->buffer_destroy);
+}
+
+static void handle_buffer_release_destroy(struct wl_listener *listener, void *data) {
+  (void)data;
+  struct wm_buffer_release *release = wl_container_of(listener, release, destroy);
+  wm_buffer_release_destroy(release);
+}
+
+struct wm_buffer_release* wm_buffer_release_create(struct wlr_surface *surface) {
+  struct wm_buffer_release *release = calloc(1, sizeof(struct wm_buffer_release));
+  release->surface = surface;
+
+  release->commit.notify = handle_buffer_release_commit;
+  wl_signal_add(&surface->events.commit, &release->commit);
+
+  release->destroy.notify = handle_buffer_release_destroy;
+  wl_signal_add(&surface->events.destroy, &release->destroy);
+
+  release->buffer_destroy.notify = handle_buffer_destroy;
+
+  return release;
+}
+
+void wm_buffer_release_destroy(struct wm_buffer_release *release) {
+  release_forget_buffer(release);
+  wl_list_remove(&release->commit.link);
+  wl_list_remove(&release->destroy.link);
+  free(release);
+}
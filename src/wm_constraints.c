@@ -0,0 +1,568 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_constraints.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_region.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_surface.h>
+
+#include "pointer-constraints-unstable-v1-protocol.h"
+#include "relative-pointer-unstable-v1-protocol.h"
+
+#include "wm_pointer.h"
+#include "wm_seat.h"
+#include "wm_server.h"
+
+#define RELATIVE_POINTER_MANAGER_VERSION 1
+#define POINTER_CONSTRAINTS_VERSION 1
+
+static const struct zwp_relative_pointer_v1_interface relative_pointer_impl;
+static const struct zwp_locked_pointer_v1_interface locked_pointer_impl;
+static const struct zwp_confined_pointer_v1_interface confined_pointer_impl;
+
+static bool resource_in_list(struct wl_resource *resource, struct wl_list *list) {
+  struct wl_resource *entry;
+  wl_resource_for_each(entry, list) {
+    if (entry == resource) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void relative_pointer_clear_pointer(struct wm_relative_pointer *relative) {
+  if (relative->pointer_resource == NULL) {
+    return;
+  }
+
+  relative->pointer_resource = NULL;
+  wl_list_remove(&relative->pointer_destroy.link);
+}
+
+static void relative_pointer_handle_pointer_destroy(struct wl_listener *listener,
+  void *data) {
+  (void)data;
+  struct wm_relative_pointer *relative =
+    wl_container_of(listener, relative, pointer_destroy);
+  relative_pointer_clear_pointer(relative);
+}
+
+static void relative_pointer_handle_resource_destroy(struct wl_resource *resource) {
+  assert(wl_resource_instance_of(resource,
+    &zwp_relative_pointer_v1_interface, &relative_pointer_impl));
+  struct wm_relative_pointer *relative = wl_resource_get_user_data(resource);
+
+  relative_pointer_clear_pointer(relative);
+  wl_list_remove(&relative->link);
+  free(relative);
+}
+
+static void relative_pointer_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct zwp_relative_pointer_v1_interface relative_pointer_impl = {
+  .destroy = relative_pointer_handle_destroy,
+};
+
+static void relative_manager_handle_get_relative_pointer(
+  struct wl_client *wl_client, struct wl_resource *manager_resource,
+  uint32_t id, struct wl_resource *pointer_resource) {
+  struct wm_constraints *constraints =
+    wl_resource_get_user_data(manager_resource);
+
+  struct wm_relative_pointer *relative =
+    calloc(1, sizeof(struct wm_relative_pointer));
+
+  relative->resource = wl_resource_create(wl_client,
+    &zwp_relative_pointer_v1_interface,
+    wl_resource_get_version(manager_resource), id);
+
+  if (relative->resource == NULL) {
+    free(relative);
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  relative->pointer_resource = pointer_resource;
+  relative->pointer_destroy.notify = relative_pointer_handle_pointer_destroy;
+  wl_resource_add_destroy_listener(pointer_resource, &relative->pointer_destroy);
+
+  wl_list_insert(&constraints->relative_pointers, &relative->link);
+
+  wl_resource_set_implementation(relative->resource, &relative_pointer_impl,
+    relative, relative_pointer_handle_resource_destroy);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct zwp_relative_pointer_manager_v1_interface
+  relative_manager_impl = {
+  .destroy = manager_handle_destroy,
+  .get_relative_pointer = relative_manager_handle_get_relative_pointer,
+};
+
+static void relative_manager_bind(struct wl_client *wl_client, void *data,
+  uint32_t version, uint32_t id) {
+  struct wl_resource *resource = wl_resource_create(wl_client,
+    &zwp_relative_pointer_manager_v1_interface, version, id);
+
+  if (resource == NULL) {
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wl_resource_set_implementation(resource, &relative_manager_impl, data, NULL);
+}
+
+void wm_constraints_relative_motion(struct wm_constraints* constraints,
+  struct wm_seat* seat, uint32_t time_msec, double dx, double dy) {
+  if (constraints == NULL || wl_list_empty(&constraints->relative_pointers)) {
+    return;
+  }
+
+  struct wlr_seat_client *client = seat->seat->pointer_state.focused_client;
+  if (client == NULL) {
+    return;
+  }
+
+  // Backends only report accelerated deltas, they double as the raw ones
+  uint64_t utime = (uint64_t)time_msec * 1000;
+  wl_fixed_t fixed_dx = wl_fixed_from_double(dx);
+  wl_fixed_t fixed_dy = wl_fixed_from_double(dy);
+
+  struct wm_relative_pointer *relative;
+  wl_list_for_each(relative, &constraints->relative_pointers, link) {
+    struct wl_resource *pointer_resource = relative->pointer_resource;
+    if (pointer_resource == NULL ||
+        !resource_in_list(pointer_resource, &client->pointers)) {
+      continue;
+    }
+
+    zwp_relative_pointer_v1_send_relative_motion(relative->resource,
+      utime >> 32, utime & 0xffffffff, fixed_dx, fixed_dy, fixed_dx, fixed_dy);
+
+    if (wl_resource_get_version(pointer_resource) >=
+        WL_POINTER_FRAME_SINCE_VERSION) {
+      wl_pointer_send_frame(pointer_resource);
+    }
+  }
+}
+
+static bool constraint_contains(struct wm_constraint *constraint,
+  double sx, double sy) {
+  struct wlr_surface *surface = constraint->surface;
+
+  if (surface == NULL || sx < 0 || sy < 0 ||
+      sx >= surface->current->width || sy >= surface->current->height) {
+    return false;
+  }
+
+  if (!constraint->has_region) {
+    return true;
+  }
+
+  return pixman_region32_contains_point(&constraint->region,
+    (int)sx, (int)sy, NULL);
+}
+
+static void constraint_surface_point(struct wm_constraint *constraint,
+  double *sx, double *sy) {
+  struct wm_pointer *pointer = constraint->pointer;
+  *sx = pointer->cursor->x - pointer->motion_origin_x;
+  *sy = pointer->cursor->y - pointer->motion_origin_y;
+}
+
+static void constraint_activate(struct wm_constraint *constraint,
+  struct wm_pointer *pointer) {
+  constraint->pointer = pointer;
+  constraint->window = pointer->motion_window;
+  pointer->constraint = constraint;
+
+  if (constraint->type == WM_CONSTRAINT_LOCK) {
+    // The client draws its own cursor, if any, while locked
+    wlr_cursor_set_surface(pointer->cursor, NULL, 0, 0);
+    zwp_locked_pointer_v1_send_locked(constraint->resource);
+    return;
+  }
+
+  zwp_confined_pointer_v1_send_confined(constraint->resource);
+}
+
+static void constraint_deactivate(struct wm_constraint *constraint,
+  bool notify) {
+  struct wm_pointer *pointer = constraint->pointer;
+  if (pointer == NULL) {
+    return;
+  }
+
+  if (constraint->type == WM_CONSTRAINT_LOCK) {
+    if (constraint->hint_set && constraint->surface) {
+      wlr_cursor_warp(pointer->cursor, NULL,
+        pointer->motion_origin_x + constraint->hint_x,
+        pointer->motion_origin_y + constraint->hint_y);
+    }
+    wm_pointer_set_default_cursor(pointer);
+  }
+
+  constraint->pointer = NULL;
+  constraint->window = NULL;
+  pointer->constraint = NULL;
+
+  if (constraint->lifetime == ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_ONESHOT) {
+    constraint->defunct = true;
+  }
+
+  if (!notify) {
+    return;
+  }
+
+  if (constraint->type == WM_CONSTRAINT_LOCK) {
+    zwp_locked_pointer_v1_send_unlocked(constraint->resource);
+  } else {
+    zwp_confined_pointer_v1_send_unconfined(constraint->resource);
+  }
+}
+
+void wm_constraints_update(struct wm_constraints* constraints,
+  struct wm_pointer* pointer) {
+  if (constraints == NULL) {
+    return;
+  }
+
+  struct wlr_seat *seat = pointer->seat->seat;
+  struct wlr_surface *focused = seat->pointer_state.focused_surface;
+
+  // Only the window with keyboard focus may hold on to the pointer
+  struct wm_window *window = pointer->seat->focused_window;
+
+  if (pointer->constraint) {
+    if (pointer->constraint->surface == focused &&
+        pointer->constraint->window == window) {
+      return;
+    }
+    constraint_deactivate(pointer->constraint, true);
+  }
+
+  struct wm_constraint *constraint;
+  wl_list_for_each(constraint, &constraints->constraints, link) {
+    if (constraint->seat == seat && constraint->surface != focused) {
+      constraint->suspended = false;
+    }
+  }
+
+  if (focused == NULL || pointer->motion_surface != focused ||
+      pointer->motion_window != window) {
+    return;
+  }
+
+  wl_list_for_each(constraint, &constraints->constraints, link) {
+    if (constraint->surface != focused || constraint->seat != seat ||
+        constraint->defunct || constraint->suspended) {
+      continue;
+    }
+
+    double sx = pointer->cursor->x - pointer->motion_origin_x;
+    double sy = pointer->cursor->y - pointer->motion_origin_y;
+
+    if (constraint_contains(constraint, sx, sy)) {
+      constraint_activate(constraint, pointer);
+    }
+    return;
+  }
+}
+
+void wm_constraints_deactivate(struct wm_pointer* pointer) {
+  if (pointer->constraint) {
+    constraint_deactivate(pointer->constraint, true);
+  }
+}
+
+void wm_constraints_break(struct wm_pointer* pointer) {
+  struct wm_constraint *constraint = pointer->constraint;
+  if (constraint == NULL) {
+    return;
+  }
+
+  constraint_deactivate(constraint, true);
+  constraint->suspended = true;
+}
+
+void wm_constraint_confine(struct wm_constraint* constraint,
+  double* dx, double* dy) {
+  double sx, sy;
+  constraint_surface_point(constraint, &sx, &sy);
+
+  if (constraint_contains(constraint, sx + *dx, sy + *dy)) {
+    return;
+  }
+
+  // Slide along whichever edge still allows movement
+  if (constraint_contains(constraint, sx + *dx, sy)) {
+    *dy = 0;
+    return;
+  }
+
+  if (constraint_contains(constraint, sx, sy + *dy)) {
+    *dx = 0;
+    return;
+  }
+
+  *dx = 0;
+  *dy = 0;
+}
+
+static struct wm_constraint* constraint_from_resource(
+  struct wl_resource *resource) {
+  assert(wl_resource_instance_of(resource,
+      &zwp_locked_pointer_v1_interface, &locked_pointer_impl) ||
+    wl_resource_instance_of(resource,
+      &zwp_confined_pointer_v1_interface, &confined_pointer_impl));
+  return wl_resource_get_user_data(resource);
+}
+
+static void constraint_clear_surface(struct wm_constraint *constraint) {
+  if (constraint->surface == NULL) {
+    return;
+  }
+
+  constraint->surface = NULL;
+  wl_list_remove(&constraint->surface_destroy.link);
+  wl_list_remove(&constraint->surface_commit.link);
+}
+
+static void constraint_handle_surface_destroy(struct wl_listener *listener,
+  void *data) {
+  (void)data;
+  struct wm_constraint *constraint =
+    wl_container_of(listener, constraint, surface_destroy);
+
+  constraint_deactivate(constraint, true);
+  constraint_clear_surface(constraint);
+  constraint->defunct = true;
+}
+
+static void constraint_handle_surface_commit(struct wl_listener *listener,
+  void *data) {
+  (void)data;
+  struct wm_constraint *constraint =
+    wl_container_of(listener, constraint, surface_commit);
+
+  if (constraint->region_pending) {
+    constraint->region_pending = false;
+    constraint->has_region = constraint->pending_has_region;
+    pixman_region32_copy(&constraint->region, &constraint->pending_region);
+  }
+
+  constraint->hint_set = constraint->pending_hint_set;
+  constraint->hint_x = constraint->pending_hint_x;
+  constraint->hint_y = constraint->pending_hint_y;
+}
+
+static void constraint_handle_resource_destroy(struct wl_resource *resource) {
+  struct wm_constraint *constraint = constraint_from_resource(resource);
+
+  constraint_deactivate(constraint, false);
+  constraint_clear_surface(constraint);
+
+  pixman_region32_fini(&constraint->region);
+  pixman_region32_fini(&constraint->pending_region);
+  wl_list_remove(&constraint->link);
+  free(constraint);
+}
+
+static void constraint_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static void constraint_set_pending_region(struct wm_constraint *constraint,
+  struct wl_resource *region) {
+  constraint->region_pending = true;
+  constraint->pending_has_region = region != NULL;
+
+  if (region) {
+    pixman_region32_copy(&constraint->pending_region,
+      wlr_region_from_resource(region));
+  } else {
+    pixman_region32_clear(&constraint->pending_region);
+  }
+}
+
+static void constraint_handle_set_region(struct wl_client *client,
+  struct wl_resource *resource, struct wl_resource *region) {
+  (void)client;
+  constraint_set_pending_region(constraint_from_resource(resource), region);
+}
+
+static void locked_pointer_handle_set_cursor_position_hint(
+  struct wl_client *client, struct wl_resource *resource,
+  wl_fixed_t surface_x, wl_fixed_t surface_y) {
+  (void)client;
+  struct wm_constraint *constraint = constraint_from_resource(resource);
+
+  constraint->pending_hint_set = true;
+  constraint->pending_hint_x = wl_fixed_to_double(surface_x);
+  constraint->pending_hint_y = wl_fixed_to_double(surface_y);
+}
+
+static const struct zwp_locked_pointer_v1_interface locked_pointer_impl = {
+  .destroy = constraint_handle_destroy,
+  .set_cursor_position_hint = locked_pointer_handle_set_cursor_position_hint,
+  .set_region = constraint_handle_set_region,
+};
+
+static const struct zwp_confined_pointer_v1_interface confined_pointer_impl = {
+  .destroy = constraint_handle_destroy,
+  .set_region = constraint_handle_set_region,
+};
+
+static void constraints_create_constraint(struct wl_client *wl_client,
+  struct wl_resource *manager_resource, uint32_t id,
+  struct wl_resource *surface_resource, struct wl_resource *pointer_resource,
+  struct wl_resource *region, uint32_t lifetime, int type) {
+  struct wm_constraints *constraints =
+    wl_resource_get_user_data(manager_resource);
+
+  struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+  struct wlr_seat_client *seat_client =
+    wlr_seat_client_from_pointer_resource(pointer_resource);
+
+  // A wl_pointer whose seat has gone is inert, so is its constraint
+  bool inert = seat_client == NULL;
+  struct wlr_seat *seat = inert ? NULL : seat_client->seat;
+
+  struct wm_constraint *existing;
+  wl_list_for_each(existing, &constraints->constraints, link) {
+    if (existing->surface == surface && existing->seat == seat && !inert) {
+      wl_resource_post_error(manager_resource,
+        ZWP_POINTER_CONSTRAINTS_V1_ERROR_ALREADY_CONSTRAINED,
+        "the pointer is already constrained on this surface");
+      return;
+    }
+  }
+
+  struct wm_constraint *constraint = calloc(1, sizeof(struct wm_constraint));
+  constraint->constraints = constraints;
+  constraint->type = type;
+  constraint->lifetime = lifetime;
+  constraint->seat = seat;
+  constraint->surface = inert ? NULL : surface;
+  constraint->defunct = inert;
+
+  bool lock = type == WM_CONSTRAINT_LOCK;
+  constraint->resource = wl_resource_create(wl_client,
+    lock ? &zwp_locked_pointer_v1_interface : &zwp_confined_pointer_v1_interface,
+    wl_resource_get_version(manager_resource), id);
+
+  if (constraint->resource == NULL) {
+    free(constraint);
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  pixman_region32_init(&constraint->region);
+  pixman_region32_init(&constraint->pending_region);
+
+  constraint_set_pending_region(constraint, region);
+  constraint->region_pending = false;
+  constraint->has_region = constraint->pending_has_region;
+  pixman_region32_copy(&constraint->region, &constraint->pending_region);
+
+  wl_resource_set_implementation(constraint->resource,
+    lock ? (const void *)&locked_pointer_impl :
+      (const void *)&confined_pointer_impl,
+    constraint, constraint_handle_resource_destroy);
+
+  if (inert) {
+    wl_list_init(&constraint->link);
+    return;
+  }
+
+  constraint->surface_destroy.notify = constraint_handle_surface_destroy;
+  wl_signal_add(&surface->events.destroy, &constraint->surface_destroy);
+
+  constraint->surface_commit.notify = constraint_handle_surface_commit;
+  wl_signal_add(&surface->events.commit, &constraint->surface_commit);
+
+  wl_list_insert(&constraints->constraints, &constraint->link);
+
+  // The surface may already have pointer focus
+  struct wm_seat *wm_seat;
+  wl_list_for_each(wm_seat, &constraints->server->seats, link) {
+    if (wm_seat->seat == seat && wm_seat->pointer) {
+      wm_constraints_update(constraints, wm_seat->pointer);
+    }
+  }
+}
+
+static void constraints_handle_lock_pointer(struct wl_client *client,
+  struct wl_resource *resource, uint32_t id, struct wl_resource *surface,
+  struct wl_resource *pointer, struct wl_resource *region, uint32_t lifetime) {
+  constraints_create_constraint(client, resource, id, surface, pointer,
+    region, lifetime, WM_CONSTRAINT_LOCK);
+}
+
+static void constraints_handle_confine_pointer(struct wl_client *client,
+  struct wl_resource *resource, uint32_t id, struct wl_resource *surface,
+  struct wl_resource *pointer, struct wl_resource *region, uint32_t lifetime) {
+  constraints_create_constraint(client, resource, id, surface, pointer,
+    region, lifetime, WM_CONSTRAINT_CONFINE);
+}
+
+static const struct zwp_pointer_constraints_v1_interface constraints_impl = {
+  .destroy = manager_handle_destroy,
+  .lock_pointer = constraints_handle_lock_pointer,
+  .confine_pointer = constraints_handle_confine_pointer,
+};
+
+static void constraints_bind(struct wl_client *wl_client, void *data,
+  uint32_t version, uint32_t id) {
+  struct wl_resource *resource = wl_resource_create(wl_client,
+    &zwp_pointer_constraints_v1_interface, version, id);
+
+  if (resource == NULL) {
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wl_resource_set_implementation(resource, &constraints_impl, data, NULL);
+}
+
+struct wm_constraints* wm_constraints_create(struct wm_server* server) {
+  struct wm_constraints *constraints = calloc(1, sizeof(struct wm_constraints));
+  constraints->server = server;
+
+  wl_list_init(&constraints->relative_pointers);
+  wl_list_init(&constraints->constraints);
+
+  constraints->relative_global = wl_global_create(server->wl_display,
+    &zwp_relative_pointer_manager_v1_interface,
+    RELATIVE_POINTER_MANAGER_VERSION, constraints, relative_manager_bind);
+
+  constraints->constraints_global = wl_global_create(server->wl_display,
+    &zwp_pointer_constraints_v1_interface, POINTER_CONSTRAINTS_VERSION,
+    constraints, constraints_bind);
+
+  return constraints;
+}
+
+void wm_constraints_destroy(struct wm_constraints* constraints) {
+  if (constraints == NULL) {
+    return;
+  }
+
+  wl_global_destroy(constraints->relative_global);
+  wl_global_destroy(constraints->constraints_global);
+  free(constraints);
+}
@@ -0,0 +1,246 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_cursor_shape.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_seat.h>
+
+#include "cursor-shape-v1-protocol.h"
+
+#include "wm_constraints.h"
+#include "wm_pointer.h"
+#include "wm_seat.h"
+#include "wm_server.h"
+
+#define CURSOR_SHAPE_MANAGER_VERSION 1
+
+// Themes are looked up by CSS name, wm_cursors falls back to X names
+static const char *shape_names[WM_CURSOR_SHAPE_COUNT] = {
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_DEFAULT] = "default",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_CONTEXT_MENU] = "context-menu",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_HELP] = "help",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_POINTER] = "pointer",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_PROGRESS] = "progress",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_WAIT] = "wait",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_CELL] = "cell",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_CROSSHAIR] = "crosshair",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_TEXT] = "text",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_VERTICAL_TEXT] = "vertical-text",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_ALIAS] = "alias",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_COPY] = "copy",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_MOVE] = "move",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NO_DROP] = "no-drop",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NOT_ALLOWED] = "not-allowed",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_GRAB] = "grab",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_GRABBING] = "grabbing",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_E_RESIZE] = "e-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_N_RESIZE] = "n-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NE_RESIZE] = "ne-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NW_RESIZE] = "nw-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_S_RESIZE] = "s-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_SE_RESIZE] = "se-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_SW_RESIZE] = "sw-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_W_RESIZE] = "w-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_EW_RESIZE] = "ew-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NS_RESIZE] = "ns-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NESW_RESIZE] = "nesw-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NWSE_RESIZE] = "nwse-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_COL_RESIZE] = "col-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_ROW_RESIZE] = "row-resize",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_ALL_SCROLL] = "all-scroll",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_ZOOM_IN] = "zoom-in",
+  [WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_ZOOM_OUT] = "zoom-out",
+};
+
+static const struct wp_cursor_shape_device_v1_interface device_impl;
+
+static void device_clear_pointer(struct wm_cursor_shape_device *device) {
+  if (device->pointer_resource == NULL) {
+    return;
+  }
+
+  device->pointer_resource = NULL;
+  wl_list_remove(&device->pointer_destroy.link);
+}
+
+static void device_handle_pointer_destroy(struct wl_listener *listener,
+  void *data) {
+  (void)data;
+  struct wm_cursor_shape_device *device =
+    wl_container_of(listener, device, pointer_destroy);
+  device_clear_pointer(device);
+}
+
+static void device_handle_resource_destroy(struct wl_resource *resource) {
+  assert(wl_resource_instance_of(resource,
+    &wp_cursor_shape_device_v1_interface, &device_impl));
+  struct wm_cursor_shape_device *device = wl_resource_get_user_data(resource);
+
+  device_clear_pointer(device);
+  wl_list_remove(&device->link);
+  free(device);
+}
+
+static struct wm_pointer* device_pointer(struct wm_cursor_shape_device *device) {
+  struct wlr_seat_client *client =
+    wlr_seat_client_from_pointer_resource(device->pointer_resource);
+
+  // Like set_cursor, only the client with pointer focus may change it
+  if (client == NULL || client != client->seat->pointer_state.focused_client) {
+    return NULL;
+  }
+
+  struct wm_seat *seat;
+  wl_list_for_each(seat, &device->cursor_shape->server->seats, link) {
+    if (seat->seat == client->seat) {
+      return seat->pointer;
+    }
+  }
+
+  return NULL;
+}
+
+static void device_handle_set_shape(struct wl_client *client,
+  struct wl_resource *resource, uint32_t serial, uint32_t shape) {
+  (void)client;
+  (void)serial;
+  struct wm_cursor_shape_device *device = wl_resource_get_user_data(resource);
+
+  if (shape < WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_DEFAULT ||
+      shape >= WM_CURSOR_SHAPE_COUNT) {
+    wl_resource_post_error(resource,
+      WP_CURSOR_SHAPE_DEVICE_V1_ERROR_INVALID_SHAPE,
+      "Invalid cursor shape %u", shape);
+    return;
+  }
+
+  if (device->pointer_resource == NULL) {
+    return;
+  }
+
+  struct wm_pointer *pointer = device_pointer(device);
+  if (pointer == NULL) {
+    return;
+  }
+
+  // Nothing is drawn for a locked pointer
+  if (pointer->constraint && pointer->constraint->type == WM_CONSTRAINT_LOCK) {
+    return;
+  }
+
+  wm_pointer_set_cursor_name(pointer, shape_names[shape]);
+}
+
+static void device_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct wp_cursor_shape_device_v1_interface device_impl = {
+  .destroy = device_handle_destroy,
+  .set_shape = device_handle_set_shape,
+};
+
+static void manager_create_device(struct wl_client *wl_client,
+  struct wl_resource *manager_resource, uint32_t id,
+  struct wl_resource *pointer_resource) {
+  struct wm_cursor_shape *cursor_shape =
+    wl_resource_get_user_data(manager_resource);
+
+  struct wm_cursor_shape_device *device =
+    calloc(1, sizeof(struct wm_cursor_shape_device));
+
+  device->resource = wl_resource_create(wl_client,
+    &wp_cursor_shape_device_v1_interface,
+    wl_resource_get_version(manager_resource), id);
+
+  if (device->resource == NULL) {
+    free(device);
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  device->cursor_shape = cursor_shape;
+
+  if (pointer_resource != NULL) {
+    device->pointer_resource = pointer_resource;
+    device->pointer_destroy.notify = device_handle_pointer_destroy;
+    wl_resource_add_destroy_listener(pointer_resource, &device->pointer_destroy);
+  }
+
+  wl_list_insert(&cursor_shape->devices, &device->link);
+
+  wl_resource_set_implementation(device->resource, &device_impl, device,
+    device_handle_resource_destroy);
+}
+
+static void manager_handle_get_pointer(struct wl_client *client,
+  struct wl_resource *resource, uint32_t id, struct wl_resource *pointer) {
+  manager_create_device(client, resource, id, pointer);
+}
+
+static void manager_handle_get_tablet_tool_v2(struct wl_client *client,
+  struct wl_resource *resource, uint32_t id, struct wl_resource *tablet_tool) {
+  // There are no tablets yet, the device just never changes anything
+  (void)tablet_tool;
+  manager_create_device(client, resource, id, NULL);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct wp_cursor_shape_manager_v1_interface manager_impl = {
+  .destroy = manager_handle_destroy,
+  .get_pointer = manager_handle_get_pointer,
+  .get_tablet_tool_v2 = manager_handle_get_tablet_tool_v2,
+};
+
+static void manager_bind(struct wl_client *wl_client, void *data,
+  uint32_t version, uint32_t id) {
+  struct wm_cursor_shape *cursor_shape = data;
+
+  struct wl_resource *resource = wl_resource_create(wl_client,
+    &wp_cursor_shape_manager_v1_interface, version, id);
+
+  if (resource == NULL) {
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wl_resource_set_implementation(resource, &manager_impl, cursor_shape, NULL);
+}
+
+struct wm_cursor_shape* wm_cursor_shape_create(struct wm_server* server) {
+  struct wm_cursor_shape *cursor_shape =
+    calloc(1, sizeof(struct wm_cursor_shape));
+  cursor_shape->server = server;
+
+  wl_list_init(&cursor_shape->devices);
+
+  cursor_shape->global = wl_global_create(server->wl_display,
+    &wp_cursor_shape_manager_v1_interface, CURSOR_SHAPE_MANAGER_VERSION,
+    cursor_shape, manager_bind);
+
+  return cursor_shape;
+}
+
+void wm_cursor_shape_destroy(struct wm_cursor_shape* cursor_shape) {
+  if (cursor_shape == NULL) {
+    return;
+  }
+
+  struct wm_cursor_shape_device *device, *tmp;
+  wl_list_for_each_safe(device, tmp, &cursor_shape->devices, link) {
+    device_clear_pointer(device);
+    wl_list_remove(&device->link);
+    wl_list_init(&device->link);
+  }
+
+  wl_global_destroy(cursor_shape->global);
+  free(cursor_shape);
+}
@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_cursors.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/xcursor.h>
+#include <wlr/util/log.h>
+
+#include "wm_pointer.h"
+#include "wm_seat.h"
+#include "wm_server.h"
+
+#define CURSORS_FALLBACK "left_ptr"
+
+// CSS names mapped to the names older X cursor themes ship
+static const struct {
+  const char *name;
+  const char *legacy;
+} aliases[] = {
+  { "default", "left_ptr" },
+  { "context-menu", "left_ptr" },
+  { "help", "question_arrow" },
+  { "pointer", "hand2" },
+  { "progress", "left_ptr_watch" },
+  { "wait", "watch" },
+  { "cell", "plus" },
+  { "crosshair", "cross" },
+  { "text", "xterm" },
+  { "vertical-text", "xterm" },
+  { "alias", "dnd-link" },
+  { "copy", "dnd-copy" },
+  { "move", "fleur" },
+  { "no-drop", "dnd-none" },
+  { "not-allowed", "crossed_circle" },
+  { "grab", "hand1" },
+  { "grabbing", "fleur" },
+  { "e-resize", "right_side" },
+  { "n-resize", "top_side" },
+  { "ne-resize", "top_right_corner" },
+  { "nw-resize", "top_left_corner" },
+  { "s-resize", "bottom_side" },
+  { "se-resize", "bottom_right_corner" },
+  { "sw-resize", "bottom_left_corner" },
+  { "w-resize", "left_side" },
+  { "ew-resize", "sb_h_double_arrow" },
+  { "ns-resize", "sb_v_double_arrow" },
+  { "nesw-resize", "fd_double_arrow" },
+  { "nwse-resize", "bd_double_arrow" },
+  { "col-resize", "sb_h_double_arrow" },
+  { "row-resize", "sb_v_double_arrow" },
+  { "all-scroll", "fleur" },
+};
+
+static struct wlr_xcursor* theme_cursor(struct wm_cursor_theme *theme,
+  const char *name) {
+  struct wlr_xcursor *xcursor = wlr_xcursor_theme_get_cursor(theme->theme, name);
+  if (xcursor != NULL) {
+    return xcursor;
+  }
+
+  for (size_t i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+    if (strcmp(aliases[i].name, name) == 0) {
+      xcursor = wlr_xcursor_theme_get_cursor(theme->theme, aliases[i].legacy);
+      break;
+    }
+  }
+
+  if (xcursor == NULL) {
+    xcursor = wlr_xcursor_theme_get_cursor(theme->theme, CURSORS_FALLBACK);
+  }
+
+  return xcursor;
+}
+
+static void theme_set_image(struct wm_cursor_theme *theme, const char *name,
+  struct wlr_cursor *cursor) {
+  struct wlr_xcursor *xcursor = theme_cursor(theme, name);
+  if (xcursor == NULL) {
+    return;
+  }
+
+  struct wlr_xcursor_image *image = xcursor->images[0];
+  wlr_cursor_set_image(cursor, image->buffer, image->width * 4,
+    image->width, image->height, image->hotspot_x, image->hotspot_y,
+    theme->scale);
+}
+
+static void* cursors_thread(void *data) {
+  struct wm_cursors *cursors = data;
+
+  pthread_mutex_lock(&cursors->lock);
+
+  while (true) {
+    while (cursors->running && wl_list_empty(&cursors->queue)) {
+      pthread_cond_wait(&cursors->cond, &cursors->lock);
+    }
+
+    if (!cursors->running) {
+      break;
+    }
+
+    struct wm_cursor_theme *theme = wl_container_of(cursors->queue.prev,
+      theme, queue_link);
+    wl_list_remove(&theme->queue_link);
+    wl_list_init(&theme->queue_link);
+
+    pthread_mutex_unlock(&cursors->lock);
+
+    struct wlr_xcursor_theme *loaded = wlr_xcursor_theme_load(cursors->name,
+      cursors->size * theme->scale);
+
+    pthread_mutex_lock(&cursors->lock);
+    theme->theme = loaded;
+    theme->loaded = true;
+
+    uint64_t one = 1;
+    if (write(cursors->ready_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+      wlr_log(L_ERROR, "Failed to wake the main loop for a cursor theme");
+    }
+  }
+
+  pthread_mutex_unlock(&cursors->lock);
+  return NULL;
+}
+
+// Pointers that asked for a named image pick up the new scale
+static void theme_ready(struct wm_cursors *cursors,
+  struct wm_cursor_theme *theme) {
+  theme->ready = true;
+
+  if (theme->theme == NULL) {
+    wlr_log(L_ERROR, "Failed to load cursor theme %s at scale %.2f",
+      cursors->name, theme->scale);
+    return;
+  }
+
+  struct wm_seat *seat;
+  wl_list_for_each(seat, &cursors->server->seats, link) {
+    struct wm_pointer *pointer = seat->pointer;
+    if (pointer != NULL && pointer->cursor_name != NULL) {
+      theme_set_image(theme, pointer->cursor_name, pointer->cursor);
+    }
+  }
+}
+
+static int cursors_ready(int fd, uint32_t mask, void *data) {
+  (void)mask;
+  struct wm_cursors *cursors = data;
+
+  uint64_t count;
+  if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    wlr_log(L_ERROR, "Failed to read cursor theme eventfd");
+  }
+
+  struct wm_cursor_theme *theme;
+  wl_list_for_each(theme, &cursors->themes, link) {
+    if (theme->ready) {
+      continue;
+    }
+
+    pthread_mutex_lock(&cursors->lock);
+    bool loaded = theme->loaded;
+    pthread_mutex_unlock(&cursors->lock);
+
+    if (loaded) {
+      theme_ready(cursors, theme);
+    }
+  }
+
+  return 0;
+}
+
+void wm_cursors_load(struct wm_cursors* cursors, float scale) {
+  struct wm_cursor_theme *theme;
+  wl_list_for_each(theme, &cursors->themes, link) {
+    if (theme->scale == scale) {
+      return;
+    }
+  }
+
+  theme = calloc(1, sizeof(struct wm_cursor_theme));
+  theme->scale = scale;
+  wl_list_insert(&cursors->themes, &theme->link);
+
+  pthread_mutex_lock(&cursors->lock);
+  wl_list_insert(&cursors->queue, &theme->queue_link);
+  pthread_cond_signal(&cursors->cond);
+  pthread_mutex_unlock(&cursors->lock);
+}
+
+void wm_cursors_set_image(struct wm_cursors* cursors, const char* name,
+  struct wlr_cursor* cursor) {
+  struct wm_cursor_theme *theme;
+  wl_list_for_each(theme, &cursors->themes, link) {
+    if (theme->ready && theme->theme != NULL) {
+      theme_set_image(theme, name, cursor);
+    }
+  }
+}
+
+struct wm_cursors* wm_cursors_create(struct wm_server* server,
+  const char* name, uint32_t size) {
+  struct wm_cursors *cursors = calloc(1, sizeof(struct wm_cursors));
+  cursors->server = server;
+  cursors->name = name != NULL ? strdup(name) : NULL;
+  cursors->size = size;
+
+  wl_list_init(&cursors->themes);
+  wl_list_init(&cursors->queue);
+  pthread_mutex_init(&cursors->lock, NULL);
+  pthread_cond_init(&cursors->cond, NULL);
+
+  cursors->ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (cursors->ready_fd < 0) {
+    wlr_log(L_ERROR, "Failed to create cursor theme eventfd");
+    exit(1);
+  }
+
+  struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
+  cursors->ready_source = wl_event_loop_add_fd(loop, cursors->ready_fd,
+    WL_EVENT_READABLE, cursors_ready, cursors);
+
+  cursors->running = true;
+  if (pthread_create(&cursors->thread, NULL, cursors_thread, cursors) != 0) {
+    wlr_log(L_ERROR, "Failed to start the cursor theme thread");
+    exit(1);
+  }
+
+  return cursors;
+}
+
+void wm_cursors_destroy(struct wm_cursors* cursors) {
+  if (cursors == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&cursors->lock);
+  cursors->running = false;
+  pthread_cond_signal(&cursors->cond);
+  pthread_mutex_unlock(&cursors->lock);
+
+  pthread_join(cursors->thread, NULL);
+
+  struct wm_cursor_theme *theme, *tmp;
+  wl_list_for_each_safe(theme, tmp, &cursors->themes, link) {
+    if (theme->theme != NULL) {
+      wlr_xcursor_theme_destroy(theme->theme);
+    }
+    wl_list_remove(&theme->link);
+    free(theme);
+  }
+
+  wl_event_source_remove(cursors->ready_source);
+  close(cursors->ready_fd);
+
+  pthread_cond_destroy(&cursors->cond);
+  pthread_mutex_destroy(&cursors->lock);
+  free(cursors->name);
+  free(cursors);
+}
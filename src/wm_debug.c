@@ -0,0 +1,142 @@
+#include "wm_debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_surface.h>
+
+#include "wm_output.h"
+#include "wm_server.h"
+#include "wm_surface.h"
+#include "wm_window.h"
+
+static const char* mode_names[WM_DEBUG_MODE_COUNT] = {
+  [WM_DEBUG_OFF] = "off",
+  [WM_DEBUG_DAMAGE] = "damage",
+  [WM_DEBUG_OVERDRAW] = "overdraw",
+  [WM_DEBUG_CULLING] = "culling",
+};
+
+// Colours are premultiplied
+static const float damage_color[4] = { 0.25, 0.0, 0.25, 0.25 };
+static const float overdraw_color[4] = { 0.25, 0.08, 0.0, 0.25 };
+static const float culled_color[4] = { 1.0, 0.0, 0.0, 1.0 };
+
+#define CULLED_BORDER 2
+
+enum wm_debug_mode wm_debug_mode_from_env() {
+  const char *mode = getenv("BOXY_DEBUG");
+  if (mode == NULL) {
+    return WM_DEBUG_OFF;
+  }
+
+  for (int i = 0; i < WM_DEBUG_MODE_COUNT; i++) {
+    if (strcmp(mode, mode_names[i]) == 0) {
+      return i;
+    }
+  }
+
+  return WM_DEBUG_OFF;
+}
+
+void wm_debug_cycle_mode(struct wm_server* server) {
+  server->debug_mode = (server->debug_mode + 1) % WM_DEBUG_MODE_COUNT;
+  printf("Debug mode: %s\n", mode_names[server->debug_mode]);
+
+  struct wm_output *output;
+  wl_list_for_each(output, &server->outputs, link) {
+    wm_output_damage_whole(output);
+  }
+}
+
+static struct wlr_renderer* output_renderer(struct wm_output *output) {
+  return wlr_backend_get_renderer(output->wlr_output->backend);
+}
+
+struct overdraw_data {
+  struct wm_output *output;
+  double x;
+  double y;
+};
+
+static void overdraw_surface(struct wlr_surface *surface,
+  int sx, int sy, void *data) {
+  if (!wlr_surface_has_buffer(surface)) {
+    return;
+  }
+
+  struct overdraw_data *overdraw_data = data;
+  struct wlr_output *wlr_output = overdraw_data->output->wlr_output;
+  double scale = wlr_output->scale;
+
+  struct wlr_box box = {
+    .x = (overdraw_data->x + sx) * scale,
+    .y = (overdraw_data->y + sy) * scale,
+    .width = surface->current->width * scale,
+    .height = surface->current->height * scale
+  };
+
+  // Each layer blends over the last so more layers end up brighter
+  wlr_render_rect(output_renderer(overdraw_data->output), &box,
+    overdraw_color, wlr_output->transform_matrix);
+}
+
+void wm_debug_render_overdraw(struct wm_output* output,
+  struct wm_window* window, double x, double y) {
+  struct overdraw_data data = {
+    .output = output,
+    .x = x,
+    .y = y
+  };
+
+  window->surface->render(window->surface, overdraw_surface, &data);
+}
+
+void wm_debug_render_culled(struct wm_output* output,
+  struct wm_window* window, double x, double y) {
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = output_renderer(output);
+  double scale = wlr_output->scale;
+
+  struct wlr_box extents = wm_window_extents(window);
+
+  int x1 = (x + extents.x - window->x) * scale;
+  int y1 = (y + extents.y - window->y) * scale;
+  int width = extents.width * scale;
+  int height = extents.height * scale;
+
+  struct wlr_box edges[4] = {
+    { x1, y1, width, CULLED_BORDER },
+    { x1, y1 + height - CULLED_BORDER, width, CULLED_BORDER },
+    { x1, y1, CULLED_BORDER, height },
+    { x1 + width - CULLED_BORDER, y1, CULLED_BORDER, height },
+  };
+
+  for (int i = 0; i < 4; i++) {
+    wlr_render_rect(renderer, &edges[i], culled_color,
+      wlr_output->transform_matrix);
+  }
+}
+
+void wm_debug_render_damage(struct wm_output* output) {
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = output_renderer(output);
+
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(&output->damage, &nrects);
+  for (int i = 0; i < nrects; i++) {
+    struct wlr_box box = {
+      .x = rects[i].x1,
+      .y = rects[i].y1,
+      .width = rects[i].x2 - rects[i].x1,
+      .height = rects[i].y2 - rects[i].y1
+    };
+
+    wlr_render_rect(renderer, &box, damage_color,
+      wlr_output->transform_matrix);
+  }
+}
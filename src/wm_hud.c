@@ -0,0 +1,316 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_hud.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_output.h>
+
+#include "wm_output.h"
+#include "wm_server.h"
+#include "wm_window.h"
+
+#define HUD_MARGIN 8
+#define HUD_PADDING 8
+#define HUD_GAP 8
+#define HUD_FRAME_BAR 2
+#define HUD_FRAME_HEIGHT 100
+#define HUD_PX_PER_MS 2
+#define HUD_LOOP_BAR 4
+#define HUD_LOOP_HEIGHT 40
+#define HUD_ROW_HEIGHT 8
+#define HUD_RATE_BAR_MAX 160
+
+#define HUD_LOOP_PERIOD_NS 250000000L
+#define HUD_RATES_PERIOD_NS 1000000000L
+
+// Colours are premultiplied
+static const float panel_color[4] = { 0.0, 0.0, 0.0, 0.6 };
+static const float on_time_color[4] = { 0.2, 0.8, 0.2, 1.0 };
+static const float missed_color[4] = { 0.9, 0.2, 0.2, 1.0 };
+static const float render_color[4] = { 0.6, 0.6, 0.6, 0.6 };
+static const float budget_color[4] = { 0.9, 0.9, 0.2, 1.0 };
+static const float busy_color[4] = { 0.3, 0.5, 0.9, 1.0 };
+static const float commits_color[4] = { 0.9, 0.6, 0.2, 1.0 };
+static const float text_color[4] = { 1.0, 1.0, 1.0, 1.0 };
+
+// 3x5 digits, one row per entry with the high bit on the left
+static const uint8_t digits[10][5] = {
+  { 7, 5, 5, 5, 7 },
+  { 2, 6, 2, 2, 7 },
+  { 7, 1, 7, 4, 7 },
+  { 7, 1, 7, 1, 7 },
+  { 5, 5, 7, 1, 1 },
+  { 7, 4, 7, 1, 7 },
+  { 7, 4, 7, 5, 7 },
+  { 7, 1, 1, 1, 1 },
+  { 7, 5, 7, 5, 7 },
+  { 7, 5, 7, 1, 7 },
+};
+
+static long elapsed_ns(struct timespec *start, struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1000000000L +
+    (end->tv_nsec - start->tv_nsec);
+}
+
+static float output_budget_ms(struct wlr_output *wlr_output) {
+  if (wlr_output->refresh <= 0) {
+    return 1000.0f / 60.0f;
+  }
+  return 1000000.0f / wlr_output->refresh;
+}
+
+struct wm_hud* wm_hud_create(struct wm_server* server) {
+  struct wm_hud *hud = calloc(1, sizeof(struct wm_hud));
+  hud->server = server;
+  hud->visible = getenv("BOXY_HUD") != NULL;
+
+  clock_gettime(CLOCK_MONOTONIC, &hud->period_start);
+  hud->busy_start = hud->period_start;
+  hud->rates_start = hud->period_start;
+
+  return hud;
+}
+
+void wm_hud_destroy(struct wm_hud* hud) {
+  free(hud);
+}
+
+void wm_hud_toggle(struct wm_hud* hud) {
+  hud->visible = !hud->visible;
+}
+
+static void hud_update_rates(struct wm_hud *hud) {
+  hud->top_count = 0;
+
+  struct wm_window *window;
+  wl_list_for_each(window, &hud->server->windows, link) {
+    uint32_t rate = window->commits;
+    window->commits = 0;
+
+    int i = hud->top_count;
+    while (i > 0 && hud->top_rates[i - 1] < rate) {
+      if (i < WM_HUD_TOP_WINDOWS) {
+        hud->top_rates[i] = hud->top_rates[i - 1];
+        hud->top_ids[i] = hud->top_ids[i - 1];
+      }
+      i--;
+    }
+
+    if (i < WM_HUD_TOP_WINDOWS) {
+      hud->top_rates[i] = rate;
+      hud->top_ids[i] = window->id;
+      if (hud->top_count < WM_HUD_TOP_WINDOWS) {
+        hud->top_count++;
+      }
+    }
+  }
+}
+
+void wm_hud_loop_idle(struct wm_hud* hud, struct timespec* idle_start,
+  struct timespec* idle_end) {
+  hud->busy_ns += elapsed_ns(&hud->busy_start, idle_start);
+  hud->idle_ns += elapsed_ns(idle_start, idle_end);
+  hud->busy_start = *idle_end;
+
+  if (elapsed_ns(&hud->period_start, idle_end) >= HUD_LOOP_PERIOD_NS) {
+    long total = hud->busy_ns + hud->idle_ns;
+    hud->busy[hud->busy_head] = total > 0 ? 100.0f * hud->busy_ns / total : 0;
+    hud->busy_head = (hud->busy_head + 1) % WM_HUD_LOOP_SAMPLES;
+    hud->busy_ns = 0;
+    hud->idle_ns = 0;
+    hud->period_start = *idle_end;
+  }
+
+  if (elapsed_ns(&hud->rates_start, idle_end) >= HUD_RATES_PERIOD_NS) {
+    hud_update_rates(hud);
+    hud->rates_start = *idle_end;
+  }
+}
+
+void wm_hud_output_frame(struct wm_hud* hud, struct wm_output* output,
+  struct timespec* frame_start, struct timespec* render_end) {
+  (void)hud;
+  struct wm_hud_frames *frames = &output->frames;
+
+  float interval = elapsed_ns(&output->last_frame, frame_start) / 1000000.0f;
+  float render = elapsed_ns(frame_start, render_end) / 1000000.0f;
+  output->last_frame = *frame_start;
+
+  if (interval > 1.5f * output_budget_ms(output->wlr_output)) {
+    frames->missed++;
+  }
+
+  frames->interval[frames->head] = interval;
+  frames->render[frames->head] = render;
+  frames->head = (frames->head + 1) % WM_HUD_FRAME_SAMPLES;
+}
+
+// A rect continuing the previous one on the same row and colour widens it,
+// so runs of equal bars and digit rows cost one draw call
+static void hud_push(struct wm_hud *hud, int x, int y, int width, int height,
+  const float *color) {
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+
+  if (hud->rect_count > 0) {
+    struct wm_hud_rect *last = &hud->rects[hud->rect_count - 1];
+    if (last->color == color && last->box.y == y &&
+        last->box.height == height && last->box.x + last->box.width == x) {
+      last->box.width += width;
+      return;
+    }
+  }
+
+  if (hud->rect_count == WM_HUD_MAX_RECTS) {
+    return;
+  }
+
+  struct wm_hud_rect *rect = &hud->rects[hud->rect_count++];
+  rect->box.x = x;
+  rect->box.y = y;
+  rect->box.width = width;
+  rect->box.height = height;
+  rect->color = color;
+}
+
+static int hud_push_number(struct wm_hud *hud, int x, int y, int cell,
+  unsigned int value, const float *color) {
+  char text[16];
+  int length = snprintf(text, sizeof(text), "%u", value);
+
+  for (int i = 0; i < length; i++) {
+    const uint8_t *rows = digits[text[i] - '0'];
+    for (int row = 0; row < 5; row++) {
+      for (int column = 0; column < 3; column++) {
+        if (rows[row] & (4 >> column)) {
+          hud_push(hud, x + column * cell, y + row * cell,
+            cell, cell, color);
+        }
+      }
+    }
+    x += 4 * cell;
+  }
+
+  return length * 4 * cell;
+}
+
+static int hud_push_frames(struct wm_hud *hud, struct wm_output *output,
+  int x, int y) {
+  struct wm_hud_frames *frames = &output->frames;
+  float budget = output_budget_ms(output->wlr_output);
+
+  for (int i = 0; i < WM_HUD_FRAME_SAMPLES; i++) {
+    int sample = (frames->head + i) % WM_HUD_FRAME_SAMPLES;
+
+    int interval = frames->interval[sample] * HUD_PX_PER_MS;
+    if (interval > HUD_FRAME_HEIGHT) {
+      interval = HUD_FRAME_HEIGHT;
+    }
+
+    const float *color = frames->interval[sample] > 1.5f * budget ?
+      missed_color : on_time_color;
+
+    hud_push(hud, x + i * HUD_FRAME_BAR, y + HUD_FRAME_HEIGHT - interval,
+      HUD_FRAME_BAR, interval, color);
+  }
+
+  // Render bars go in a second pass so neighbouring ones can merge
+  for (int i = 0; i < WM_HUD_FRAME_SAMPLES; i++) {
+    int sample = (frames->head + i) % WM_HUD_FRAME_SAMPLES;
+
+    int render = frames->render[sample] * HUD_PX_PER_MS;
+    if (render > HUD_FRAME_HEIGHT) {
+      render = HUD_FRAME_HEIGHT;
+    }
+
+    hud_push(hud, x + i * HUD_FRAME_BAR, y + HUD_FRAME_HEIGHT - render,
+      HUD_FRAME_BAR, render, render_color);
+  }
+
+  int budget_y = HUD_FRAME_HEIGHT - budget * HUD_PX_PER_MS;
+  if (budget_y >= 0) {
+    hud_push(hud, x, y + budget_y,
+      WM_HUD_FRAME_SAMPLES * HUD_FRAME_BAR, 1, budget_color);
+  }
+
+  y += HUD_FRAME_HEIGHT + HUD_GAP;
+  hud_push_number(hud, x, y, 2, frames->missed, missed_color);
+
+  return HUD_FRAME_HEIGHT + HUD_GAP + 10;
+}
+
+static int hud_push_loop(struct wm_hud *hud, int x, int y) {
+  for (int i = 0; i < WM_HUD_LOOP_SAMPLES; i++) {
+    int sample = (hud->busy_head + i) % WM_HUD_LOOP_SAMPLES;
+    int height = hud->busy[sample] * HUD_LOOP_HEIGHT / 100.0f;
+    hud_push(hud, x + i * HUD_LOOP_BAR, y + HUD_LOOP_HEIGHT - height,
+      HUD_LOOP_BAR, height, busy_color);
+  }
+
+  int last = (hud->busy_head + WM_HUD_LOOP_SAMPLES - 1) % WM_HUD_LOOP_SAMPLES;
+  hud_push_number(hud, x + WM_HUD_LOOP_SAMPLES * HUD_LOOP_BAR + 4, y,
+    2, (unsigned int)hud->busy[last], text_color);
+
+  return HUD_LOOP_HEIGHT;
+}
+
+static int hud_push_windows(struct wm_hud *hud, int x, int y) {
+  for (int i = 0; i < hud->top_count; i++) {
+    int row_y = y + i * HUD_ROW_HEIGHT;
+
+    hud_push_number(hud, x, row_y, 1, hud->top_ids[i], text_color);
+
+    int length = hud->top_rates[i];
+    if (length > HUD_RATE_BAR_MAX) {
+      length = HUD_RATE_BAR_MAX;
+    }
+
+    hud_push(hud, x + 24, row_y, length, 5, commits_color);
+    hud_push_number(hud, x + 24 + length + 4, row_y, 1,
+      hud->top_rates[i], text_color);
+  }
+
+  return WM_HUD_TOP_WINDOWS * HUD_ROW_HEIGHT;
+}
+
+void wm_hud_render(struct wm_hud* hud, struct wm_output* output) {
+  if (hud == NULL || !hud->visible) {
+    return;
+  }
+
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+  double scale = wlr_output->scale;
+
+  int x = HUD_MARGIN + HUD_PADDING;
+  int y = HUD_MARGIN + HUD_PADDING;
+
+  // The panel is the first rect, its height is known once the rest is laid out
+  hud->rect_count = 0;
+  hud_push(hud, HUD_MARGIN, HUD_MARGIN, 1, 1, panel_color);
+
+  y += hud_push_frames(hud, output, x, y) + HUD_GAP;
+  y += hud_push_loop(hud, x, y) + HUD_GAP;
+  y += hud_push_windows(hud, x, y);
+
+  struct wlr_box *panel = &hud->rects[0].box;
+  panel->width = WM_HUD_FRAME_SAMPLES * HUD_FRAME_BAR + 2 * HUD_PADDING + 40;
+  panel->height = y + HUD_PADDING - HUD_MARGIN;
+
+  // Laid out in layout pixels, scaled here so merged rects keep exact edges
+  for (int i = 0; i < hud->rect_count; i++) {
+    struct wlr_box *rect = &hud->rects[i].box;
+    struct wlr_box box = {
+      .x = rect->x * scale,
+      .y = rect->y * scale,
+      .width = rect->width * scale,
+      .height = rect->height * scale
+    };
+    wlr_render_rect(renderer, &box, hud->rects[i].color,
+      wlr_output->transform_matrix);
+  }
+}
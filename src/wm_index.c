@@ -0,0 +1,193 @@
+#include "wm_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wm_window.h"
+
+static int cell_of(int coordinate) {
+  if (coordinate >= 0) {
+    return coordinate / WM_INDEX_CELL_SIZE;
+  }
+  return -((-coordinate + WM_INDEX_CELL_SIZE - 1) / WM_INDEX_CELL_SIZE);
+}
+
+static int floor_int(double value) {
+  int truncated = (int)value;
+  return value < truncated ? truncated - 1 : truncated;
+}
+
+static struct wm_index_bucket* index_bucket(struct wm_index *index,
+  int cell_x, int cell_y) {
+  uint32_t hash = ((uint32_t)cell_x * 73856093u) ^ ((uint32_t)cell_y * 19349663u);
+  return &index->buckets[hash % WM_INDEX_BUCKETS];
+}
+
+static struct wlr_box window_bounds(struct wm_window *window) {
+  struct wlr_box geometry = wm_window_geometry(window);
+  struct wlr_box *extents = &window->extents;
+
+  if (extents->width <= 0 || extents->height <= 0) {
+    return geometry;
+  }
+
+  int x1 = geometry.x < extents->x ? geometry.x : extents->x;
+  int y1 = geometry.y < extents->y ? geometry.y : extents->y;
+  int x2 = geometry.x + geometry.width;
+  int y2 = geometry.y + geometry.height;
+
+  if (extents->x + extents->width > x2) {
+    x2 = extents->x + extents->width;
+  }
+
+  if (extents->y + extents->height > y2) {
+    y2 = extents->y + extents->height;
+  }
+
+  struct wlr_box bounds = { x1, y1, x2 - x1, y2 - y1 };
+  return bounds;
+}
+
+static void bucket_add(struct wm_index_bucket *bucket,
+  struct wm_window *window, int cell_x, int cell_y) {
+  if (bucket->count == bucket->capacity) {
+    bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 8;
+    bucket->entries = realloc(bucket->entries,
+      bucket->capacity * sizeof(struct wm_index_entry));
+  }
+
+  struct wm_index_entry *entry = &bucket->entries[bucket->count++];
+  entry->window = window;
+  entry->cell_x = cell_x;
+  entry->cell_y = cell_y;
+}
+
+static void bucket_remove(struct wm_index_bucket *bucket,
+  struct wm_window *window, int cell_x, int cell_y) {
+  for (int i = 0; i < bucket->count; i++) {
+    struct wm_index_entry *entry = &bucket->entries[i];
+    if (entry->window == window && entry->cell_x == cell_x &&
+        entry->cell_y == cell_y) {
+      *entry = bucket->entries[--bucket->count];
+      return;
+    }
+  }
+}
+
+void wm_index_remove(struct wm_index* index, struct wm_window* window) {
+  if (!window->index_valid) {
+    return;
+  }
+
+  window->index_valid = false;
+
+  if (window->index_oversized) {
+    wl_list_remove(&window->index_link);
+    return;
+  }
+
+  struct wlr_box *box = &window->index_box;
+  int x2 = cell_of(box->x + box->width - 1);
+  int y2 = cell_of(box->y + box->height - 1);
+
+  for (int cy = cell_of(box->y); cy <= y2; cy++) {
+    for (int cx = cell_of(box->x); cx <= x2; cx++) {
+      bucket_remove(index_bucket(index, cx, cy), window, cx, cy);
+    }
+  }
+}
+
+void wm_index_update(struct wm_index* index, struct wm_window* window) {
+  struct wlr_box bounds = window_bounds(window);
+
+  if (window->index_valid &&
+      memcmp(&bounds, &window->index_box, sizeof(struct wlr_box)) == 0) {
+    return;
+  }
+
+  wm_index_remove(index, window);
+
+  if (bounds.width <= 0 || bounds.height <= 0) {
+    return;
+  }
+
+  window->index_box = bounds;
+  window->index_valid = true;
+
+  int x1 = cell_of(bounds.x);
+  int y1 = cell_of(bounds.y);
+  int x2 = cell_of(bounds.x + bounds.width - 1);
+  int y2 = cell_of(bounds.y + bounds.height - 1);
+
+  long cells = (long)(x2 - x1 + 1) * (y2 - y1 + 1);
+  window->index_oversized = cells > WM_INDEX_MAX_CELLS;
+
+  if (window->index_oversized) {
+    wl_list_insert(&index->oversized, &window->index_link);
+    return;
+  }
+
+  for (int cy = y1; cy <= y2; cy++) {
+    for (int cx = x1; cx <= x2; cx++) {
+      bucket_add(index_bucket(index, cx, cy), window, cx, cy);
+    }
+  }
+}
+
+static int insert_by_z(struct wm_window **windows, int count, int max,
+  struct wm_window *window) {
+  int i = count < max ? count : max - 1;
+  if (count == max && windows[i]->z >= window->z) {
+    return count;
+  }
+
+  while (i > 0 && windows[i - 1]->z < window->z) {
+    windows[i] = windows[i - 1];
+    i--;
+  }
+
+  windows[i] = window;
+  return count < max ? count + 1 : count;
+}
+
+// Fills windows with those whose bounds hold the point, topmost first
+int wm_index_query(struct wm_index* index, double x, double y,
+  struct wm_window** windows, int max) {
+  int count = 0;
+  int cell_x = cell_of(floor_int(x));
+  int cell_y = cell_of(floor_int(y));
+
+  struct wm_index_bucket *bucket = index_bucket(index, cell_x, cell_y);
+  for (int i = 0; i < bucket->count; i++) {
+    struct wm_index_entry *entry = &bucket->entries[i];
+    if (entry->cell_x != cell_x || entry->cell_y != cell_y) {
+      continue;
+    }
+
+    if (wlr_box_contains_point(&entry->window->index_box, x, y)) {
+      count = insert_by_z(windows, count, max, entry->window);
+    }
+  }
+
+  struct wm_window *window;
+  wl_list_for_each(window, &index->oversized, index_link) {
+    if (wlr_box_contains_point(&window->index_box, x, y)) {
+      count = insert_by_z(windows, count, max, window);
+    }
+  }
+
+  return count;
+}
+
+struct wm_index* wm_index_create() {
+  struct wm_index *index = calloc(1, sizeof(struct wm_index));
+  wl_list_init(&index->oversized);
+  return index;
+}
+
+void wm_index_destroy(struct wm_index* index) {
+  for (int i = 0; i < WM_INDEX_BUCKETS; i++) {
+    free(index->buckets[i].entries);
+  }
+  free(index);
+}
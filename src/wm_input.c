@@ -0,0 +1,169 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_input.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/types/wlr_input_device.h>
+
+#include "wm_server.h"
+
+static uint64_t timespec_ns(struct timespec *ts) {
+  return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+void wm_latency_record(struct wm_latency* latency, uint64_t ns) {
+  uint64_t bucket = ns / WM_LATENCY_BUCKET_NS;
+  if (bucket > WM_LATENCY_BUCKETS) {
+    bucket = WM_LATENCY_BUCKETS;
+  }
+
+  latency->buckets[bucket]++;
+  latency->count++;
+
+  if (ns > latency->max_ns) {
+    latency->max_ns = ns;
+  }
+}
+
+uint64_t wm_latency_percentile(struct wm_latency* latency, double percentile) {
+  if (latency->count == 0) {
+    return 0;
+  }
+
+  uint64_t target = latency->count * percentile / 100.0;
+  uint64_t seen = 0;
+
+  for (int i = 0; i <= WM_LATENCY_BUCKETS; i++) {
+    seen += latency->buckets[i];
+    if (seen > target) {
+      return (uint64_t)(i + 1) * WM_LATENCY_BUCKET_NS;
+    }
+  }
+
+  return latency->max_ns;
+}
+
+void wm_latency_print(struct wm_latency* latency) {
+  printf("%s latency: %lu events, p50 %luus p90 %luus p99 %luus max %luus\n",
+    latency->name, (unsigned long)latency->count,
+    (unsigned long)wm_latency_percentile(latency, 50) / 1000,
+    (unsigned long)wm_latency_percentile(latency, 90) / 1000,
+    (unsigned long)wm_latency_percentile(latency, 99) / 1000,
+    (unsigned long)latency->max_ns / 1000);
+}
+
+static int input_sigusr1(int signal, void *data) {
+  (void)signal;
+  struct wm_input *input = data;
+  wm_latency_print(&input->backend_latency);
+  wm_latency_print(&input->key_latency);
+
+  struct wm_device_latency *device;
+  wl_list_for_each(device, &input->devices, link) {
+    wm_latency_print(&device->latency);
+  }
+  return 0;
+}
+
+static bool event_age_ns(uint32_t time_msec, uint64_t *ns) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint32_t now_msec = timespec_ns(&now) / 1000000;
+
+  // Backends other than libinput stamp events with other clocks
+  uint32_t elapsed = now_msec - time_msec;
+  if (elapsed > 10000) {
+    return false;
+  }
+
+  *ns = (uint64_t)elapsed * 1000000;
+  return true;
+}
+
+void wm_input_backend_event(struct wm_input* input, uint32_t time_msec) {
+  uint64_t ns;
+  if (input == NULL || !event_age_ns(time_msec, &ns)) {
+    return;
+  }
+
+  wm_latency_record(&input->backend_latency, ns);
+}
+
+// Entries live as long as the input, so callers may hold on to them
+struct wm_device_latency* wm_input_device(struct wm_input* input,
+  struct wlr_input_device* wlr_device) {
+  if (input == NULL || wlr_device == NULL) {
+    return NULL;
+  }
+
+  const char *name = wlr_device->name ? wlr_device->name : "unnamed device";
+
+  struct wm_device_latency *device;
+  wl_list_for_each(device, &input->devices, link) {
+    if (strcmp(device->name, name) == 0) {
+      return device;
+    }
+  }
+
+  device = calloc(1, sizeof(struct wm_device_latency));
+  device->name = strdup(name);
+  device->latency.name = device->name;
+  wl_list_insert(input->devices.prev, &device->link);
+  return device;
+}
+
+void wm_input_delivered(struct wm_device_latency* device, uint32_t time_msec) {
+  uint64_t ns;
+  if (device == NULL || !event_age_ns(time_msec, &ns)) {
+    return;
+  }
+
+  wm_latency_record(&device->latency, ns);
+}
+
+// Time from the backend handing over a key to the client being notified
+void wm_input_key_dispatched(struct wm_input* input, struct timespec* start) {
+  if (input == NULL) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  wm_latency_record(&input->key_latency, timespec_ns(&now) - timespec_ns(start));
+}
+
+struct wm_input* wm_input_create(struct wm_server* server) {
+  struct wm_input *input = calloc(1, sizeof(struct wm_input));
+  input->server = server;
+  input->backend_latency.name = "Backend input";
+  input->key_latency.name = "Key dispatch";
+
+  wl_list_init(&input->devices);
+
+  struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
+  // Added before any thread starts so they all inherit the blocked signal
+  input->sigusr1_source = wl_event_loop_add_signal(loop, SIGUSR1,
+    input_sigusr1, input);
+
+  return input;
+}
+
+void wm_input_destroy(struct wm_input* input) {
+  if (input == NULL) {
+    return;
+  }
+
+  wl_event_source_remove(input->sigusr1_source);
+
+  struct wm_device_latency *device, *tmp_device;
+  wl_list_for_each_safe(device, tmp_device, &input->devices, link) {
+    wl_list_remove(&device->link);
+    free(device->name);
+    free(device);
+  }
+
+  free(input);
+}
@@ -1,147 +1,430 @@
 #include "wm_keyboard.h"
 
 #include <stdlib.h>
-#include <unistd.h>
+#include <time.h>
 #include <xkbcommon/xkbcommon.h>
-#include <wlr/types/wlr_input_device.h>
+#include <wlr/interfaces/wlr_input_device.h>
+#include <wlr/interfaces/wlr_keyboard.h>
 #include <wlr/backend.h>
 #include <wlr/util/log.h>
 #include <wlr/types/wlr_seat.h>
 
+#include "wm_bindings.h"
+#include "wm_input.h"
+#include "wm_keymap.h"
 #include "wm_server.h"
+#include "wm_pointer.h"
 #include "wm_seat.h"
+#include "wm_timestamps.h"
 
-void wm_keyboard_destroy(struct wm_keyboard* keyboard) {
-  wl_list_remove(&keyboard->link);
-  free(keyboard);
+struct keyboard_pending {
+  bool modifiers;
+  struct wlr_event_keyboard_key key;
+  struct wlr_keyboard_modifiers mods;
+};
+
+static void group_keyboard_destroy(struct wlr_keyboard *wlr_keyboard) {
+  // Embedded in the group, freed with it
+  (void)wlr_keyboard;
 }
 
-void exec_command(const char* shell_cmd) {
-  printf("Executing: %s\n", shell_cmd);
-  pid_t pid = fork();
-  if (pid < 0) {
-    wlr_log(L_ERROR, "cannot execute binding command: fork() failed");
-    return;
-  } else if (pid == 0) {
-    execl("/bin/sh", "/bin/sh", "-c", shell_cmd, (void *)NULL);
+static void group_keyboard_led_update(struct wlr_keyboard *wlr_keyboard,
+  uint32_t leds) {
+  struct wm_keyboard_group *group =
+    wl_container_of(wlr_keyboard, group, keyboard);
+
+  struct wm_keyboard *keyboard;
+  wl_list_for_each(keyboard, &group->keyboards, group_link) {
+    wlr_keyboard_led_update(keyboard->device->keyboard, leds);
   }
 }
 
-static bool mod_state(const char* mod_name, struct xkb_keymap* keymap, struct xkb_state* state) {
-  xkb_mod_index_t index = xkb_keymap_mod_get_index(keymap, mod_name);
-
-  int active = xkb_state_mod_index_is_active(state,
-    index, XKB_STATE_MODS_DEPRESSED);
+static struct wlr_keyboard_impl group_keyboard_impl = {
+  .destroy = group_keyboard_destroy,
+  .led_update = group_keyboard_led_update
+};
 
-  return active;
+static void group_device_destroy(struct wlr_input_device *device) {
+  (void)device;
 }
 
-void wm_keyboard_modifiers_event(struct wm_keyboard *keyboard) {
-  wlr_seat_keyboard_notify_modifiers(keyboard->seat->seat,
-    &keyboard->device->keyboard->modifiers);
+static struct wlr_input_device_impl group_device_impl = {
+  .destroy = group_device_destroy
+};
 
-  struct xkb_state* state = keyboard->device->keyboard->xkb_state;
-  struct xkb_keymap* keymap = keyboard->device->keyboard->keymap;
+static uint32_t group_mods(struct wm_keyboard_group *group) {
+  return wm_binding_mods_mask(&group->keymap->mods,
+    group->keyboard.modifiers.depressed);
+}
 
-  int super = mod_state(XKB_MOD_NAME_LOGO, keymap, state);
-  int alt = mod_state(XKB_MOD_NAME_ALT, keymap, state);
+void wm_keyboard_group_modifiers_event(struct wm_keyboard_group *group) {
+  wlr_seat_keyboard_notify_modifiers(group->seat->seat,
+    &group->keyboard.modifiers);
 
-  if (!super && !alt) {
-    wm_server_commit_window_switch(keyboard->seat->server, keyboard->seat);
+  uint32_t mods = group_mods(group);
+
+  if (!(mods & (WM_BINDING_MOD_LOGO | WM_BINDING_MOD_ALT))) {
+    wm_server_commit_window_switch(group->seat->server, group->seat);
   }
 }
 
-void wm_keyboard_key_event(struct wm_keyboard *keyboard,
+void wm_keyboard_group_key_event(struct wm_keyboard_group *group,
   struct wlr_event_keyboard_key *event) {
+  struct wm_seat *seat = group->seat;
 
-  struct xkb_state* state = keyboard->device->keyboard->xkb_state;
-  struct xkb_keymap* keymap = keyboard->device->keyboard->keymap;
+  if (seat->pointer) {
+    wm_pointer_flush_motion(seat->pointer);
+  }
 
-  int super = mod_state(XKB_MOD_NAME_LOGO, keymap, state);
-  int shift = mod_state(XKB_MOD_NAME_SHIFT, keymap, state);
-  int ctrl = mod_state(XKB_MOD_NAME_CTRL, keymap, state);
-  int alt = mod_state(XKB_MOD_NAME_ALT, keymap, state);
+  struct wm_bindings *bindings = seat->server->bindings;
+  struct xkb_state* state = group->keyboard.xkb_state;
 
+  uint32_t mods = group_mods(group);
+  bool release = event->state == WLR_KEY_RELEASED;
   uint32_t keycode = event->keycode + 8;
 
   const xkb_keysym_t *syms;
   int nsyms = xkb_state_key_get_syms(state, keycode, &syms);
 
-  if (event->state == WLR_KEY_PRESSED) {
-    for (int i = 0; i < nsyms; i++) {
-      xkb_keysym_t sym = syms[i];
-
-      if (super && sym == XKB_KEY_Up) {
-        wm_server_maximize_focused_window(keyboard->seat->server);
-        return;
-      }
-
-      if (super && sym == XKB_KEY_k) {
-        wm_server_switch_window(keyboard->seat->server);
-        return;
-      }
-
-      if (super && sym == XKB_KEY_b) {
-        exec_command("chrome");
-        return;
-      }
-
-      if (super && sym == XKB_KEY_s) {
-        exec_command("slack-desktop");
-        return;
-      }
-
-      if (sym == XKB_KEY_F1) {
-        exec_command("epiphany");
-        return;
-      }
-
-      if (alt && sym == XKB_KEY_Tab) {
-        wm_server_switch_window(keyboard->seat->server);
-        return;
-      }
+  for (int i = 0; i < nsyms; i++) {
+    struct wm_binding *binding = wm_bindings_find(bindings,
+      mods, syms[i], release);
+
+    if (binding == NULL) {
+      continue;
     }
-  }
 
-  if (event->state == WLR_KEY_RELEASED) {
-    for (int i = 0; i < nsyms; i++) {
-      xkb_keysym_t sym = syms[i];
-      if (sym == XKB_KEY_BackSpace) {
-        if (ctrl && alt) {
-          wl_display_terminate(keyboard->seat->server->wl_display);
-          return;
-        }
-      }
-
-      if (sym == XKB_KEY_Return) {
-        if (super && !shift) {
-          exec_command("gnome-terminal");
-        }
-        if (super && shift) {
-          exec_command("weston-terminal");
-        }
-      }
+    wm_binding_run(binding, seat);
+
+    // The client already saw the press, so releases still go through
+    if (!release) {
+      return;
     }
   }
 
+  wm_timestamps_keyboard(seat->server->timestamps, seat, event->time_msec);
+
   wlr_seat_keyboard_notify_key(
-    keyboard->seat->seat,
+    seat->seat,
     event->time_msec,
     event->keycode,
     event->state
   );
 }
 
-static void keyboard_modifiers_notify(struct wl_listener *listener, void *data) {
+static void group_modifiers_notify(struct wl_listener *listener, void *data) {
   (void)data;
-  struct wm_keyboard *keyboard = wl_container_of(listener, keyboard, modifiers);
-  wm_keyboard_modifiers_event(keyboard);
+  struct wm_keyboard_group *group = wl_container_of(listener, group, modifiers);
+  wm_keyboard_group_modifiers_event(group);
+}
+
+static void group_key_notify(struct wl_listener *listener, void *data) {
+  struct wlr_event_keyboard_key *event = data;
+  struct wm_keyboard_group *group = wl_container_of(listener, group, key);
+  struct wm_input *input = group->seat->server->input;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  wm_keyboard_group_key_event(group, event);
+
+  wm_input_key_dispatched(input, &start);
+}
+
+static struct wm_keyboard_group* keyboard_group_create(struct wm_seat *seat,
+  struct wm_keymap *keymap) {
+  struct wm_keyboard_group *group = calloc(1, sizeof(struct wm_keyboard_group));
+  group->seat = seat;
+  group->keymap = keymap;
+  wl_list_init(&group->keyboards);
+
+  wlr_input_device_init(&group->device, WLR_INPUT_DEVICE_KEYBOARD,
+    &group_device_impl, "boxy keyboard group", 0, 0);
+  wlr_keyboard_init(&group->keyboard, &group_keyboard_impl);
+  group->device.keyboard = &group->keyboard;
+
+  int repeat_rate = 25;
+  int repeat_delay = 600;
+  wlr_keyboard_set_repeat_info(&group->keyboard, repeat_rate, repeat_delay);
+  wlr_keyboard_set_keymap(&group->keyboard, keymap->keymap);
+
+  wl_signal_add(&group->keyboard.events.key, &group->key);
+  group->key.notify = group_key_notify;
+
+  wl_signal_add(&group->keyboard.events.modifiers, &group->modifiers);
+  group->modifiers.notify = group_modifiers_notify;
+
+  wl_list_insert(&seat->keyboard_groups, &group->link);
+
+  return group;
+}
+
+static void keyboard_group_destroy(struct wm_keyboard_group *group) {
+  wl_list_remove(&group->key.link);
+  wl_list_remove(&group->modifiers.link);
+  wl_list_remove(&group->link);
+
+  wlr_input_device_destroy(&group->device);
+  free(group);
+}
+
+static void keyboard_join_group(struct wm_keyboard *keyboard) {
+  struct wm_seat *seat = keyboard->seat;
+
+  struct wm_keyboard_group *group;
+  bool found = false;
+  wl_list_for_each(group, &seat->keyboard_groups, link) {
+    if (group->keymap == keyboard->keymap) {
+      found = true;
+      break;
+    }
+  }
+
+  if (!found) {
+    group = keyboard_group_create(seat, keyboard->keymap);
+  }
+
+  keyboard->group = group;
+  wl_list_insert(&group->keyboards, &keyboard->group_link);
+
+  if (seat->seat->keyboard_state.keyboard != &group->keyboard) {
+    wlr_seat_set_keyboard(seat->seat, &group->device);
+  }
+}
+
+// Typing on another group's device makes it the seat keyboard, which
+// sends clients its keymap
+static void group_make_active(struct wm_keyboard_group *group) {
+  struct wlr_seat *wlr_seat = group->seat->seat;
+  if (wlr_seat->keyboard_state.keyboard != &group->keyboard) {
+    wlr_seat_set_keyboard(wlr_seat, &group->device);
+  }
+}
+
+// Keys are replayed into the group so its xkb state is shared across devices
+static bool group_forward_key(struct wm_keyboard_group *group,
+  struct wlr_event_keyboard_key *event) {
+  if (event->keycode >= WM_KEYBOARD_KEYCODES) {
+    return false;
+  }
+
+  uint8_t *pressed = &group->pressed[event->keycode];
+
+  if (event->state == WLR_KEY_PRESSED) {
+    if ((*pressed)++ > 0) {
+      return false;
+    }
+  } else if (*pressed == 0 || --(*pressed) > 0) {
+    return false;
+  }
+
+  if (event->state == WLR_KEY_PRESSED) {
+    group_make_active(group);
+  }
+
+  struct wlr_event_keyboard_key group_event = *event;
+  group_event.update_state = true;
+  wlr_keyboard_notify_key(&group->keyboard, &group_event);
+
+  return true;
+}
+
+static void keyboard_leave_group(struct wm_keyboard *keyboard) {
+  struct wm_keyboard_group *group = keyboard->group;
+  if (group == NULL) {
+    return;
+  }
+
+  // Keys still held on a departing device are released in the group
+  struct wlr_keyboard *wlr_keyboard = keyboard->device->keyboard;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (size_t i = 0; i < wlr_keyboard->num_keycodes; i++) {
+    struct wlr_event_keyboard_key event = {
+      .time_msec = now.tv_sec * 1000 + now.tv_nsec / 1000000,
+      .keycode = wlr_keyboard->keycodes[i],
+      .update_state = true,
+      .state = WLR_KEY_RELEASED
+    };
+    group_forward_key(group, &event);
+  }
+
+  keyboard->group = NULL;
+  wl_list_remove(&keyboard->group_link);
+
+  if (!wl_list_empty(&group->keyboards)) {
+    return;
+  }
+
+  struct wm_seat *seat = group->seat;
+  bool active = seat->seat->keyboard_state.keyboard == &group->keyboard;
+
+  keyboard_group_destroy(group);
+
+  if (!active) {
+    return;
+  }
+
+  wlr_seat_set_keyboard(seat->seat, NULL);
+
+  if (!wl_list_empty(&seat->keyboard_groups)) {
+    struct wm_keyboard_group *other =
+      wl_container_of(seat->keyboard_groups.next, other, link);
+    wlr_seat_set_keyboard(seat->seat, &other->device);
+  }
+}
+
+void wm_keyboard_destroy(struct wm_keyboard* keyboard) {
+  keyboard_leave_group(keyboard);
+  wl_array_release(&keyboard->pending);
+
+  wl_list_remove(&keyboard->link);
+  wl_list_remove(&keyboard->keymap_link);
+  wl_list_remove(&keyboard->key.link);
+  wl_list_remove(&keyboard->destroy.link);
+
+  if (keyboard->keymap) {
+    wm_keymap_unref(keyboard->keymap);
+  }
+
+  free(keyboard);
 }
 
 static void keyboard_key_notify(struct wl_listener *listener, void *data) {
   struct wlr_event_keyboard_key *event = data;
   struct wm_keyboard *keyboard = wl_container_of(listener, keyboard, key);
-  wm_keyboard_key_event(keyboard, event);
+  wm_input_backend_event(keyboard->seat->server->input, event->time_msec);
+
+  // Keys are dropped until the shared keymap has finished compiling
+  if (keyboard->group == NULL) {
+    return;
+  }
+
+  if (group_forward_key(keyboard->group, event)) {
+    wm_input_delivered(keyboard->latency, event->time_msec);
+  }
+}
+
+static void keyboard_destroy_notify(struct wl_listener *listener, void *data) {
+  (void)data;
+  struct wm_keyboard *keyboard = wl_container_of(listener, keyboard, destroy);
+  wm_keyboard_destroy(keyboard);
+}
+
+static bool keyboard_waiting(struct wm_keyboard *keyboard) {
+  return !wl_list_empty(&keyboard->keymap_link);
+}
+
+static void keyboard_drop_pending(struct wm_keyboard *keyboard) {
+  wl_list_remove(&keyboard->keymap_link);
+  wl_list_init(&keyboard->keymap_link);
+  wl_array_release(&keyboard->pending);
+  wl_array_init(&keyboard->pending);
+}
+
+// Held input has no xkb state to be read with, so it goes too
+void wm_keyboard_keymap_failed(struct wm_keyboard* keyboard) {
+  keyboard_drop_pending(keyboard);
+}
+
+void wm_keyboard_set_keymap(struct wm_keyboard* keyboard,
+  struct wm_keymap* keymap) {
+  keyboard->keymap = keymap;
+
+  wlr_keyboard_set_keymap(keyboard->device->keyboard, keymap->keymap);
+  keyboard_join_group(keyboard);
+
+  struct keyboard_pending *pending;
+  wl_array_for_each(pending, &keyboard->pending) {
+    if (pending->modifiers) {
+      wm_keyboard_notify_modifiers(keyboard, &pending->mods);
+    } else {
+      wm_keyboard_notify_key(keyboard, &pending->key);
+    }
+  }
+
+  wl_array_release(&keyboard->pending);
+  wl_array_init(&keyboard->pending);
+}
+
+static void keyboard_attach_keymap(struct wm_keyboard *keyboard,
+  struct wm_keymap *keymap) {
+  keyboard->keymap = keymap;
+  wm_keymap_ref(keymap);
+
+  if (keymap->ready && keymap->keymap == NULL) {
+    wlr_log(L_ERROR, "Keyboard %s not attached, its keymap failed to compile",
+      keyboard->device->name);
+  } else if (keymap->ready) {
+    wm_keyboard_set_keymap(keyboard, keymap);
+  } else {
+    wl_list_insert(&keymap->keyboards, &keyboard->keymap_link);
+  }
+}
+
+void wm_keyboard_use_keymap(struct wm_keyboard* keyboard,
+  struct wm_keymap* keymap) {
+  if (keyboard->keymap == keymap) {
+    return;
+  }
+
+  keyboard_leave_group(keyboard);
+
+  // Input held for the keymap being replaced would be read with this one
+  keyboard_drop_pending(keyboard);
+
+  struct wm_keymap *old = keyboard->keymap;
+  keyboard->keymap = NULL;
+  if (old) {
+    wm_keymap_unref(old);
+  }
+
+  keyboard_attach_keymap(keyboard, keymap);
+}
+
+void wm_keyboard_notify_key(struct wm_keyboard* keyboard,
+  struct wlr_event_keyboard_key* event) {
+  if (keyboard_waiting(keyboard)) {
+    struct keyboard_pending *pending =
+      wl_array_add(&keyboard->pending, sizeof(struct keyboard_pending));
+    if (pending) {
+      *pending = (struct keyboard_pending){ .key = *event };
+    }
+    return;
+  }
+
+  // Without a keymap the device has no xkb state to update
+  if (keyboard->group == NULL) {
+    return;
+  }
+
+  wlr_keyboard_notify_key(keyboard->device->keyboard, event);
+}
+
+// Modifiers go straight to the group, it is the state clients see
+void wm_keyboard_notify_modifiers(struct wm_keyboard* keyboard,
+  struct wlr_keyboard_modifiers* modifiers) {
+  if (keyboard_waiting(keyboard)) {
+    struct keyboard_pending *pending =
+      wl_array_add(&keyboard->pending, sizeof(struct keyboard_pending));
+    if (pending) {
+      *pending = (struct keyboard_pending){
+        .modifiers = true,
+        .mods = *modifiers
+      };
+    }
+    return;
+  }
+
+  struct wm_keyboard_group *group = keyboard->group;
+  if (group == NULL) {
+    return;
+  }
+
+  group_make_active(group);
+  wlr_keyboard_notify_modifiers(&group->keyboard, modifiers->depressed,
+    modifiers->latched, modifiers->locked, modifiers->group);
 }
 
 struct wm_keyboard* wm_keyboard_create(struct wlr_input_device* device,
@@ -151,40 +434,22 @@ struct wm_keyboard* wm_keyboard_create(struct wlr_input_device* device,
   keyboard->seat = seat;
 
   wl_list_insert(&seat->keyboards, &keyboard->link);
+  wl_list_init(&keyboard->keymap_link);
+  wl_array_init(&keyboard->pending);
 
-  int repeat_rate = 25;
-  int repeat_delay = 600;
-  wlr_keyboard_set_repeat_info(device->keyboard, repeat_rate, repeat_delay);
+  keyboard->latency = wm_input_device(seat->server->input, device);
 
   wl_signal_add(&device->keyboard->events.key, &keyboard->key);
   keyboard->key.notify = keyboard_key_notify;
 
-  wl_signal_add(&device->keyboard->events.modifiers, &keyboard->modifiers);
-  keyboard->modifiers.notify = keyboard_modifiers_notify;
-
-  wlr_seat_set_keyboard(seat->seat, device);
-
-  struct xkb_rule_names rules = { 0 };
-  rules.rules = getenv("XKB_DEFAULT_RULES");
-  rules.model = getenv("XKB_DEFAULT_MODEL");
-  rules.layout = getenv("XKB_DEFAULT_LAYOUT");
-  rules.variant = getenv("XKB_DEFAULT_VARIANT");
-  rules.options = getenv("XKB_DEFAULT_OPTIONS");
-
-  struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-
-  if (!context) {
-    wlr_log(L_ERROR, "Failed to create XKB context");
-    exit(1);
-  }
-
-  struct xkb_keymap *keymap = xkb_map_new_from_names(context,
-    &rules, XKB_KEYMAP_COMPILE_NO_FLAGS);
+  wl_signal_add(&device->events.destroy, &keyboard->destroy);
+  keyboard->destroy.notify = keyboard_destroy_notify;
 
-  wlr_keyboard_set_keymap(device->keyboard, keymap);
+  struct xkb_rule_names rules;
+  wm_keymaps_default_rules(&rules);
 
-  xkb_context_unref(context);
-  xkb_keymap_unref(keymap);
+  struct wm_keymap *keymap = wm_keymaps_get(seat->server->keymaps, &rules);
+  keyboard_attach_keymap(keyboard, keymap);
 
   return keyboard;
 }
@@ -0,0 +1,318 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_keymap.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+#include "wm_keyboard.h"
+#include "wm_server.h"
+
+static char* copy_name(const char *name) {
+  return name != NULL ? strdup(name) : NULL;
+}
+
+static bool same_name(const char *a, const char *b) {
+  if (a == NULL || b == NULL) {
+    return a == b;
+  }
+  return strcmp(a, b) == 0;
+}
+
+static bool keymap_matches(struct wm_keymap *keymap,
+  const struct xkb_rule_names *rules) {
+  return keymap->string == NULL &&
+    same_name(keymap->rules, rules->rules) &&
+    same_name(keymap->model, rules->model) &&
+    same_name(keymap->layout, rules->layout) &&
+    same_name(keymap->variant, rules->variant) &&
+    same_name(keymap->options, rules->options);
+}
+
+static void* keymaps_thread(void *data) {
+  struct wm_keymaps *keymaps = data;
+
+  pthread_mutex_lock(&keymaps->lock);
+
+  while (true) {
+    while (keymaps->running && wl_list_empty(&keymaps->queue)) {
+      pthread_cond_wait(&keymaps->cond, &keymaps->lock);
+    }
+
+    if (!keymaps->running) {
+      break;
+    }
+
+    struct wm_keymap *keymap = wl_container_of(keymaps->queue.prev,
+      keymap, queue_link);
+    wl_list_remove(&keymap->queue_link);
+    wl_list_init(&keymap->queue_link);
+
+    pthread_mutex_unlock(&keymaps->lock);
+
+    struct xkb_keymap *compiled;
+
+    if (keymap->string) {
+      compiled = xkb_keymap_new_from_string(keymaps->context, keymap->string,
+        XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    } else {
+      struct xkb_rule_names rules = {
+        .rules = keymap->rules,
+        .model = keymap->model,
+        .layout = keymap->layout,
+        .variant = keymap->variant,
+        .options = keymap->options
+      };
+      compiled = xkb_keymap_new_from_names(keymaps->context, &rules,
+        XKB_KEYMAP_COMPILE_NO_FLAGS);
+    }
+
+    // A client's own keymap has no rules to fall back from
+    bool fallback = compiled == NULL && keymap->string == NULL;
+    if (fallback) {
+      struct xkb_rule_names fallback_rules = {
+        .rules = WM_KEYMAP_FALLBACK_RULES,
+        .model = WM_KEYMAP_FALLBACK_MODEL,
+        .layout = WM_KEYMAP_FALLBACK_LAYOUT
+      };
+      compiled = xkb_keymap_new_from_names(keymaps->context, &fallback_rules,
+        XKB_KEYMAP_COMPILE_NO_FLAGS);
+    }
+
+    pthread_mutex_lock(&keymaps->lock);
+    keymap->keymap = compiled;
+    keymap->fallback = fallback;
+    keymap->compiled = true;
+
+    uint64_t one = 1;
+    if (write(keymaps->ready_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+      wlr_log(L_ERROR, "Failed to wake the main loop for a keymap");
+    }
+  }
+
+  pthread_mutex_unlock(&keymaps->lock);
+  return NULL;
+}
+
+static void keymap_free(struct wm_keymap *keymap) {
+  xkb_keymap_unref(keymap->keymap);
+  free(keymap->rules);
+  free(keymap->model);
+  free(keymap->layout);
+  free(keymap->variant);
+  free(keymap->options);
+  free(keymap->string);
+  wl_list_remove(&keymap->link);
+  free(keymap);
+}
+
+static void keymap_ready(struct wm_keymap *keymap) {
+  keymap->ready = true;
+
+  const char *layout = keymap->string ? "client" :
+    keymap->layout ? keymap->layout : "default";
+
+  if (keymap->fallback) {
+    wlr_log(L_ERROR, "Failed to compile keymap for layout %s, using %s",
+      layout, WM_KEYMAP_FALLBACK_LAYOUT);
+  }
+
+  // Waiting keyboards are let go of and stay without a keymap
+  if (keymap->keymap == NULL) {
+    wlr_log(L_ERROR, "Failed to compile the %s keymap, keyboards "
+      "using layout %s are not attached",
+      keymap->string ? "client" : "fallback", layout);
+
+    struct wm_keyboard *keyboard, *tmp;
+    wl_list_for_each_safe(keyboard, tmp, &keymap->keyboards, keymap_link) {
+      wm_keyboard_keymap_failed(keyboard);
+    }
+    return;
+  }
+
+  wm_binding_mods_init(&keymap->mods, keymap->keymap);
+
+  struct wm_keyboard *keyboard, *tmp;
+  wl_list_for_each_safe(keyboard, tmp, &keymap->keyboards, keymap_link) {
+    wl_list_remove(&keyboard->keymap_link);
+    wl_list_init(&keyboard->keymap_link);
+    wm_keyboard_set_keymap(keyboard, keymap);
+  }
+}
+
+static int keymaps_ready(int fd, uint32_t mask, void *data) {
+  (void)mask;
+  struct wm_keymaps *keymaps = data;
+
+  uint64_t count;
+  if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    wlr_log(L_ERROR, "Failed to read keymap eventfd");
+  }
+
+  struct wm_keymap *keymap, *tmp;
+  wl_list_for_each_safe(keymap, tmp, &keymaps->keymaps, link) {
+    if (keymap->ready) {
+      continue;
+    }
+
+    pthread_mutex_lock(&keymaps->lock);
+    bool compiled = keymap->compiled;
+    pthread_mutex_unlock(&keymaps->lock);
+
+    if (!compiled) {
+      continue;
+    }
+
+    keymap_ready(keymap);
+
+    // Every keyboard let go of it while it compiled
+    if (keymap->refs == 0 && keymap->string) {
+      keymap_free(keymap);
+    }
+  }
+
+  return 0;
+}
+
+void wm_keymaps_default_rules(struct xkb_rule_names* rules) {
+  memset(rules, 0, sizeof(struct xkb_rule_names));
+  rules->rules = getenv("XKB_DEFAULT_RULES");
+  rules->model = getenv("XKB_DEFAULT_MODEL");
+  rules->layout = getenv("XKB_DEFAULT_LAYOUT");
+  rules->variant = getenv("XKB_DEFAULT_VARIANT");
+  rules->options = getenv("XKB_DEFAULT_OPTIONS");
+}
+
+static void keymaps_queue(struct wm_keymaps *keymaps,
+  struct wm_keymap *keymap) {
+  wl_list_init(&keymap->keyboards);
+  wl_list_insert(&keymaps->keymaps, &keymap->link);
+
+  pthread_mutex_lock(&keymaps->lock);
+  wl_list_insert(&keymaps->queue, &keymap->queue_link);
+  pthread_cond_signal(&keymaps->cond);
+  pthread_mutex_unlock(&keymaps->lock);
+}
+
+struct wm_keymap* wm_keymaps_get(struct wm_keymaps* keymaps,
+  const struct xkb_rule_names* rules) {
+  struct wm_keymap *keymap;
+  wl_list_for_each(keymap, &keymaps->keymaps, link) {
+    if (keymap_matches(keymap, rules)) {
+      return keymap;
+    }
+  }
+
+  keymap = calloc(1, sizeof(struct wm_keymap));
+  keymap->rules = copy_name(rules->rules);
+  keymap->model = copy_name(rules->model);
+  keymap->layout = copy_name(rules->layout);
+  keymap->variant = copy_name(rules->variant);
+  keymap->options = copy_name(rules->options);
+  keymaps_queue(keymaps, keymap);
+
+  return keymap;
+}
+
+// Clients tend to send the same text over and over, e.g. one per
+// input method activation, so it is compiled once
+struct wm_keymap* wm_keymaps_get_string(struct wm_keymaps* keymaps,
+  const char* string) {
+  struct wm_keymap *keymap;
+  wl_list_for_each(keymap, &keymaps->keymaps, link) {
+    if (keymap->string && strcmp(keymap->string, string) == 0) {
+      return keymap;
+    }
+  }
+
+  keymap = calloc(1, sizeof(struct wm_keymap));
+  keymap->string = strdup(string);
+  keymaps_queue(keymaps, keymap);
+
+  return keymap;
+}
+
+void wm_keymap_ref(struct wm_keymap* keymap) {
+  keymap->refs++;
+}
+
+// One still compiling is freed by keymaps_ready, the thread owns it until then
+void wm_keymap_unref(struct wm_keymap* keymap) {
+  if (--keymap->refs > 0 || keymap->string == NULL || !keymap->ready) {
+    return;
+  }
+
+  keymap_free(keymap);
+}
+
+struct wm_keymaps* wm_keymaps_create(struct wm_server* server) {
+  struct wm_keymaps *keymaps = calloc(1, sizeof(struct wm_keymaps));
+  keymaps->server = server;
+
+  wl_list_init(&keymaps->keymaps);
+  wl_list_init(&keymaps->queue);
+  pthread_mutex_init(&keymaps->lock, NULL);
+  pthread_cond_init(&keymaps->cond, NULL);
+
+  keymaps->context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+
+  if (!keymaps->context) {
+    wlr_log(L_ERROR, "Failed to create XKB context");
+    exit(1);
+  }
+
+  keymaps->ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (keymaps->ready_fd < 0) {
+    wlr_log(L_ERROR, "Failed to create keymap eventfd");
+    exit(1);
+  }
+
+  struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
+  keymaps->ready_source = wl_event_loop_add_fd(loop, keymaps->ready_fd,
+    WL_EVENT_READABLE, keymaps_ready, keymaps);
+
+  keymaps->running = true;
+  if (pthread_create(&keymaps->thread, NULL, keymaps_thread, keymaps) != 0) {
+    wlr_log(L_ERROR, "Failed to start the keymap thread");
+    exit(1);
+  }
+
+  return keymaps;
+}
+
+void wm_keymaps_destroy(struct wm_keymaps* keymaps) {
+  if (keymaps == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&keymaps->lock);
+  keymaps->running = false;
+  pthread_cond_signal(&keymaps->cond);
+  pthread_mutex_unlock(&keymaps->lock);
+
+  pthread_join(keymaps->thread, NULL);
+
+  struct wm_keymap *keymap, *tmp;
+  wl_list_for_each_safe(keymap, tmp, &keymaps->keymaps, link) {
+    struct wm_keyboard *keyboard, *next;
+    wl_list_for_each_safe(keyboard, next, &keymap->keyboards, keymap_link) {
+      wl_list_remove(&keyboard->keymap_link);
+      wl_list_init(&keyboard->keymap_link);
+    }
+
+    keymap_free(keymap);
+  }
+
+  wl_event_source_remove(keymaps->ready_source);
+  close(keymaps->ready_fd);
+
+  xkb_context_unref(keymaps->context);
+  pthread_cond_destroy(&keymaps->cond);
+  pthread_mutex_destroy(&keymaps->lock);
+  free(keymaps);
+}
@@ -0,0 +1,377 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_mirror.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_box.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+#include "wm_output.h"
+#include "wm_screencopy.h"
+#include "wm_server.h"
+#include "wm_vnc.h"
+
+static struct wm_output* mirror_find_output(struct wm_mirror *mirror,
+  const char *name) {
+  struct wm_output *output;
+  wl_list_for_each(output, &mirror->server->outputs, link) {
+    if (strcmp(output->wlr_output->name, name) == 0) {
+      return output;
+    }
+  }
+  return NULL;
+}
+
+static struct wm_mirror_source* mirror_find_source(struct wm_mirror *mirror,
+  struct wm_output *output) {
+  struct wm_mirror_source *source;
+  wl_list_for_each(source, &mirror->sources, link) {
+    if (source->output == output) {
+      return source;
+    }
+  }
+  return NULL;
+}
+
+static void mirror_source_destroy(struct wm_mirror_source *source) {
+  if (source->texture) {
+    wlr_texture_destroy(source->texture);
+  }
+  wl_list_remove(&source->link);
+  free(source->pixels);
+  free(source);
+}
+
+static bool mirror_is_mirroring(struct wm_output *output,
+  struct wm_output *source) {
+  return output->mirror_of &&
+    strcmp(output->mirror_of, source->wlr_output->name) == 0;
+}
+
+// Letterboxed area of the mirror that the source is scaled into
+static struct wlr_box mirror_box(struct wm_mirror_source *source,
+  struct wm_output *output) {
+  int width = output->wlr_output->width;
+  int height = output->wlr_output->height;
+
+  if (output->wlr_output->transform % 2 == 1) {
+    width = output->wlr_output->height;
+    height = output->wlr_output->width;
+  }
+
+  double scale_x = (double)width / source->width;
+  double scale_y = (double)height / source->height;
+  double scale = scale_x < scale_y ? scale_x : scale_y;
+
+  struct wlr_box box = {
+    .width = source->width * scale,
+    .height = source->height * scale
+  };
+
+  box.x = (width - box.width) / 2;
+  box.y = (height - box.height) / 2;
+
+  return box;
+}
+
+static void mirror_damage(struct wm_mirror_source *source,
+  struct wm_output *output, pixman_region32_t *damage) {
+  struct wlr_output *wlr_output = output->wlr_output;
+
+  if (wlr_output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+    wm_output_damage_whole(output);
+    wlr_output_schedule_frame(wlr_output);
+    return;
+  }
+
+  struct wlr_box box = mirror_box(source, output);
+
+  double scale_x = (double)box.width / source->width;
+  double scale_y = (double)box.height / source->height;
+
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(damage, &nrects);
+  for (int i = 0; i < nrects; i++) {
+    int x1 = box.x + (int)(rects[i].x1 * scale_x) - 1;
+    int y1 = box.y + (int)(rects[i].y1 * scale_y) - 1;
+    int x2 = box.x + (int)(rects[i].x2 * scale_x) + 1;
+    int y2 = box.y + (int)(rects[i].y2 * scale_y) + 1;
+
+    pixman_region32_union_rect(&output->damage, &output->damage,
+      x1, y1, x2 - x1, y2 - y1);
+  }
+
+  pixman_region32_intersect_rect(&output->damage, &output->damage,
+    0, 0, wlr_output->width, wlr_output->height);
+
+  if (nrects > 0) {
+    wlr_output_schedule_frame(wlr_output);
+  }
+}
+
+static bool mirror_read_rect(struct wm_mirror *mirror,
+  struct wm_mirror_source *source, struct wlr_renderer *renderer,
+  pixman_box32_t *rect) {
+  int width = rect->x2 - rect->x1;
+  int height = rect->y2 - rect->y1;
+  size_t size = width * height;
+
+  if (size > mirror->scratch_size) {
+    mirror->scratch = realloc(mirror->scratch, size * sizeof(uint32_t));
+    mirror->scratch_size = size;
+  }
+
+  bool ok = wlr_renderer_read_pixels(renderer, WL_SHM_FORMAT_XRGB8888,
+    width * 4, width, height, rect->x1, source->height - rect->y2, 0, 0,
+    mirror->scratch);
+
+  if (!ok) {
+    return false;
+  }
+
+  // GL rows are bottom up, textures are uploaded top down
+  for (int row = 0; row < height; row++) {
+    memcpy(source->pixels + (rect->y2 - 1 - row) * source->width + rect->x1,
+      mirror->scratch + row * width, width * sizeof(uint32_t));
+  }
+
+  return true;
+}
+
+void wm_mirror_output_frame(struct wm_mirror* mirror, struct wm_output* output) {
+  if (mirror == NULL || output->mirror_of) {
+    return;
+  }
+
+  struct wm_mirror_source *source = mirror_find_source(mirror, output);
+
+  bool mirrored = false;
+  struct wm_output *other;
+  wl_list_for_each(other, &mirror->server->outputs, link) {
+    mirrored = mirrored || mirror_is_mirroring(other, output);
+  }
+
+  if (!mirrored) {
+    if (source) {
+      mirror_source_destroy(source);
+    }
+    return;
+  }
+
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+
+  if (source == NULL) {
+    source = calloc(1, sizeof(struct wm_mirror_source));
+    source->output = output;
+    wl_list_insert(&mirror->sources, &source->link);
+  }
+
+  pixman_region32_t damage;
+  pixman_region32_init(&damage);
+  pixman_region32_copy(&damage, &output->damage);
+
+  if (source->width != wlr_output->width ||
+      source->height != wlr_output->height) {
+    if (source->texture) {
+      wlr_texture_destroy(source->texture);
+      source->texture = NULL;
+    }
+
+    free(source->pixels);
+    source->width = wlr_output->width;
+    source->height = wlr_output->height;
+    source->pixels = calloc(source->width * source->height, sizeof(uint32_t));
+
+    pixman_region32_union_rect(&damage, &damage,
+      0, 0, source->width, source->height);
+  }
+
+  // Only what changed on the source is read back and uploaded, the
+  // mirrors then scale the shared texture instead of composing the scene
+  bool ok = true;
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+  for (int i = 0; i < nrects && ok; i++) {
+    ok = mirror_read_rect(mirror, source, renderer, &rects[i]);
+  }
+
+  if (!ok) {
+    wlr_log(L_ERROR, "Failed to read pixels for mirroring");
+  }
+
+  int stride = source->width * 4;
+
+  if (source->texture == NULL) {
+    source->texture = wlr_texture_from_pixels(renderer, WL_SHM_FORMAT_XRGB8888,
+      stride, source->width, source->height, source->pixels);
+  } else {
+    for (int i = 0; i < nrects; i++) {
+      pixman_box32_t *rect = &rects[i];
+      wlr_texture_write_pixels(source->texture, WL_SHM_FORMAT_XRGB8888,
+        stride, rect->x2 - rect->x1, rect->y2 - rect->y1,
+        rect->x1, rect->y1, rect->x1, rect->y1, source->pixels);
+    }
+  }
+
+  wl_list_for_each(other, &mirror->server->outputs, link) {
+    if (mirror_is_mirroring(other, output)) {
+      mirror_damage(source, other, &damage);
+    }
+  }
+
+  pixman_region32_fini(&damage);
+}
+
+void wm_mirror_render(struct wm_mirror* mirror, struct wm_output* output) {
+  struct wm_server *server = mirror->server;
+  struct wlr_output *wlr_output = output->wlr_output;
+
+  // Mirrors only swap when the source changed, they are woken up again by
+  // wlr_output_schedule_frame when it does
+  if (!pixman_region32_not_empty(&output->damage)) {
+    return;
+  }
+
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+
+  wlr_output_make_current(wlr_output, NULL);
+  wlr_renderer_begin(renderer, wlr_output->width, wlr_output->height);
+
+  float color[4] = { 0.0, 0, 0, 1.0 };
+  wlr_renderer_clear(renderer, color);
+
+  struct wm_output *source_output =
+    mirror_find_output(mirror, output->mirror_of);
+
+  struct wm_mirror_source *source = NULL;
+  if (source_output) {
+    source = mirror_find_source(mirror, source_output);
+  }
+
+  if (source && source->texture) {
+    struct wlr_box box = mirror_box(source, output);
+
+    float matrix[16];
+    wlr_matrix_project_box(matrix, &box, WL_OUTPUT_TRANSFORM_NORMAL, 0,
+      wlr_output->transform_matrix);
+
+    wlr_render_texture_with_matrix(renderer, source->texture, matrix, 1.0f);
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  wm_screencopy_output_frame(server->screencopy, output, &now);
+  wm_vnc_output_frame(server->vnc, output);
+  pixman_region32_clear(&output->damage);
+
+  wlr_output_swap_buffers(wlr_output, NULL, NULL);
+  wlr_renderer_end(renderer);
+}
+
+const char* wm_mirror_source_name(struct wm_mirror* mirror,
+  const char* output_name) {
+  if (mirror == NULL) {
+    return NULL;
+  }
+
+  struct wm_mirror_rule *rule;
+  wl_list_for_each(rule, &mirror->rules, link) {
+    if (strcmp(rule->output, output_name) == 0) {
+      return rule->source;
+    }
+  }
+
+  return NULL;
+}
+
+void wm_mirror_output_destroy(struct wm_mirror* mirror,
+  struct wm_output* output) {
+  if (mirror == NULL) {
+    return;
+  }
+
+  struct wm_mirror_source *source = mirror_find_source(mirror, output);
+  if (source == NULL) {
+    return;
+  }
+
+  mirror_source_destroy(source);
+
+  // Blank the mirrors rather than leave the last frame up
+  struct wm_output *other;
+  wl_list_for_each(other, &mirror->server->outputs, link) {
+    if (mirror_is_mirroring(other, output)) {
+      wm_output_damage_whole(other);
+      wlr_output_schedule_frame(other->wlr_output);
+    }
+  }
+}
+
+struct wm_mirror* wm_mirror_create(struct wm_server* server) {
+  const char *config = getenv("BOXY_MIRROR");
+  if (config == NULL) {
+    return NULL;
+  }
+
+  struct wm_mirror *mirror = calloc(1, sizeof(struct wm_mirror));
+  mirror->server = server;
+
+  wl_list_init(&mirror->rules);
+  wl_list_init(&mirror->sources);
+
+  // BOXY_MIRROR=HDMI-A-1=DP-1,HDMI-A-2=DP-1 shows DP-1 on both projectors
+  char *rules = strdup(config);
+  char *save = NULL;
+  for (char *entry = strtok_r(rules, ",", &save); entry;
+       entry = strtok_r(NULL, ",", &save)) {
+    char *source = strchr(entry, '=');
+    if (source == NULL || source == entry || source[1] == '\0') {
+      wlr_log(L_ERROR, "Ignoring mirror rule '%s'", entry);
+      continue;
+    }
+
+    *source++ = '\0';
+
+    struct wm_mirror_rule *rule = calloc(1, sizeof(struct wm_mirror_rule));
+    rule->output = strdup(entry);
+    rule->source = strdup(source);
+    wl_list_insert(mirror->rules.prev, &rule->link);
+
+    printf("Mirroring %s onto %s\n", rule->source, rule->output);
+  }
+  free(rules);
+
+  return mirror;
+}
+
+void wm_mirror_destroy(struct wm_mirror* mirror) {
+  if (mirror == NULL) {
+    return;
+  }
+
+  struct wm_mirror_source *source, *tmp_source;
+  wl_list_for_each_safe(source, tmp_source, &mirror->sources, link) {
+    mirror_source_destroy(source);
+  }
+
+  struct wm_mirror_rule *rule, *tmp_rule;
+  wl_list_for_each_safe(rule, tmp_rule, &mirror->rules, link) {
+    wl_list_remove(&rule->link);
+    free(rule->output);
+    free(rule->source);
+    free(rule);
+  }
+
+  free(mirror->scratch);
+  free(mirror);
+}
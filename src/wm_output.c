@@ -18,14 +18,22 @@
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_xdg_shell_v6.h>
 #include <wlr/types/wlr_xdg_shell.h>
-#include <wlr/types/wlr_xcursor_manager.h>
 
+#include "wm_cursors.h"
+#include "wm_debug.h"
+#include "wm_hud.h"
+#include "wm_mirror.h"
+#include "wm_screencopy.h"
 #include "wm_server.h"
 #include "wm_window.h"
+#include "wm_window_store.h"
 #include "wm_surface.h"
+#include "wm_pointer.h"
 #include "wm_seat.h"
+#include "wm_vnc.h"
 
 void wm_output_destroy(struct wm_output* output) {
+  pixman_region32_fini(&output->damage);
   free(output);
 }
 
@@ -42,6 +50,10 @@ static void output_destroy_notify(struct wl_listener *listener, void *data) {
   wl_list_remove(&output->link);
   wl_list_remove(&output->destroy.link);
   wl_list_remove(&output->frame.link);
+  wm_workspace_output_destroy(output);
+  wm_screencopy_output_destroy(output->server->screencopy, output);
+  wm_vnc_output_destroy(output->server->vnc, output);
+  wm_mirror_output_destroy(output->server->mirror, output);
   wm_output_destroy(output);
 }
 
@@ -59,7 +71,16 @@ struct wm_output* wm_output_create(struct wlr_output* wlr_output,
   output->server = server;
   output->wlr_output = wlr_output;
 
-  wlr_output_layout_add_auto(layout, wlr_output);
+  output->mirror_of = wm_mirror_source_name(server->mirror, wlr_output->name);
+
+  for (int i = 0; i < WM_WORKSPACE_COUNT; i++) {
+    wm_workspace_init(&output->workspaces[i], output, i);
+  }
+  output->workspace = &output->workspaces[0];
+
+  if (output->mirror_of == NULL) {
+    wlr_output_layout_add_auto(layout, wlr_output);
+  }
 
   if (strcmp(wlr_output->name, "eDP-1") == 0) {
     wlr_output_set_scale(wlr_output, 2.0);
@@ -75,7 +96,10 @@ struct wm_output* wm_output_create(struct wlr_output* wlr_output,
 
   setenv("GDK_SCALE", "2", true);
 
-  wlr_xcursor_manager_load(server->xcursor_manager, wlr_output->scale);
+  wm_cursors_load(server->cursors, wlr_output->scale);
+
+  pixman_region32_init(&output->damage);
+  wm_output_damage_whole(output);
 
   output->destroy.notify = output_destroy_notify;
   wl_signal_add(&wlr_output->events.destroy, &output->destroy);
@@ -86,9 +110,43 @@ struct wm_output* wm_output_create(struct wlr_output* wlr_output,
   return output;
 }
 
+void wm_output_damage_box(struct wm_output* output, struct wlr_box* box) {
+  struct wlr_output *wlr_output = output->wlr_output;
+
+  if (box->width <= 0 || box->height <= 0) {
+    return;
+  }
+
+  double x = box->x;
+  double y = box->y;
+  wlr_output_layout_output_coords(output->server->layout, wlr_output, &x, &y);
+
+  double scale = wlr_output->scale;
+
+  int x1 = (int)(x * scale) - 1;
+  int y1 = (int)(y * scale) - 1;
+  int x2 = (int)((x + box->width) * scale) + 1;
+  int y2 = (int)((y + box->height) * scale) + 1;
+
+  pixman_region32_union_rect(&output->damage, &output->damage,
+    x1, y1, x2 - x1, y2 - y1);
+
+  pixman_region32_intersect_rect(&output->damage, &output->damage,
+    0, 0, wlr_output->width, wlr_output->height);
+}
+
+void wm_output_damage_whole(struct wm_output* output) {
+  pixman_region32_union_rect(&output->damage, &output->damage,
+    0, 0, output->wlr_output->width, output->wlr_output->height);
+}
+
 struct render_data {
   struct wm_output *output;
-  struct wm_window* window;
+  double x;
+  double y;
+  double scale;
+  double stretch_x;
+  double stretch_y;
 };
 
 static void render_surface(struct wlr_surface *surface, int sx, int sy, void *data) {
@@ -102,16 +160,18 @@ static void render_surface(struct wlr_surface *surface, int sx, int sy, void *da
   }
 
   struct render_data *render_data = data;
-  struct wm_window* window = render_data->window;
   struct wm_output* output = render_data->output;
 
-  double scale = output->wlr_output->scale;
+  double scale = render_data->scale;
+
+  double stretch_x = render_data->stretch_x;
+  double stretch_y = render_data->stretch_y;
 
   struct wlr_box box = {
-    .x = (window->x + sx) * scale,
-    .y = (window->y + sy) * scale,
-    .width = surface->current->width * scale,
-    .height = surface->current->height * scale
+    .x = (render_data->x + sx * stretch_x) * scale,
+    .y = (render_data->y + sy * stretch_y) * scale,
+    .width = surface->current->width * stretch_x * scale,
+    .height = surface->current->height * stretch_y * scale
   };
 
   float matrix[16];
@@ -128,6 +188,124 @@ static void render_surface(struct wlr_surface *surface, int sx, int sy, void *da
   wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0f);
 }
 
+void wm_output_render_window(struct wm_output* output,
+  struct wm_window* window, double x, double y, double scale) {
+  struct render_data render_data = {
+    .output = output,
+    .x = x,
+    .y = y,
+    .scale = scale,
+    .stretch_x = 1.0,
+    .stretch_y = 1.0
+  };
+
+  window->surface->render(window->surface, render_surface, &render_data);
+}
+
+// Draws the last committed buffers into the pending geometry, stretched or
+// cropped, while the client is still rendering the new size
+static void render_window_snapshot(struct wm_output *output,
+  struct wm_window *window, struct wlr_box *snapshot) {
+  struct wm_server *server = output->server;
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+  double scale = wlr_output->scale;
+
+  double x = snapshot->x;
+  double y = snapshot->y;
+  wlr_output_layout_output_coords(server->layout, wlr_output, &x, &y);
+
+  if (server->resize_snapshot == WM_RESIZE_SNAPSHOT_STRETCH) {
+    struct render_data render_data = {
+      .output = output,
+      .x = x,
+      .y = y,
+      .scale = scale,
+      .stretch_x = (double)snapshot->width / window->width,
+      .stretch_y = (double)snapshot->height / window->height
+    };
+
+    window->surface->render(window->surface, render_surface, &render_data);
+    return;
+  }
+
+  // Cropping keeps the edge opposite the one being dragged in place
+  double content_x = window->update_x ?
+    x + snapshot->width - window->width : x;
+  double content_y = window->update_y ?
+    y + snapshot->height - window->height : y;
+
+  struct wlr_box clip = {
+    .x = x * scale,
+    .y = y * scale,
+    .width = snapshot->width * scale,
+    .height = snapshot->height * scale
+  };
+
+  wlr_renderer_scissor(renderer, &clip);
+  wm_output_render_window(output, window, content_x, content_y, scale);
+  wlr_renderer_scissor(renderer, NULL);
+}
+
+struct cull_data {
+  struct wm_window *window;
+  pixman_region32_t *opaque;
+};
+
+static void add_surface_opaque(struct wlr_surface *surface,
+  int sx, int sy, void *data) {
+  struct cull_data *cull_data = data;
+
+  pixman_region32_t opaque;
+  pixman_region32_init(&opaque);
+  pixman_region32_copy(&opaque, &surface->current->opaque);
+  pixman_region32_intersect_rect(&opaque, &opaque, 0, 0,
+    surface->current->width, surface->current->height);
+  pixman_region32_translate(&opaque,
+    cull_data->window->x + sx, cull_data->window->y + sy);
+
+  pixman_region32_union(cull_data->opaque, cull_data->opaque, &opaque);
+  pixman_region32_fini(&opaque);
+}
+
+// Walks the stack top down marking windows hidden behind opaque ones
+static void cull_windows(struct wm_server *server) {
+  struct wm_window_store *store = server->window_store;
+
+  pixman_region32_t opaque;
+  pixman_region32_init(&opaque);
+
+  for (int i = store->count - 1; i >= 0; i--) {
+    if (store->windows[i] == NULL) {
+      continue;
+    }
+
+    struct wlr_box *extents = &store->extents[i];
+
+    pixman_box32_t box = {
+      .x1 = extents->x,
+      .y1 = extents->y,
+      .x2 = extents->x + extents->width,
+      .y2 = extents->y + extents->height
+    };
+
+    store->culled[i] = extents->width > 0 && extents->height > 0 &&
+      pixman_region32_contains_rectangle(&opaque, &box) == PIXMAN_REGION_IN;
+
+    struct wm_window *window = store->windows[i];
+    struct wlr_box snapshot;
+
+    // A scaled snapshot may not cover the old opaque region, so it hides nothing
+    if (!store->culled[i] && !wm_window_snapshot_box(window, &snapshot)) {
+      struct cull_data cull_data = { window, &opaque };
+      window->surface->for_each_surface(window->surface,
+        add_surface_opaque, &cull_data);
+    }
+  }
+
+  pixman_region32_fini(&opaque);
+}
+
 void send_frame_done(struct wlr_surface *surface, int sx, int sy, void *data) {
   (void)sx;
   (void)sy;
@@ -139,43 +317,105 @@ void wm_output_render(struct wm_output* output) {
   struct wm_server *server = output->server;
   struct wlr_output *wlr_output = output->wlr_output;
 
+  if (output->mirror_of) {
+    wm_mirror_render(server->mirror, output);
+    return;
+  }
+
+  struct timespec frame_start;
+  clock_gettime(CLOCK_MONOTONIC, &frame_start);
+
+  struct wm_seat *seat;
+  wl_list_for_each(seat, &server->seats, link) {
+    if (seat->pointer) {
+      wm_pointer_flush_motion(seat->pointer);
+    }
+  }
+
   struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
 
   wlr_output_make_current(wlr_output, NULL);
   wlr_renderer_begin(renderer, wlr_output->width, wlr_output->height);
 
+  wm_screencopy_render_windows(server->screencopy, output);
+
   float color[4] = { 0.0, 0, 0, 1.0 };
   wlr_renderer_clear(renderer, color);
 
   struct timespec now;
   clock_gettime(CLOCK_MONOTONIC, &now);
 
-  struct wm_window *window;
-  wl_list_for_each_reverse(window, &server->windows, link) {
-    struct render_data render_data = {
-      .output = output,
-      .window = window
-    };
+  cull_windows(server);
+
+  struct wm_window_store *store = server->window_store;
+
+  for (int i = 0; i < store->count; i++) {
+    if (store->culled[i] || !wlr_output_layout_intersects(server->layout,
+        wlr_output, &store->geometry[i])) {
+      continue;
+    }
+
+    struct wm_window *window = store->windows[i];
 
     if (!window->surface->render) {
       printf("Surface has no render function\n");
       continue;
     }
 
-    struct wlr_box window_geometry = wm_window_geometry(window);
+    double x = store->geometry[i].x;
+    double y = store->geometry[i].y;
+    wlr_output_layout_output_coords(server->layout, wlr_output, &x, &y);
+
+    struct wlr_box snapshot;
+    bool behind = wm_window_snapshot_box(window, &snapshot);
 
-    bool within_output = wlr_output_layout_intersects(server->layout,
-      wlr_output, &window_geometry);
+    if (behind && server->debug_mode != WM_DEBUG_OVERDRAW) {
+      render_window_snapshot(output, window, &snapshot);
+    } else if (server->debug_mode == WM_DEBUG_OVERDRAW) {
+      wm_debug_render_overdraw(output, window, x, y);
+    } else {
+      wm_output_render_window(output, window, x, y, wlr_output->scale);
+    }
+  }
 
-    if (within_output) {
-      window->surface->render(window->surface, render_surface, &render_data);
+  for (int i = 0; i < store->count; i++) {
+    struct wm_window *window = store->windows[i];
+    if (window) {
+      window->surface->frame_done(window->surface, send_frame_done, &now);
     }
   }
 
-  wl_list_for_each_reverse(window, &server->windows, link) {
-    window->surface->frame_done(window->surface, send_frame_done, &now);
+  wm_screencopy_output_frame(server->screencopy, output, &now);
+  wm_vnc_output_frame(server->vnc, output);
+  wm_mirror_output_frame(server->mirror, output);
+
+  // Overlays are drawn after the frame is handed to the capture paths
+  if (server->debug_mode == WM_DEBUG_DAMAGE) {
+    wm_debug_render_damage(output);
   }
 
+  if (server->debug_mode == WM_DEBUG_CULLING) {
+    for (int i = 0; i < store->count; i++) {
+      if (store->windows[i] && store->culled[i] &&
+          wlr_output_layout_intersects(server->layout, wlr_output,
+            &store->geometry[i])) {
+        struct wm_window *window = store->windows[i];
+        double x = store->geometry[i].x;
+        double y = store->geometry[i].y;
+        wlr_output_layout_output_coords(server->layout, wlr_output, &x, &y);
+        wm_debug_render_culled(output, window, x, y);
+      }
+    }
+  }
+
+  wm_hud_render(server->hud, output);
+
+  pixman_region32_clear(&output->damage);
+
   wlr_output_swap_buffers(wlr_output, NULL, NULL);
   wlr_renderer_end(renderer);
+
+  struct timespec frame_end;
+  clock_gettime(CLOCK_MONOTONIC, &frame_end);
+  wm_hud_output_frame(server->hud, output, &frame_start, &frame_end);
 }
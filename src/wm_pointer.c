@@ -2,13 +2,18 @@
 
 #include <stdlib.h>
 #include <wlr/types/wlr_seat.h>
-#include <wlr/types/wlr_xcursor_manager.h>
+#include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_xdg_shell.h>
 
 
+#include "wm_constraints.h"
+#include "wm_cursors.h"
+#include "wm_index.h"
+#include "wm_input.h"
 #include "wm_seat.h"
 #include "wm_server.h"
 #include "wm_surface.h"
+#include "wm_timestamps.h"
 #include "wm_window.h"
 
 #define DEFAULT_CURSOR "left_ptr"
@@ -20,11 +25,17 @@ static void handle_request_set_cursor(struct wl_listener *listener, void *data)
   struct wlr_surface *focused_surface =
 		event->seat_client->seat->pointer_state.focused_surface;
 
+  // Nothing is drawn for a locked pointer
+  if (pointer->constraint && pointer->constraint->type == WM_CONSTRAINT_LOCK) {
+    return;
+  }
+
   if (pointer->focused_surface && pointer->focused_surface->surface != focused_surface) {
     wm_pointer_set_default_cursor(pointer);
 		return;
   }
 
+  pointer->cursor_name = NULL;
   wlr_cursor_set_surface(pointer->cursor,
     event->surface, event->hotspot_x, event->hotspot_y);
 }
@@ -32,73 +43,157 @@ static void handle_request_set_cursor(struct wl_listener *listener, void *data)
 static void handle_cursor_button(struct wl_listener *listener, void *data) {
   struct wlr_event_pointer_button *event = data;
   struct wm_pointer *pointer = wl_container_of(listener, pointer, button);
-
-  if (event->state == WLR_BUTTON_RELEASED) {
-    wm_pointer_set_mode(pointer, WM_POINTER_MODE_FREE);
-    wm_server_focus_window_under_point(pointer->server, pointer->seat,
-      pointer->cursor->x, pointer->cursor->y);
-  }
-
-  wlr_seat_pointer_notify_button(pointer->seat->seat, event->time_msec, event->button, event->state);
+  wm_input_backend_event(pointer->server->input, event->time_msec);
+  wm_pointer_button(pointer, event->time_msec, event->button, event->state);
+  wm_input_delivered(wm_input_device(pointer->server->input, event->device),
+    event->time_msec);
 }
 
 static void handle_cursor_motion(struct wl_listener *listener, void *data) {
   struct wlr_event_pointer_motion *event = data;
   struct wm_pointer *pointer = wl_container_of(listener, pointer, cursor_motion);
-  wlr_cursor_move(pointer->cursor, event->device, event->delta_x, event->delta_y);
-  wm_pointer_motion(pointer, event->time_msec);
+  wm_input_backend_event(pointer->server->input, event->time_msec);
+
+  wm_constraints_relative_motion(pointer->server->constraints, pointer->seat,
+    event->time_msec, event->delta_x, event->delta_y);
+
+  // A locked pointer skips cursor movement and window management entirely
+  struct wm_constraint *constraint = pointer->constraint;
+  if (constraint && constraint->type == WM_CONSTRAINT_LOCK) {
+    return;
+  }
+
+  double dx = event->delta_x;
+  double dy = event->delta_y;
+
+  if (constraint) {
+    wm_constraint_confine(constraint, &dx, &dy);
+  }
+
+  wlr_cursor_move(pointer->cursor, event->device, dx, dy);
+  wm_pointer_queue_motion(pointer, event->device, event->time_msec);
 }
 
 static void handle_cursor_motion_absolute(struct wl_listener *listener, void *data) {
   struct wlr_event_pointer_motion_absolute *event = data;
   struct wm_pointer *pointer = wl_container_of(listener, pointer, cursor_motion_absolute);
+  wm_input_backend_event(pointer->server->input, event->time_msec);
+
+  struct wm_constraint *constraint = pointer->constraint;
+  if (constraint && constraint->type == WM_CONSTRAINT_LOCK) {
+    return;
+  }
+
   wlr_cursor_warp_absolute(pointer->cursor, event->device, event->x, event->y);
-  wm_pointer_motion(pointer, event->time_msec);
+  wm_pointer_queue_motion(pointer, event->device, event->time_msec);
 }
 
 static void handle_axis(struct wl_listener *listener, void *data) {
   struct wm_pointer *pointer = wl_container_of(listener, pointer, axis);
 	struct wlr_event_pointer_axis *event = data;
+  wm_pointer_axis(pointer, event->time_msec, event->orientation,
+    event->delta, event->source);
+  wm_input_delivered(wm_input_device(pointer->server->input, event->device),
+    event->time_msec);
+}
 
-  float delta = event->delta;
-  double delta_discrete = event->delta;
+void wm_pointer_button(struct wm_pointer* pointer, uint32_t time,
+  uint32_t button, enum wlr_button_state state) {
+  wm_pointer_flush_motion(pointer);
 
-  bool natural_scrolling = true; 
+  if (state == WLR_BUTTON_RELEASED) {
+    // The final size goes out even if the client is still behind
+    if (pointer->mode == WM_POINTER_MODE_RESIZE && pointer->grabbed_window) {
+      wm_window_finish_resize(pointer->grabbed_window);
+    }
+
+    wm_pointer_set_mode(pointer, WM_POINTER_MODE_FREE);
+    wm_server_focus_window_under_point(pointer->server, pointer->seat,
+      pointer->cursor->x, pointer->cursor->y);
+  }
+
+  wm_timestamps_pointer(pointer->server->timestamps, pointer->seat, time);
+  wlr_seat_pointer_notify_button(pointer->seat->seat, time, button, state);
+}
+
+void wm_pointer_axis(struct wm_pointer* pointer, uint32_t time,
+  enum wlr_axis_orientation orientation, double delta,
+  enum wlr_axis_source source) {
+  wm_pointer_flush_motion(pointer);
+
+  double delta_discrete = delta;
+
+  bool natural_scrolling = true;
 
   if (natural_scrolling) {
     delta = -delta;
     delta_discrete = -delta_discrete;
   }
 
-  wlr_seat_pointer_notify_axis(pointer->seat->seat, event->time_msec,
-    event->orientation, delta, delta_discrete, event->source);
+  wm_timestamps_pointer(pointer->server->timestamps, pointer->seat, time);
+  wlr_seat_pointer_notify_axis(pointer->seat->seat, time,
+    orientation, delta, delta_discrete, source);
 }
 
 void wm_pointer_set_mode(struct wm_pointer* pointer, int mode) {
   pointer->mode = mode;
+
+  if (mode == WM_POINTER_MODE_FREE) {
+    pointer->grabbed_window = NULL;
+  }
+}
+
+void wm_pointer_set_cursor_name(struct wm_pointer* pointer, const char* name) {
+  pointer->cursor_name = name;
+  wm_cursors_set_image(pointer->server->cursors, name, pointer->cursor);
 }
 
 void wm_pointer_set_default_cursor(struct wm_pointer* pointer) {
-  wlr_xcursor_manager_set_cursor_image(pointer->server->xcursor_manager,
-		DEFAULT_CURSOR, pointer->cursor);
+  wm_pointer_set_cursor_name(pointer, DEFAULT_CURSOR);
 }
 
 void wm_pointer_set_resize_edge(struct wm_pointer* pointer, int resize_edge) {
   pointer->resize_edge = resize_edge;
 }
 
-void wm_pointer_motion(struct wm_pointer *pointer, uint32_t time) {
-  pointer->focused_surface = NULL;
+static struct wlr_surface* window_surface_at(struct wm_window *window,
+  double x, double y, double *sx, double *sy) {
+  return window->surface->wlr_surface_at(window->surface,
+    x - window->x, y - window->y, sx, sy);
+}
 
-  int list_length = wl_list_length(&pointer->server->windows);
+// Topmost surface under the cursor, found through the window index
+static struct wlr_surface* pointer_surface_at(struct wm_pointer *pointer,
+  struct wm_window **window, double *sx, double *sy) {
+  double x = pointer->cursor->x;
+  double y = pointer->cursor->y;
 
-  if (list_length > 0) {
-    struct wm_window *window = wl_list_first(
-      &pointer->server->windows, window, link);
+  struct wm_window *windows[WM_INDEX_MAX_RESULTS];
+  int count = wm_index_query(pointer->server->index, x, y,
+    windows, WM_INDEX_MAX_RESULTS);
+
+  for (int i = 0; i < count; i++) {
+    struct wlr_surface *surface = window_surface_at(windows[i], x, y, sx, sy);
+    if (surface) {
+      *window = windows[i];
+      return surface;
+    }
+  }
+
+  *window = NULL;
+  return NULL;
+}
+
+void wm_pointer_motion(struct wm_pointer *pointer, uint32_t time) {
+  struct wm_window *window = NULL;
+  struct wlr_surface *surface = NULL;
+  double sx = 0, sy = 0;
+
+  if (pointer->mode != WM_POINTER_MODE_FREE && pointer->grabbed_window) {
+    window = pointer->grabbed_window;
 
     window->update_x = false;
     window->update_y = false;
-    pointer->focused_surface = window->surface;
 
     if (pointer->mode == WM_POINTER_MODE_RESIZE) {
       wm_window_resize(window, pointer);
@@ -114,20 +209,110 @@ void wm_pointer_motion(struct wm_pointer *pointer, uint32_t time) {
       wm_window_move(window, x, y);
     }
 
-    double local_x = pointer->cursor->x - window->x;
-    double local_y = pointer->cursor->y - window->y;
+    // The grabbed window keeps the pointer while it is moved or resized
+    surface = window_surface_at(window, pointer->cursor->x, pointer->cursor->y,
+      &sx, &sy);
+  } else {
+    surface = pointer_surface_at(pointer, &window, &sx, &sy);
+  }
 
-    double sx, sy;
+  pointer->focused_surface = window ? window->surface : NULL;
 
-    struct wlr_surface *surface = window->surface->wlr_surface_at(
-      window->surface, local_x, local_y, &sx, &sy);
+  // Raw motion may already have delivered this position
+  bool sent = pointer->motion_sent && surface == pointer->motion_surface;
 
-    if (surface) {
-      wlr_seat_pointer_notify_enter(pointer->seat->seat, surface, sx, sy);
-      wlr_seat_pointer_notify_motion(pointer->seat->seat, time, sx, sy);
-    } else {
-      wlr_seat_pointer_clear_focus(pointer->seat->seat);
+  pointer->motion_surface = surface;
+  pointer->motion_window = window;
+  pointer->motion_sent = false;
+
+  if (window) {
+    pointer->motion_window_x = window->x;
+    pointer->motion_window_y = window->y;
+    pointer->motion_origin_x = pointer->cursor->x - sx;
+    pointer->motion_origin_y = pointer->cursor->y - sy;
+  }
+
+  // Enter and leave only go out when the hovered surface changes
+  struct wlr_seat *seat = pointer->seat->seat;
+  struct wlr_surface *entered = seat->pointer_state.focused_surface;
+
+  if (surface == NULL) {
+    if (entered) {
+      wlr_seat_pointer_clear_focus(seat);
     }
+    return;
+  }
+
+  if (surface != entered) {
+    wlr_seat_pointer_notify_enter(seat, surface, sx, sy);
+    return;
+  }
+
+  if (!sent) {
+    wm_timestamps_pointer(pointer->server->timestamps, pointer->seat, time);
+    wlr_seat_pointer_notify_motion(seat, time, sx, sy);
+    wm_input_delivered(pointer->motion_latency, time);
+  }
+}
+
+static bool pointer_send_raw_motion(struct wm_pointer *pointer,
+  uint32_t time) {
+  struct wlr_surface *surface = pointer->motion_surface;
+  struct wm_window *window = pointer->motion_window;
+
+  if (pointer->mode != WM_POINTER_MODE_FREE || surface == NULL ||
+      surface != pointer->seat->seat->pointer_state.focused_surface) {
+    return false;
+  }
+
+  if (window->x != pointer->motion_window_x ||
+      window->y != pointer->motion_window_y) {
+    return false;
+  }
+
+  double sx = pointer->cursor->x - pointer->motion_origin_x;
+  double sy = pointer->cursor->y - pointer->motion_origin_y;
+
+  // Leaving the surface needs a hit test, that waits for the frame pass
+  if (sx < 0 || sy < 0 || sx >= surface->current->width ||
+      sy >= surface->current->height) {
+    return false;
+  }
+
+  wm_timestamps_pointer(pointer->server->timestamps, pointer->seat, time);
+  wlr_seat_pointer_notify_motion(pointer->seat->seat, time, sx, sy);
+  wm_input_delivered(pointer->motion_latency, time);
+  return true;
+}
+
+void wm_pointer_queue_motion(struct wm_pointer *pointer,
+  struct wlr_input_device *device, uint32_t time) {
+  pointer->motion_pending = true;
+  pointer->motion_time = time;
+  pointer->motion_latency = wm_input_device(pointer->server->input, device);
+  pointer->motion_sent = pointer_send_raw_motion(pointer, time);
+}
+
+void wm_pointer_flush_motion(struct wm_pointer *pointer) {
+  if (!pointer->motion_pending) {
+    return;
+  }
+
+  pointer->motion_pending = false;
+  wm_pointer_motion(pointer, pointer->motion_time);
+  wm_constraints_update(pointer->server->constraints, pointer);
+}
+
+void wm_pointer_forget_window(struct wm_pointer *pointer,
+  struct wm_window *window) {
+  if (pointer->motion_window == window) {
+    pointer->motion_surface = NULL;
+    pointer->motion_window = NULL;
+    pointer->motion_sent = false;
+  }
+
+  if (pointer->grabbed_window == window) {
+    wm_pointer_set_mode(pointer, WM_POINTER_MODE_FREE);
   }
 }
 
@@ -0,0 +1,476 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_record.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_pointer.h>
+#include <wlr/util/log.h>
+
+#include "wm_server.h"
+
+struct record_device_add {
+  uint8_t type;
+} __attribute__((packed));
+
+struct record_motion {
+  double x;
+  double y;
+} __attribute__((packed));
+
+struct record_code {
+  uint32_t code;
+  uint8_t state;
+} __attribute__((packed));
+
+struct record_axis {
+  uint8_t orientation;
+  uint8_t source;
+  double delta;
+} __attribute__((packed));
+
+static uint64_t timespec_ns(struct timespec *ts) {
+  return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static uint32_t now_msec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return timespec_ns(&now) / 1000000;
+}
+
+static void record_write(struct wm_record *record, uint32_t time_msec,
+  uint8_t type, uint8_t device, const void *data, uint16_t length) {
+  struct wm_record_header header = {
+    .time_msec = time_msec,
+    .type = type,
+    .device = device,
+    .length = length
+  };
+
+  if (fwrite(&header, sizeof(header), 1, record->output) != 1 ||
+      (length > 0 && fwrite(data, length, 1, record->output) != 1)) {
+    wlr_log(L_ERROR, "Failed to write input recording, stopping");
+    fclose(record->output);
+    record->output = NULL;
+  }
+}
+
+static void record_key_notify(struct wl_listener *listener, void *data) {
+  struct wm_record_device *device = wl_container_of(listener, device, key);
+  struct wlr_event_keyboard_key *event = data;
+  struct record_code code = { event->keycode, event->state };
+  record_write(device->record, event->time_msec, WM_RECORD_KEY,
+    device->id, &code, sizeof(code));
+}
+
+static void record_motion_notify(struct wl_listener *listener, void *data) {
+  struct wm_record_device *device = wl_container_of(listener, device, motion);
+  struct wlr_event_pointer_motion *event = data;
+  struct record_motion motion = { event->delta_x, event->delta_y };
+  record_write(device->record, event->time_msec, WM_RECORD_MOTION,
+    device->id, &motion, sizeof(motion));
+}
+
+static void record_motion_absolute_notify(struct wl_listener *listener,
+  void *data) {
+  struct wm_record_device *device =
+    wl_container_of(listener, device, motion_absolute);
+  struct wlr_event_pointer_motion_absolute *event = data;
+  struct record_motion motion = { event->x, event->y };
+  record_write(device->record, event->time_msec, WM_RECORD_MOTION_ABSOLUTE,
+    device->id, &motion, sizeof(motion));
+}
+
+static void record_button_notify(struct wl_listener *listener, void *data) {
+  struct wm_record_device *device = wl_container_of(listener, device, button);
+  struct wlr_event_pointer_button *event = data;
+  struct record_code code = { event->button, event->state };
+  record_write(device->record, event->time_msec, WM_RECORD_BUTTON,
+    device->id, &code, sizeof(code));
+}
+
+static void record_axis_notify(struct wl_listener *listener, void *data) {
+  struct wm_record_device *device = wl_container_of(listener, device, axis);
+  struct wlr_event_pointer_axis *event = data;
+  struct record_axis axis = { event->orientation, event->source, event->delta };
+  record_write(device->record, event->time_msec, WM_RECORD_AXIS,
+    device->id, &axis, sizeof(axis));
+}
+
+static void record_device_free(struct wm_record_device *device) {
+  wl_list_remove(&device->destroy.link);
+
+  if (device->device->type == WLR_INPUT_DEVICE_KEYBOARD) {
+    wl_list_remove(&device->key.link);
+  } else {
+    wl_list_remove(&device->motion.link);
+    wl_list_remove(&device->motion_absolute.link);
+    wl_list_remove(&device->button.link);
+    wl_list_remove(&device->axis.link);
+  }
+
+  wl_list_remove(&device->link);
+  free(device);
+}
+
+static void record_destroy_notify(struct wl_listener *listener, void *data) {
+  (void)data;
+  struct wm_record_device *device = wl_container_of(listener, device, destroy);
+  struct wm_record *record = device->record;
+
+  if (record->output) {
+    record_write(record, now_msec(), WM_RECORD_DEVICE_REMOVE, device->id,
+      NULL, 0);
+  }
+
+  record_device_free(device);
+}
+
+void wm_record_device_added(struct wm_record* record,
+  struct wlr_input_device* wlr_device) {
+  if (record == NULL || record->output == NULL) {
+    return;
+  }
+
+  if (wlr_device->type != WLR_INPUT_DEVICE_KEYBOARD &&
+      wlr_device->type != WLR_INPUT_DEVICE_POINTER) {
+    return;
+  }
+
+  if (record->next_device_id == WM_RECORD_MAX_DEVICES) {
+    wlr_log(L_ERROR, "Too many input devices to record %s", wlr_device->name);
+    return;
+  }
+
+  struct wm_record_device *device = calloc(1, sizeof(struct wm_record_device));
+  device->record = record;
+  device->device = wlr_device;
+  device->id = record->next_device_id++;
+
+  struct record_device_add add = { wlr_device->type };
+  record_write(record, now_msec(), WM_RECORD_DEVICE_ADD, device->id,
+    &add, sizeof(add));
+
+  wl_signal_add(&wlr_device->events.destroy, &device->destroy);
+  device->destroy.notify = record_destroy_notify;
+
+  if (wlr_device->type == WLR_INPUT_DEVICE_KEYBOARD) {
+    wl_signal_add(&wlr_device->keyboard->events.key, &device->key);
+    device->key.notify = record_key_notify;
+  } else {
+    struct wlr_pointer *pointer = wlr_device->pointer;
+
+    wl_signal_add(&pointer->events.motion, &device->motion);
+    device->motion.notify = record_motion_notify;
+
+    wl_signal_add(&pointer->events.motion_absolute, &device->motion_absolute);
+    device->motion_absolute.notify = record_motion_absolute_notify;
+
+    wl_signal_add(&pointer->events.button, &device->button);
+    device->button.notify = record_button_notify;
+
+    wl_signal_add(&pointer->events.axis, &device->axis);
+    device->axis.notify = record_axis_notify;
+  }
+
+  wl_list_insert(&record->devices, &device->link);
+}
+
+static void replay_stop(struct wm_record *record) {
+  wlr_log(L_ERROR, "Input recording is corrupt, stopping replay");
+  fclose(record->input);
+  record->input = NULL;
+}
+
+static bool replay_read_next(struct wm_record *record) {
+  if (record->next_ready) {
+    return true;
+  }
+
+  if (record->input == NULL) {
+    return false;
+  }
+
+  struct wm_record_header *header = &record->next;
+
+  if (fread(header, sizeof(*header), 1, record->input) != 1 ||
+      header->length > sizeof(record->next_data) ||
+      (header->length > 0 &&
+        fread(record->next_data, header->length, 1, record->input) != 1)) {
+    if (!feof(record->input)) {
+      replay_stop(record);
+    } else {
+      fclose(record->input);
+      record->input = NULL;
+    }
+    return false;
+  }
+
+  record->next_ready = true;
+  return true;
+}
+
+// Each event must name a device that exists with the type it applies to
+static bool replay_valid(struct wm_record *record) {
+  struct wm_record_header *header = &record->next;
+  struct wlr_input_device *device = record->replay_devices[header->device];
+  size_t length;
+  int type;
+
+  switch (header->type) {
+    case WM_RECORD_DEVICE_ADD: {
+      struct record_device_add *add = (void *)record->next_data;
+      return device == NULL && header->length == sizeof(*add) &&
+        (add->type == WLR_INPUT_DEVICE_KEYBOARD ||
+          add->type == WLR_INPUT_DEVICE_POINTER);
+    }
+    case WM_RECORD_DEVICE_REMOVE:
+      return device != NULL && header->length == 0;
+    case WM_RECORD_KEY:
+      length = sizeof(struct record_code);
+      type = WLR_INPUT_DEVICE_KEYBOARD;
+      break;
+    case WM_RECORD_MOTION:
+    case WM_RECORD_MOTION_ABSOLUTE:
+      length = sizeof(struct record_motion);
+      type = WLR_INPUT_DEVICE_POINTER;
+      break;
+    case WM_RECORD_BUTTON:
+      length = sizeof(struct record_code);
+      type = WLR_INPUT_DEVICE_POINTER;
+      break;
+    case WM_RECORD_AXIS:
+      length = sizeof(struct record_axis);
+      type = WLR_INPUT_DEVICE_POINTER;
+      break;
+    default:
+      return false;
+  }
+
+  return device != NULL && (int)device->type == type &&
+    header->length == length;
+}
+
+static bool replay_dispatch(struct wm_record *record) {
+  if (!replay_valid(record)) {
+    return false;
+  }
+
+  struct wm_record_header *header = &record->next;
+  struct wlr_input_device *device = record->replay_devices[header->device];
+  uint32_t time_msec = now_msec();
+
+  switch (header->type) {
+    case WM_RECORD_DEVICE_ADD: {
+      struct record_device_add *add = (void *)record->next_data;
+      device = wlr_headless_add_input_device(record->server->backend,
+        add->type);
+      record->replay_devices[header->device] = device;
+      return device != NULL;
+    }
+    case WM_RECORD_DEVICE_REMOVE:
+      wlr_input_device_destroy(device);
+      record->replay_devices[header->device] = NULL;
+      break;
+    case WM_RECORD_KEY: {
+      struct record_code *code = (void *)record->next_data;
+      struct wlr_event_keyboard_key event = {
+        .time_msec = time_msec,
+        .keycode = code->code,
+        .update_state = true,
+        .state = code->state
+      };
+      wlr_keyboard_notify_key(device->keyboard, &event);
+      break;
+    }
+    case WM_RECORD_MOTION: {
+      struct record_motion *motion = (void *)record->next_data;
+      struct wlr_event_pointer_motion event = {
+        .device = device,
+        .time_msec = time_msec,
+        .delta_x = motion->x,
+        .delta_y = motion->y
+      };
+      wl_signal_emit(&device->pointer->events.motion, &event);
+      break;
+    }
+    case WM_RECORD_MOTION_ABSOLUTE: {
+      struct record_motion *motion = (void *)record->next_data;
+      struct wlr_event_pointer_motion_absolute event = {
+        .device = device,
+        .time_msec = time_msec,
+        .x = motion->x,
+        .y = motion->y
+      };
+      wl_signal_emit(&device->pointer->events.motion_absolute, &event);
+      break;
+    }
+    case WM_RECORD_BUTTON: {
+      struct record_code *code = (void *)record->next_data;
+      struct wlr_event_pointer_button event = {
+        .device = device,
+        .time_msec = time_msec,
+        .button = code->code,
+        .state = code->state
+      };
+      wl_signal_emit(&device->pointer->events.button, &event);
+      break;
+    }
+    case WM_RECORD_AXIS: {
+      struct record_axis *axis = (void *)record->next_data;
+      struct wlr_event_pointer_axis event = {
+        .device = device,
+        .time_msec = time_msec,
+        .source = axis->source,
+        .orientation = axis->orientation,
+        .delta = axis->delta
+      };
+      wl_signal_emit(&device->pointer->events.axis, &event);
+      break;
+    }
+  }
+
+  return true;
+}
+
+static int replay_timer(void *data) {
+  struct wm_record *record = data;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t now_ns = timespec_ns(&now);
+
+  while (replay_read_next(record)) {
+    if (!record->started) {
+      record->started = true;
+      record->first_time = record->next.time_msec;
+      record->start = now;
+    }
+
+    uint32_t offset = record->next.time_msec - record->first_time;
+    uint64_t due_ns = timespec_ns(&record->start) +
+      (uint64_t)(offset * 1000000.0 / record->speed);
+
+    if (due_ns > now_ns) {
+      int delay = (due_ns - now_ns + 999999) / 1000000;
+      wl_event_source_timer_update(record->timer, delay);
+      return 0;
+    }
+
+    record->next_ready = false;
+    if (!replay_dispatch(record)) {
+      replay_stop(record);
+      return 0;
+    }
+  }
+
+  printf("Input replay finished\n");
+  return 0;
+}
+
+void wm_record_start_replay(struct wm_record* record) {
+  if (record == NULL || record->input == NULL) {
+    return;
+  }
+
+  printf("Replaying input at %.2fx\n", record->speed);
+  wl_event_source_timer_update(record->timer, 1);
+}
+
+bool wm_record_replay_enabled() {
+  return getenv("BOXY_REPLAY") != NULL;
+}
+
+static bool replay_open(struct wm_record *record, const char *path) {
+  record->input = fopen(path, "rb");
+  if (record->input == NULL) {
+    wlr_log(L_ERROR, "Failed to open input recording %s", path);
+    return false;
+  }
+
+  char magic[sizeof(WM_RECORD_MAGIC) - 1];
+  if (fread(magic, sizeof(magic), 1, record->input) != 1 ||
+      memcmp(magic, WM_RECORD_MAGIC, sizeof(magic)) != 0) {
+    wlr_log(L_ERROR, "%s is not an input recording", path);
+    fclose(record->input);
+    record->input = NULL;
+    return false;
+  }
+
+  const char *speed = getenv("BOXY_REPLAY_SPEED");
+  record->speed = speed ? strtod(speed, NULL) : 1.0;
+  if (record->speed <= 0) {
+    record->speed = 1.0;
+  }
+
+  struct wl_event_loop *loop =
+    wl_display_get_event_loop(record->server->wl_display);
+  record->timer = wl_event_loop_add_timer(loop, replay_timer, record);
+
+  return true;
+}
+
+static bool record_open(struct wm_record *record, const char *path) {
+  record->output = fopen(path, "wb");
+  if (record->output == NULL) {
+    wlr_log(L_ERROR, "Failed to create input recording %s", path);
+    return false;
+  }
+
+  fwrite(WM_RECORD_MAGIC, sizeof(WM_RECORD_MAGIC) - 1, 1, record->output);
+  printf("Recording input to %s\n", path);
+  return true;
+}
+
+struct wm_record* wm_record_create(struct wm_server* server) {
+  const char *record_path = getenv("BOXY_RECORD");
+  const char *replay_path = getenv("BOXY_REPLAY");
+
+  if (record_path == NULL && replay_path == NULL) {
+    return NULL;
+  }
+
+  struct wm_record *record = calloc(1, sizeof(struct wm_record));
+  record->server = server;
+  wl_list_init(&record->devices);
+
+  if (record_path) {
+    record_open(record, record_path);
+  }
+
+  if (replay_path) {
+    replay_open(record, replay_path);
+  }
+
+  return record;
+}
+
+void wm_record_destroy(struct wm_record* record) {
+  if (record == NULL) {
+    return;
+  }
+
+  struct wm_record_device *device, *tmp;
+  wl_list_for_each_safe(device, tmp, &record->devices, link) {
+    record_device_free(device);
+  }
+
+  if (record->output) {
+    fclose(record->output);
+  }
+
+  if (record->input) {
+    fclose(record->input);
+  }
+
+  if (record->timer) {
+    wl_event_source_remove(record->timer);
+  }
+
+  free(record);
+}
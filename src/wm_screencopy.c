@@ -0,0 +1,1039 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_screencopy.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/log.h>
+
+#include "boxy-window-capture-unstable-v1-protocol.h"
+#include "wlr-screencopy-unstable-v1-protocol.h"
+
+#include "wm_output.h"
+#include "wm_server.h"
+#include "wm_surface.h"
+#include "wm_window.h"
+
+#define SCREENCOPY_MANAGER_VERSION 2
+#define WINDOW_CAPTURE_MANAGER_VERSION 1
+#define SCREENCOPY_FORMAT WL_SHM_FORMAT_XRGB8888
+
+static const struct zwlr_screencopy_frame_v1_interface frame_impl;
+static const struct zwlr_screencopy_manager_v1_interface manager_impl;
+static const struct zboxy_window_capture_manager_v1_interface window_manager_impl;
+
+static struct wm_screencopy_damage* screencopy_damage_find_or_create(
+  struct wm_screencopy_client *client, struct wm_output *output,
+  struct wm_window *window) {
+  struct wm_screencopy_damage *damage;
+  wl_list_for_each(damage, &client->damages, link) {
+    if (damage->output == output && damage->window == window) {
+      return damage;
+    }
+  }
+
+  damage = calloc(1, sizeof(struct wm_screencopy_damage));
+  damage->output = output;
+  damage->window = window;
+
+  // Nothing has been copied to this client yet so all of it is new
+  if (window) {
+    pixman_region32_init_rect(&damage->region, 0, 0,
+      window->extents.width, window->extents.height);
+  } else {
+    pixman_region32_init_rect(&damage->region, 0, 0,
+      output->wlr_output->width, output->wlr_output->height);
+  }
+
+  pixman_region32_init(&damage->valid);
+
+  wl_list_insert(&client->damages, &damage->link);
+  return damage;
+}
+
+static void screencopy_damage_destroy(struct wm_screencopy_damage *damage) {
+  wl_list_remove(&damage->link);
+  pixman_region32_fini(&damage->region);
+  pixman_region32_fini(&damage->valid);
+  free(damage->shadow);
+  free(damage);
+}
+
+static void frame_dequeue(struct wm_screencopy_frame *frame) {
+  wl_list_remove(&frame->link);
+  wl_list_init(&frame->link);
+
+  if (frame->buffer) {
+    wl_list_remove(&frame->buffer_destroy.link);
+    frame->buffer = NULL;
+  }
+
+  frame->output = NULL;
+  frame->window = NULL;
+}
+
+static void frame_fail(struct wm_screencopy_frame *frame) {
+  frame_dequeue(frame);
+  zwlr_screencopy_frame_v1_send_failed(frame->resource);
+}
+
+// Bounding box of every visible cursor on the output
+static struct wlr_box output_cursor_box(struct wm_output *output) {
+  struct wlr_box box = { 0 };
+
+  struct wlr_output_cursor *cursor;
+  wl_list_for_each(cursor, &output->wlr_output->cursors, link) {
+    if (!cursor->enabled || !cursor->visible) {
+      continue;
+    }
+
+    int x1 = cursor->x - cursor->hotspot_x;
+    int y1 = cursor->y - cursor->hotspot_y;
+    int x2 = x1 + cursor->width;
+    int y2 = y1 + cursor->height;
+
+    if (box.width > 0 && box.height > 0) {
+      x1 = x1 < box.x ? x1 : box.x;
+      y1 = y1 < box.y ? y1 : box.y;
+      x2 = x2 > box.x + box.width ? x2 : box.x + box.width;
+      y2 = y2 > box.y + box.height ? y2 : box.y + box.height;
+    }
+
+    box.x = x1;
+    box.y = y1;
+    box.width = x2 - x1;
+    box.height = y2 - y1;
+  }
+
+  return box;
+}
+
+static void render_output_cursors(struct wm_output *output) {
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+
+  struct wlr_output_cursor *cursor;
+  wl_list_for_each(cursor, &wlr_output->cursors, link) {
+    if (!cursor->enabled || !cursor->visible) {
+      continue;
+    }
+
+    struct wlr_texture *texture = cursor->texture;
+    if (texture == NULL && cursor->surface != NULL) {
+      texture = wlr_surface_get_texture(cursor->surface);
+    }
+
+    if (texture == NULL) {
+      continue;
+    }
+
+    wlr_render_texture(renderer, texture, wlr_output->transform_matrix,
+      cursor->x - cursor->hotspot_x, cursor->y - cursor->hotspot_y, 1.0f);
+  }
+}
+
+static struct wm_screencopy_damage* frame_damage(
+  struct wm_screencopy_frame *frame) {
+  if (frame->client == NULL) {
+    return NULL;
+  }
+
+  if (frame->window) {
+    return screencopy_damage_find_or_create(frame->client, NULL, frame->window);
+  }
+
+  return screencopy_damage_find_or_create(frame->client, frame->output, NULL);
+}
+
+// Reads the whole box straight into the client's buffer
+static bool frame_read_buffer(struct wm_screencopy_frame *frame,
+  struct wm_output *target) {
+  struct wlr_output *wlr_output = target->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+  struct wlr_box *box = &frame->box;
+
+  struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(frame->buffer);
+  int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+
+  wl_shm_buffer_begin_access(shm_buffer);
+  void *data = wl_shm_buffer_get_data(shm_buffer);
+
+  // Reads are in GL framebuffer coordinates which are bottom up, hence the
+  // y-invert flag
+  bool ok = wlr_renderer_read_pixels(renderer, SCREENCOPY_FORMAT, stride,
+    box->width, box->height, box->x, wlr_output->height - box->y - box->height,
+    0, 0, data);
+
+  wl_shm_buffer_end_access(shm_buffer);
+  return ok;
+}
+
+// Reads back only what changed since this client's last copy into its
+// shadow, then fills the client's buffer from the shadow
+static bool frame_read_shadow(struct wm_screencopy_frame *frame,
+  struct wm_output *target, struct wm_screencopy_damage *damage,
+  pixman_region32_t *region) {
+  struct wm_screencopy *screencopy = frame->screencopy;
+  struct wlr_output *wlr_output = target->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+  struct wlr_box *box = &frame->box;
+
+  int width = frame->window ? frame->window->extents.width : wlr_output->width;
+  int height = frame->window ?
+    frame->window->extents.height : wlr_output->height;
+
+  if (damage->shadow_width != width || damage->shadow_height != height) {
+    free(damage->shadow);
+    damage->shadow = malloc(width * height * sizeof(uint32_t));
+    damage->shadow_width = width;
+    damage->shadow_height = height;
+    pixman_region32_clear(&damage->valid);
+  }
+
+  // Cursor and cursorless copies see different pixels under the cursor
+  if (damage->shadow_cursor != frame->overlay_cursor) {
+    damage->shadow_cursor = frame->overlay_cursor;
+    pixman_region32_clear(&damage->valid);
+  }
+
+  pixman_region32_t current;
+  pixman_region32_init(&current);
+  pixman_region32_subtract(&current, &damage->valid, &damage->region);
+
+  pixman_region32_t read;
+  pixman_region32_init(&read);
+  pixman_region32_subtract(&read, region, &current);
+  pixman_region32_fini(&current);
+
+  bool ok = true;
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(&read, &nrects);
+
+  for (int i = 0; i < nrects && ok; i++) {
+    int rect_width = rects[i].x2 - rects[i].x1;
+    int rect_height = rects[i].y2 - rects[i].y1;
+    size_t size = rect_width * rect_height;
+
+    if (size > screencopy->scratch_size) {
+      screencopy->scratch = realloc(screencopy->scratch,
+        size * sizeof(uint32_t));
+      screencopy->scratch_size = size;
+    }
+
+    ok = wlr_renderer_read_pixels(renderer, SCREENCOPY_FORMAT,
+      rect_width * 4, rect_width, rect_height, rects[i].x1,
+      wlr_output->height - rects[i].y2, 0, 0, screencopy->scratch);
+
+    // GL rows are bottom up
+    for (int row = 0; ok && row < rect_height; row++) {
+      memcpy(damage->shadow + (rects[i].y2 - 1 - row) * width + rects[i].x1,
+        screencopy->scratch + row * rect_width, rect_width * sizeof(uint32_t));
+    }
+  }
+
+  pixman_region32_fini(&read);
+
+  if (!ok) {
+    return false;
+  }
+
+  pixman_region32_union(&damage->valid, &damage->valid, region);
+
+  struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(frame->buffer);
+  int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+
+  wl_shm_buffer_begin_access(shm_buffer);
+  uint8_t *data = wl_shm_buffer_get_data(shm_buffer);
+
+  // Filled bottom row first to match the y-invert flag
+  for (int row = 0; row < box->height; row++) {
+    int y = box->y + box->height - 1 - row;
+    memcpy(data + row * stride, damage->shadow + y * width + box->x,
+      box->width * sizeof(uint32_t));
+  }
+
+  wl_shm_buffer_end_access(shm_buffer);
+  return true;
+}
+
+// Copies the frame out of the framebuffer currently bound for target, which
+// for window captures holds the window drawn at its top left corner.
+static void frame_copy(struct wm_screencopy_frame *frame,
+  struct wm_output *target, struct timespec *now) {
+  struct wlr_box *box = &frame->box;
+
+  struct wm_screencopy_damage *damage = frame_damage(frame);
+
+  pixman_region32_t region;
+  pixman_region32_init_rect(&region, box->x, box->y, box->width, box->height);
+
+  // Clients may rotate several buffers, so every copy fills the whole buffer
+  // and damage only says what changed since this client's last copy
+  pixman_region32_t changed;
+  pixman_region32_init(&changed);
+
+  if (damage) {
+    pixman_region32_intersect(&changed, &region, &damage->region);
+  } else {
+    pixman_region32_copy(&changed, &region);
+  }
+
+  bool ok = damage ? frame_read_shadow(frame, target, damage, &region) :
+    frame_read_buffer(frame, target);
+
+  if (!ok) {
+    wlr_log(L_ERROR, "Failed to read pixels for screencopy");
+    pixman_region32_fini(&changed);
+    pixman_region32_fini(&region);
+    frame_fail(frame);
+    return;
+  }
+
+  if (frame->with_damage) {
+    int nrects;
+    pixman_box32_t *rects = pixman_region32_rectangles(&changed, &nrects);
+    for (int i = 0; i < nrects; i++) {
+      pixman_box32_t *rect = &rects[i];
+      zwlr_screencopy_frame_v1_send_damage(frame->resource,
+        rect->x1 - box->x, rect->y1 - box->y,
+        rect->x2 - rect->x1, rect->y2 - rect->y1);
+    }
+  }
+
+  pixman_region32_fini(&changed);
+
+  if (damage) {
+    pixman_region32_subtract(&damage->region, &damage->region, &region);
+  }
+
+  pixman_region32_fini(&region);
+  frame_dequeue(frame);
+
+  uint64_t tv_sec = now->tv_sec;
+  zwlr_screencopy_frame_v1_send_flags(frame->resource,
+    ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT);
+  zwlr_screencopy_frame_v1_send_ready(frame->resource,
+    tv_sec >> 32, tv_sec & 0xFFFFFFFF, now->tv_nsec);
+}
+
+static bool frame_is_ready(struct wm_screencopy_frame *frame) {
+  if (!frame->with_damage || frame->client == NULL) {
+    return true;
+  }
+
+  struct wm_screencopy_damage *damage = frame_damage(frame);
+
+  pixman_region32_t region;
+  pixman_region32_init_rect(&region, frame->box.x, frame->box.y,
+    frame->box.width, frame->box.height);
+  pixman_region32_intersect(&region, &region, &damage->region);
+
+  bool damaged = pixman_region32_not_empty(&region);
+  pixman_region32_fini(&region);
+
+  return damaged;
+}
+
+static void screencopy_accumulate_damage(struct wm_screencopy *screencopy,
+  struct wm_output *output) {
+  struct wlr_box cursor = output_cursor_box(output);
+
+  struct wm_screencopy_client *client;
+  wl_list_for_each(client, &screencopy->clients, link) {
+    struct wm_screencopy_damage *damage =
+      screencopy_damage_find_or_create(client, output, NULL);
+
+    pixman_region32_union(&damage->region, &damage->region, &output->damage);
+
+    bool cursor_moved = cursor.x != damage->cursor.x ||
+      cursor.y != damage->cursor.y ||
+      cursor.width != damage->cursor.width ||
+      cursor.height != damage->cursor.height;
+
+    if (cursor_moved) {
+      pixman_region32_union_rect(&damage->region, &damage->region,
+        damage->cursor.x, damage->cursor.y,
+        damage->cursor.width, damage->cursor.height);
+      pixman_region32_union_rect(&damage->region, &damage->region,
+        cursor.x, cursor.y, cursor.width, cursor.height);
+      damage->cursor = cursor;
+    }
+
+    pixman_region32_intersect_rect(&damage->region, &damage->region,
+      0, 0, output->wlr_output->width, output->wlr_output->height);
+  }
+}
+
+static void screencopy_copy_frames(struct wm_screencopy *screencopy,
+  struct wm_output *output, struct timespec *now, bool overlay_cursor) {
+  struct wm_screencopy_frame *frame, *tmp;
+  wl_list_for_each_safe(frame, tmp, &screencopy->frames, link) {
+    if (frame->output != output || frame->overlay_cursor != overlay_cursor) {
+      continue;
+    }
+
+    if (frame_is_ready(frame)) {
+      frame_copy(frame, output, now);
+    }
+  }
+}
+
+// Reads the back buffer under the cursors, bottom row first
+static uint32_t* save_cursor_pixels(struct wm_output *output,
+  struct wlr_box *box) {
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+
+  uint32_t *pixels = malloc(box->width * box->height * sizeof(uint32_t));
+
+  bool ok = wlr_renderer_read_pixels(renderer, SCREENCOPY_FORMAT,
+    box->width * 4, box->width, box->height,
+    box->x, wlr_output->height - box->y - box->height, 0, 0, pixels);
+
+  if (!ok) {
+    free(pixels);
+    return NULL;
+  }
+
+  return pixels;
+}
+
+static void restore_cursor_pixels(struct wm_output *output,
+  struct wlr_box *box, uint32_t *pixels) {
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+
+  // GL rows are bottom up, textures are uploaded top down
+  uint32_t *row = malloc(box->width * sizeof(uint32_t));
+  size_t row_size = box->width * sizeof(uint32_t);
+  for (int y = 0; y < box->height / 2; y++) {
+    uint32_t *top = pixels + y * box->width;
+    uint32_t *bottom = pixels + (box->height - 1 - y) * box->width;
+    memcpy(row, top, row_size);
+    memcpy(top, bottom, row_size);
+    memcpy(bottom, row, row_size);
+  }
+  free(row);
+
+  struct wlr_texture *texture = wlr_texture_from_pixels(renderer,
+    SCREENCOPY_FORMAT, box->width * 4, box->width, box->height, pixels);
+
+  if (texture == NULL) {
+    wlr_log(L_ERROR, "Failed to restore pixels under the captured cursor");
+    return;
+  }
+
+  float matrix[16];
+  wlr_matrix_project_box(matrix, box, WL_OUTPUT_TRANSFORM_NORMAL, 0,
+    wlr_output->transform_matrix);
+  wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0f);
+
+  wlr_texture_destroy(texture);
+}
+
+// Cursors live on their own plane or are drawn by wlroots at swap time, so
+// they are drawn into the back buffer only for the copy and the pixels under
+// them are put back before the frame is shown
+static void screencopy_copy_cursor_frames(struct wm_screencopy *screencopy,
+  struct wm_output *output, struct timespec *now) {
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_box output_box = {
+    .x = 0,
+    .y = 0,
+    .width = wlr_output->width,
+    .height = wlr_output->height
+  };
+
+  struct wlr_box cursor = output_cursor_box(output);
+  struct wlr_box box;
+
+  if (!wlr_box_intersection(&cursor, &output_box, &box)) {
+    screencopy_copy_frames(screencopy, output, now, true);
+    return;
+  }
+
+  uint32_t *pixels = save_cursor_pixels(output, &box);
+
+  if (pixels == NULL) {
+    wlr_log(L_ERROR, "Failed to read pixels under the cursor for screencopy");
+    screencopy_copy_frames(screencopy, output, now, true);
+    return;
+  }
+
+  render_output_cursors(output);
+  screencopy_copy_frames(screencopy, output, now, true);
+  restore_cursor_pixels(output, &box, pixels);
+
+  free(pixels);
+}
+
+static bool screencopy_wants_cursor(struct wm_screencopy *screencopy,
+  struct wm_output *output) {
+  struct wm_screencopy_frame *frame;
+  wl_list_for_each(frame, &screencopy->frames, link) {
+    if (frame->output == output && frame->overlay_cursor &&
+        frame_is_ready(frame)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void wm_screencopy_render_windows(struct wm_screencopy* screencopy,
+  struct wm_output* output) {
+  if (screencopy == NULL) {
+    return;
+  }
+
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  float transparent[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+  // Windows are drawn alone into the corner of the output's buffer before
+  // the scene is composed over it, so covered and off screen windows can be
+  // captured without reading back the whole output.
+  struct wm_screencopy_frame *frame, *tmp;
+  wl_list_for_each_safe(frame, tmp, &screencopy->frames, link) {
+    struct wm_window *window = frame->window;
+    if (window == NULL || !frame_is_ready(frame)) {
+      continue;
+    }
+
+    bool resized = window->extents.width != frame->box.width ||
+      window->extents.height != frame->box.height;
+
+    bool fits = frame->box.width <= wlr_output->width &&
+      frame->box.height <= wlr_output->height;
+
+    if (resized || !fits) {
+      frame_fail(frame);
+      continue;
+    }
+
+    wlr_renderer_clear(renderer, transparent);
+    wm_output_render_window(output, window,
+      window->x - window->extents.x, window->y - window->extents.y, 1.0);
+
+    frame_copy(frame, output, &now);
+  }
+}
+
+void wm_screencopy_output_frame(struct wm_screencopy* screencopy,
+  struct wm_output* output, struct timespec* now) {
+  if (screencopy == NULL) {
+    return;
+  }
+
+  screencopy_accumulate_damage(screencopy, output);
+
+  if (wl_list_empty(&screencopy->frames)) {
+    return;
+  }
+
+  screencopy_copy_frames(screencopy, output, now, false);
+
+  if (screencopy_wants_cursor(screencopy, output)) {
+    screencopy_copy_cursor_frames(screencopy, output, now);
+  }
+}
+
+void wm_screencopy_output_destroy(struct wm_screencopy* screencopy,
+  struct wm_output* output) {
+  if (screencopy == NULL) {
+    return;
+  }
+
+  struct wm_screencopy_frame *frame, *tmp_frame;
+  wl_list_for_each_safe(frame, tmp_frame, &screencopy->frames, link) {
+    if (frame->output == output) {
+      frame_fail(frame);
+    }
+  }
+
+  struct wm_screencopy_client *client;
+  wl_list_for_each(client, &screencopy->clients, link) {
+    struct wm_screencopy_damage *damage, *tmp_damage;
+    wl_list_for_each_safe(damage, tmp_damage, &client->damages, link) {
+      if (damage->output == output) {
+        screencopy_damage_destroy(damage);
+      }
+    }
+  }
+}
+
+static struct wm_screencopy_frame* frame_from_resource(
+  struct wl_resource *resource) {
+  assert(wl_resource_instance_of(resource,
+    &zwlr_screencopy_frame_v1_interface, &frame_impl));
+  return wl_resource_get_user_data(resource);
+}
+
+static void handle_frame_buffer_destroy(struct wl_listener *listener,
+  void *data) {
+  (void)data;
+  struct wm_screencopy_frame *frame =
+    wl_container_of(listener, frame, buffer_destroy);
+  frame_fail(frame);
+}
+
+static void frame_handle_copy_request(struct wl_resource *frame_resource,
+  struct wl_resource *buffer_resource, bool with_damage) {
+  struct wm_screencopy_frame *frame = frame_from_resource(frame_resource);
+
+  if (frame->used) {
+    wl_resource_post_error(frame->resource,
+      ZWLR_SCREENCOPY_FRAME_V1_ERROR_ALREADY_USED,
+      "frame already used");
+    return;
+  }
+
+  frame->used = true;
+
+  if (frame->output == NULL && frame->window == NULL) {
+    zwlr_screencopy_frame_v1_send_failed(frame->resource);
+    return;
+  }
+
+  struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(buffer_resource);
+
+  bool valid = shm_buffer != NULL &&
+    wl_shm_buffer_get_format(shm_buffer) == SCREENCOPY_FORMAT &&
+    wl_shm_buffer_get_width(shm_buffer) == frame->box.width &&
+    wl_shm_buffer_get_height(shm_buffer) == frame->box.height &&
+    wl_shm_buffer_get_stride(shm_buffer) >= frame->box.width * 4;
+
+  if (!valid) {
+    wl_resource_post_error(frame->resource,
+      ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER,
+      "invalid buffer attributes");
+    return;
+  }
+
+  frame->buffer = buffer_resource;
+  frame->with_damage = with_damage;
+
+  frame->buffer_destroy.notify = handle_frame_buffer_destroy;
+  wl_resource_add_destroy_listener(buffer_resource, &frame->buffer_destroy);
+
+  wl_list_insert(&frame->screencopy->frames, &frame->link);
+
+  if (frame->output) {
+    wlr_output_schedule_frame(frame->output->wlr_output);
+    return;
+  }
+
+  // Window captures are drawn by whichever output renders next
+  struct wl_list *outputs = &frame->screencopy->server->outputs;
+  if (!wl_list_empty(outputs)) {
+    struct wm_output *output = wl_list_first(outputs, output, link);
+    wlr_output_schedule_frame(output->wlr_output);
+  }
+}
+
+static void frame_handle_copy(struct wl_client *client,
+  struct wl_resource *frame_resource, struct wl_resource *buffer_resource) {
+  (void)client;
+  frame_handle_copy_request(frame_resource, buffer_resource, false);
+}
+
+static void frame_handle_copy_with_damage(struct wl_client *client,
+  struct wl_resource *frame_resource, struct wl_resource *buffer_resource) {
+  (void)client;
+  frame_handle_copy_request(frame_resource, buffer_resource, true);
+}
+
+static void frame_handle_destroy(struct wl_client *client,
+  struct wl_resource *frame_resource) {
+  (void)client;
+  wl_resource_destroy(frame_resource);
+}
+
+static const struct zwlr_screencopy_frame_v1_interface frame_impl = {
+  .copy = frame_handle_copy,
+  .destroy = frame_handle_destroy,
+  .copy_with_damage = frame_handle_copy_with_damage,
+};
+
+static void frame_handle_resource_destroy(struct wl_resource *resource) {
+  struct wm_screencopy_frame *frame = frame_from_resource(resource);
+  frame_dequeue(frame);
+  wl_list_remove(&frame->client_link);
+  free(frame);
+}
+
+static struct wm_screencopy_client* client_from_resource(
+  struct wl_resource *resource) {
+  assert(wl_resource_instance_of(resource,
+    &zwlr_screencopy_manager_v1_interface, &manager_impl));
+  return wl_resource_get_user_data(resource);
+}
+
+static struct wm_output* output_from_resource(struct wm_server *server,
+  struct wl_resource *output_resource) {
+  struct wlr_output *wlr_output = wlr_output_from_resource(output_resource);
+
+  struct wm_output *output;
+  wl_list_for_each(output, &server->outputs, link) {
+    if (output->wlr_output == wlr_output) {
+      return output;
+    }
+  }
+
+  return NULL;
+}
+
+static struct wm_screencopy_frame* frame_create(struct wl_client *wl_client,
+  struct wm_screencopy_client *client, uint32_t version, uint32_t id) {
+  struct wm_screencopy_frame *frame =
+    calloc(1, sizeof(struct wm_screencopy_frame));
+
+  frame->screencopy = client->screencopy;
+  frame->client = client;
+  wl_list_init(&frame->link);
+  wl_list_insert(&client->frames, &frame->client_link);
+
+  frame->resource = wl_resource_create(wl_client,
+    &zwlr_screencopy_frame_v1_interface, version, id);
+
+  if (frame->resource == NULL) {
+    wl_list_remove(&frame->client_link);
+    free(frame);
+    wl_client_post_no_memory(wl_client);
+    return NULL;
+  }
+
+  wl_resource_set_implementation(frame->resource, &frame_impl, frame,
+    frame_handle_resource_destroy);
+
+  return frame;
+}
+
+static void capture_output(struct wl_client *wl_client,
+  struct wl_resource *manager_resource, uint32_t id, int32_t overlay_cursor,
+  struct wl_resource *output_resource, struct wlr_box *logical_box) {
+  struct wm_screencopy_client *client = client_from_resource(manager_resource);
+  struct wm_screencopy *screencopy = client->screencopy;
+
+  struct wm_screencopy_frame *frame = frame_create(wl_client, client,
+    wl_resource_get_version(manager_resource), id);
+
+  if (frame == NULL) {
+    return;
+  }
+
+  frame->overlay_cursor = overlay_cursor != 0;
+
+  struct wm_output *output = output_from_resource(screencopy->server,
+    output_resource);
+
+  if (output == NULL) {
+    zwlr_screencopy_frame_v1_send_failed(frame->resource);
+    return;
+  }
+
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_box output_box = {
+    .x = 0,
+    .y = 0,
+    .width = wlr_output->width,
+    .height = wlr_output->height
+  };
+
+  if (logical_box) {
+    double scale = wlr_output->scale;
+    struct wlr_box scaled_box = {
+      .x = logical_box->x * scale,
+      .y = logical_box->y * scale,
+      .width = logical_box->width * scale,
+      .height = logical_box->height * scale
+    };
+
+    if (!wlr_box_intersection(&scaled_box, &output_box, &frame->box)) {
+      zwlr_screencopy_frame_v1_send_failed(frame->resource);
+      return;
+    }
+  } else {
+    frame->box = output_box;
+  }
+
+  frame->output = output;
+
+  zwlr_screencopy_frame_v1_send_buffer(frame->resource, SCREENCOPY_FORMAT,
+    frame->box.width, frame->box.height, frame->box.width * 4);
+}
+
+static void manager_handle_capture_output(struct wl_client *wl_client,
+  struct wl_resource *manager_resource, uint32_t id, int32_t overlay_cursor,
+  struct wl_resource *output_resource) {
+  capture_output(wl_client, manager_resource, id, overlay_cursor,
+    output_resource, NULL);
+}
+
+static void manager_handle_capture_output_region(struct wl_client *wl_client,
+  struct wl_resource *manager_resource, uint32_t id, int32_t overlay_cursor,
+  struct wl_resource *output_resource, int32_t x, int32_t y,
+  int32_t width, int32_t height) {
+  struct wlr_box box = {
+    .x = x,
+    .y = y,
+    .width = width,
+    .height = height
+  };
+  capture_output(wl_client, manager_resource, id, overlay_cursor,
+    output_resource, &box);
+}
+
+static void manager_handle_destroy(struct wl_client *wl_client,
+  struct wl_resource *manager_resource) {
+  (void)wl_client;
+  wl_resource_destroy(manager_resource);
+}
+
+static const struct zwlr_screencopy_manager_v1_interface manager_impl = {
+  .capture_output = manager_handle_capture_output,
+  .capture_output_region = manager_handle_capture_output_region,
+  .destroy = manager_handle_destroy,
+};
+
+static void screencopy_client_destroy(struct wm_screencopy_client *client) {
+  struct wm_screencopy_damage *damage, *tmp_damage;
+  wl_list_for_each_safe(damage, tmp_damage, &client->damages, link) {
+    screencopy_damage_destroy(damage);
+  }
+
+  struct wm_screencopy_frame *frame, *tmp_frame;
+  wl_list_for_each_safe(frame, tmp_frame, &client->frames, client_link) {
+    frame->client = NULL;
+    wl_list_remove(&frame->client_link);
+    wl_list_init(&frame->client_link);
+  }
+
+  wl_list_remove(&client->link);
+  free(client);
+}
+
+static void manager_handle_resource_destroy(struct wl_resource *resource) {
+  screencopy_client_destroy(client_from_resource(resource));
+}
+
+static void manager_bind(struct wl_client *wl_client, void *data,
+  uint32_t version, uint32_t id) {
+  struct wm_screencopy *screencopy = data;
+
+  struct wm_screencopy_client *client =
+    calloc(1, sizeof(struct wm_screencopy_client));
+
+  client->screencopy = screencopy;
+  client->resource = wl_resource_create(wl_client,
+    &zwlr_screencopy_manager_v1_interface, version, id);
+
+  if (client->resource == NULL) {
+    free(client);
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wl_list_init(&client->damages);
+  wl_list_init(&client->frames);
+  wl_list_insert(&screencopy->clients, &client->link);
+
+  wl_resource_set_implementation(client->resource, &manager_impl, client,
+    manager_handle_resource_destroy);
+}
+
+static struct wm_screencopy_client* window_client_from_resource(
+  struct wl_resource *resource) {
+  assert(wl_resource_instance_of(resource,
+    &zboxy_window_capture_manager_v1_interface, &window_manager_impl));
+  return wl_resource_get_user_data(resource);
+}
+
+static void window_manager_handle_capture_window(struct wl_client *wl_client,
+  struct wl_resource *manager_resource, uint32_t id, uint32_t window_id) {
+  struct wm_screencopy_client *client =
+    window_client_from_resource(manager_resource);
+
+  // Frames are screencopy frames, version 2 brings copy_with_damage
+  struct wm_screencopy_frame *frame = frame_create(wl_client, client,
+    SCREENCOPY_MANAGER_VERSION, id);
+
+  if (frame == NULL) {
+    return;
+  }
+
+  struct wm_window *window;
+  wl_list_for_each(window, &client->screencopy->server->windows, link) {
+    if (window->id == window_id) {
+      frame->window = window;
+      break;
+    }
+  }
+
+  if (frame->window == NULL || frame->window->extents.width <= 0 ||
+      frame->window->extents.height <= 0) {
+    frame->window = NULL;
+    zwlr_screencopy_frame_v1_send_failed(frame->resource);
+    return;
+  }
+
+  frame->box.width = frame->window->extents.width;
+  frame->box.height = frame->window->extents.height;
+
+  zwlr_screencopy_frame_v1_send_buffer(frame->resource, SCREENCOPY_FORMAT,
+    frame->box.width, frame->box.height, frame->box.width * 4);
+}
+
+static void window_manager_handle_destroy(struct wl_client *wl_client,
+  struct wl_resource *manager_resource) {
+  (void)wl_client;
+  wl_resource_destroy(manager_resource);
+}
+
+static const struct zboxy_window_capture_manager_v1_interface window_manager_impl = {
+  .capture_window = window_manager_handle_capture_window,
+  .destroy = window_manager_handle_destroy,
+};
+
+static void window_manager_handle_resource_destroy(struct wl_resource *resource) {
+  screencopy_client_destroy(window_client_from_resource(resource));
+}
+
+static void window_manager_bind(struct wl_client *wl_client, void *data,
+  uint32_t version, uint32_t id) {
+  struct wm_screencopy *screencopy = data;
+
+  struct wm_screencopy_client *client =
+    calloc(1, sizeof(struct wm_screencopy_client));
+
+  client->screencopy = screencopy;
+  client->resource = wl_resource_create(wl_client,
+    &zboxy_window_capture_manager_v1_interface, version, id);
+
+  if (client->resource == NULL) {
+    free(client);
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wl_list_init(&client->damages);
+  wl_list_init(&client->frames);
+  wl_list_insert(&screencopy->window_clients, &client->link);
+
+  wl_resource_set_implementation(client->resource, &window_manager_impl,
+    client, window_manager_handle_resource_destroy);
+
+  struct wm_window *window;
+  wl_list_for_each_reverse(window, &screencopy->server->windows, link) {
+    zboxy_window_capture_manager_v1_send_window(client->resource,
+      window->id, window->name);
+  }
+}
+
+void wm_screencopy_window_add(struct wm_screencopy* screencopy,
+  struct wm_window* window) {
+  if (screencopy == NULL) {
+    return;
+  }
+
+  struct wm_screencopy_client *client;
+  wl_list_for_each(client, &screencopy->window_clients, link) {
+    zboxy_window_capture_manager_v1_send_window(client->resource,
+      window->id, window->name);
+  }
+}
+
+void wm_screencopy_window_damage(struct wm_screencopy* screencopy,
+  struct wm_window* window, struct wlr_box* box) {
+  if (screencopy == NULL) {
+    return;
+  }
+
+  struct wm_screencopy_client *client;
+  wl_list_for_each(client, &screencopy->window_clients, link) {
+    struct wm_screencopy_damage *damage;
+    wl_list_for_each(damage, &client->damages, link) {
+      if (damage->window == window) {
+        pixman_region32_union_rect(&damage->region, &damage->region,
+          box->x, box->y, box->width, box->height);
+        pixman_region32_intersect_rect(&damage->region, &damage->region,
+          0, 0, window->extents.width, window->extents.height);
+      }
+    }
+  }
+}
+
+void wm_screencopy_window_remove(struct wm_screencopy* screencopy,
+  struct wm_window* window) {
+  if (screencopy == NULL) {
+    return;
+  }
+
+  struct wm_screencopy_frame *frame, *tmp_frame;
+  wl_list_for_each_safe(frame, tmp_frame, &screencopy->frames, link) {
+    if (frame->window == window) {
+      frame_fail(frame);
+    }
+  }
+
+  struct wm_screencopy_client *client;
+  wl_list_for_each(client, &screencopy->window_clients, link) {
+    struct wm_screencopy_damage *damage, *tmp_damage;
+    wl_list_for_each_safe(damage, tmp_damage, &client->damages, link) {
+      if (damage->window == window) {
+        screencopy_damage_destroy(damage);
+      }
+    }
+
+    // Frames not yet handed a buffer still point at the window
+    struct wm_screencopy_frame *frame;
+    wl_list_for_each(frame, &client->frames, client_link) {
+      if (frame->window == window) {
+        frame->window = NULL;
+      }
+    }
+
+    zboxy_window_capture_manager_v1_send_window_closed(client->resource,
+      window->id);
+  }
+}
+
+struct wm_screencopy* wm_screencopy_create(struct wm_server* server) {
+  struct wm_screencopy *screencopy = calloc(1, sizeof(struct wm_screencopy));
+  screencopy->server = server;
+
+  wl_list_init(&screencopy->clients);
+  wl_list_init(&screencopy->window_clients);
+  wl_list_init(&screencopy->frames);
+
+  screencopy->global = wl_global_create(server->wl_display,
+    &zwlr_screencopy_manager_v1_interface, SCREENCOPY_MANAGER_VERSION,
+    screencopy, manager_bind);
+
+  screencopy->window_global = wl_global_create(server->wl_display,
+    &zboxy_window_capture_manager_v1_interface, WINDOW_CAPTURE_MANAGER_VERSION,
+    screencopy, window_manager_bind);
+
+  return screencopy;
+}
+
+void wm_screencopy_destroy(struct wm_screencopy* screencopy) {
+  if (screencopy == NULL) {
+    return;
+  }
+
+  wl_global_destroy(screencopy->global);
+  wl_global_destroy(screencopy->window_global);
+  free(screencopy->scratch);
+  free(screencopy);
+}
@@ -14,6 +14,7 @@
 #include "wm_surface.h"
 #include "wm_keyboard.h"
 #include "wm_output.h"
+#include "wm_workspace.h"
 
 void seat_destroy_notify(struct wl_listener *listener, void *data) {
   (void)data;
@@ -27,6 +28,12 @@ void wm_seat_destroy(struct wm_seat* seat) {
     wm_keyboard_destroy(keyboard);
   }
 
+  struct wm_seat_focus *focus, *next;
+  wl_list_for_each_safe(focus, next, &seat->focus_order, link) {
+    wl_list_remove(&focus->window_link);
+    free(focus);
+  }
+
   wlr_cursor_destroy(seat->pointer->cursor);
   free(seat->pointer);
 
@@ -47,8 +54,79 @@ void wm_seat_attach_pointing_device(struct wm_seat* seat,
 
 void wm_seat_attach_keyboard_device(struct wm_seat* seat,
   struct wlr_input_device* device) {
-  struct wm_keyboard* keyboard = wm_keyboard_create(device, seat);
-  wl_list_insert(&seat->keyboards, &keyboard->link);
+  wm_keyboard_create(device, seat);
+}
+
+static struct wm_seat_focus* seat_focus_find(struct wm_seat *seat,
+  struct wm_window *window) {
+  struct wm_seat_focus *focus;
+  wl_list_for_each(focus, &window->focus_entries, window_link) {
+    if (focus->seat == seat) {
+      return focus;
+    }
+  }
+  return NULL;
+}
+
+void wm_seat_focus_promote(struct wm_seat* seat, struct wm_window* window) {
+  struct wm_seat_focus *focus = seat_focus_find(seat, window);
+
+  if (focus == NULL) {
+    focus = calloc(1, sizeof(struct wm_seat_focus));
+    focus->seat = seat;
+    focus->window = window;
+    wl_list_insert(&window->focus_entries, &focus->window_link);
+  } else {
+    wl_list_remove(&focus->link);
+  }
+
+  wl_list_insert(&seat->focus_order, &focus->link);
+  seat->focus_switch = NULL;
+}
+
+void wm_seat_focus_remove(struct wm_seat* seat, struct wm_window* window) {
+  struct wm_seat_focus *focus = seat_focus_find(seat, window);
+  if (focus == NULL) {
+    return;
+  }
+
+  if (seat->focus_switch == focus) {
+    seat->focus_switch = NULL;
+  }
+
+  wl_list_remove(&focus->link);
+  wl_list_remove(&focus->window_link);
+  free(focus);
+}
+
+// Moves the pending switch one window further back, wrapping to the front
+struct wm_window* wm_seat_focus_step(struct wm_seat* seat) {
+  struct wl_list *order = &seat->focus_order;
+
+  // Nothing to switch between with fewer than two windows
+  if (order->next == order->prev) {
+    return NULL;
+  }
+
+  struct wl_list *start = seat->focus_switch ?
+    &seat->focus_switch->link : order->next;
+  struct wl_list *next = start;
+
+  // Windows on hidden workspaces are skipped
+  do {
+    next = next->next;
+    if (next == order) {
+      next = order->next;
+    }
+
+    struct wm_seat_focus *focus = wl_container_of(next, focus, link);
+    if (wm_workspace_window_visible(focus->window)) {
+      seat->focus_switch = focus;
+      return focus->window;
+    }
+  } while (next != start);
+
+  return NULL;
 }
 
 struct wm_seat* wm_seat_find_or_create(struct wm_server* server,
@@ -68,6 +146,8 @@ struct wm_seat* wm_seat_find_or_create(struct wm_server* server,
   printf("Created seat: %s\n", seat->name);
 
   wl_list_init(&seat->keyboards);
+  wl_list_init(&seat->keyboard_groups);
+  wl_list_init(&seat->focus_order);
   wl_list_insert(&server->seats, &seat->link);
 
   wl_signal_add(&seat->seat->events.destroy, &seat->destroy);
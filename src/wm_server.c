@@ -2,10 +2,13 @@
 
 #include "wm_server.h"
 
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <wlr/backend.h>
 #include <wlr/xwayland.h>
+#include <wlr/backend/headless.h>
 #include <wlr/backend/session.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_surface.h>
@@ -23,23 +26,79 @@
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_cursor.h>
-#include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_server_decoration.h>
 #include <wlr/types/wlr_linux_dmabuf.h>
+#include <wlr/types/wlr_export_dmabuf_v1.h>
 #include <wlr/util/log.h>
 
+#include "wm_bindings.h"
+#include "wm_buffer.h"
+#include "wm_constraints.h"
+#include "wm_cursor_shape.h"
+#include "wm_cursors.h"
+#include "wm_debug.h"
+#include "wm_hud.h"
+#include "wm_index.h"
+#include "wm_input.h"
 #include "wm_pointer.h"
+#include "wm_record.h"
+#include "wm_screencopy.h"
 #include "wm_seat.h"
 #include "wm_window.h"
+#include "wm_window_store.h"
+#include "wm_workspace.h"
+#include "wm_mirror.h"
 #include "wm_output.h"
 #include "wm_surface.h"
 #include "wm_keyboard.h"
+#include "wm_keymap.h"
 #include "wm_shell.h"
 #include "wm_shell_xdg.h"
 #include "wm_shell_xdg_v6.h"
+#include "wm_timestamps.h"
+#include "wm_virtual.h"
+#include "wm_vnc.h"
 
 void wm_server_destroy(struct wm_server* server) {
+  wl_display_destroy_clients(server->wl_display);
+
+  wm_vnc_destroy(server->vnc);
+  server->vnc = NULL;
+
+  wm_input_destroy(server->input);
+  server->input = NULL;
+
+  wm_index_destroy(server->index);
+  server->index = NULL;
+
+  wm_window_store_destroy(server->window_store);
+  server->window_store = NULL;
+
+  wm_bindings_destroy(server->bindings);
+  server->bindings = NULL;
+
+  wm_mirror_destroy(server->mirror);
+  server->mirror = NULL;
+
+  wm_hud_destroy(server->hud);
+  server->hud = NULL;
+
+  wm_screencopy_destroy(server->screencopy);
+  server->screencopy = NULL;
+
+  wm_timestamps_destroy(server->timestamps);
+  server->timestamps = NULL;
+
+  wm_constraints_destroy(server->constraints);
+  server->constraints = NULL;
+
+  wm_cursor_shape_destroy(server->cursor_shape);
+  server->cursor_shape = NULL;
+
+  wm_virtual_destroy(server->virtual);
+  server->virtual = NULL;
+
   wlr_data_device_manager_destroy(server->data_device_manager);
   server->data_device_manager = NULL;
 
@@ -55,30 +114,39 @@ void wm_server_destroy(struct wm_server* server) {
   wlr_compositor_destroy(server->compositor);
   server->compositor = NULL;
 
-  wlr_xcursor_manager_destroy(server->xcursor_manager);
-  server->xcursor_manager = NULL;
+  wm_cursors_destroy(server->cursors);
+  server->cursors = NULL;
+
+  wm_record_destroy(server->record);
+  server->record = NULL;
 
   wlr_backend_destroy(server->backend);
   server->backend = NULL;
 
+  wm_keymaps_destroy(server->keymaps);
+  server->keymaps = NULL;
+
   wl_display_destroy(server->wl_display);
   server->wl_display = NULL;
 
   free(server);
 }
 
-void wm_server_set_cursors(struct wm_server* server) {
-  wlr_xcursor_manager_load(server->xcursor_manager, 1);
-}
-
 void wm_server_connect_output(struct wm_server* server, struct wlr_output* wlr_output) {
   printf("Output %s Connected\n", wlr_output->name);
   struct wm_output *output = wm_output_create(wlr_output, server->layout, server);
   wl_list_insert(&server->outputs, &output->link);
+  wm_workspace_output_added(output);
 }
 
 void wm_server_connect_input(struct wm_server* server, struct wlr_input_device* device) {
   struct wm_seat* seat = wm_seat_find_or_create(server, WM_DEFAULT_SEAT);
+  wm_server_connect_seat_input(server, seat, device);
+}
+
+void wm_server_connect_seat_input(struct wm_server* server,
+  struct wm_seat* seat, struct wlr_input_device* device) {
+  wm_record_device_added(server->record, device);
 
   if (device->type == WLR_INPUT_DEVICE_KEYBOARD) {
     fprintf(stdout, "Keyboard Connected\n");
@@ -105,10 +173,36 @@ void wm_server_run(struct wm_server* server) {
   }
 
   printf("Backend started\n");
+  wm_record_start_replay(server->record);
   setenv("WAYLAND_DISPLAY", server->socket, true);
   printf("Running compositor on wayland display '%s'\n", server->socket);
 
-  wl_display_run(server->wl_display);
+  struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
+  struct pollfd pollfd = {
+    .fd = wl_event_loop_get_fd(loop),
+    .events = POLLIN
+  };
+
+  // Same as wl_display_run but waits separately from dispatching so the
+  // HUD can tell how long the loop spends busy
+  server->running = true;
+  while (server->running) {
+    wl_display_flush_clients(server->wl_display);
+    wl_event_loop_dispatch_idle(loop);
+
+    struct timespec idle_start, idle_end;
+    clock_gettime(CLOCK_MONOTONIC, &idle_start);
+    poll(&pollfd, 1, -1);
+    clock_gettime(CLOCK_MONOTONIC, &idle_end);
+
+    wm_hud_loop_idle(server->hud, &idle_start, &idle_end);
+    wl_event_loop_dispatch(loop, 0);
+  }
+}
+
+void wm_server_terminate(struct wm_server* server) {
+  server->running = false;
+  wl_display_terminate(server->wl_display);
 }
 
 static void new_input_notify(struct wl_listener *listener, void *data) {
@@ -117,6 +211,14 @@ static void new_input_notify(struct wl_listener *listener, void *data) {
   wm_server_connect_input(server, device);
 }
 
+static void new_surface_notify(struct wl_listener *listener, void *data) {
+  struct wlr_surface *surface = data;
+  struct wm_server *server = wl_container_of(listener, server, new_surface);
+  if (server->release_shm_buffers) {
+    wm_buffer_release_create(surface);
+  }
+}
+
 static void new_output_notify(struct wl_listener *listener, void *data) {
   struct wm_server *server = wl_container_of(listener, server, new_output);
   wm_server_connect_output(server, data);
@@ -140,12 +242,22 @@ struct wm_server* wm_server_create() {
 
   fprintf(stdout, "Created display\n");
 
-  server->backend = wlr_backend_autocreate(server->wl_display, NULL);
+  // Replays run headless so live devices cannot interfere
+  if (wm_record_replay_enabled()) {
+    server->backend = wlr_headless_backend_create(server->wl_display, NULL);
+    if (server->backend) {
+      wlr_headless_add_output(server->backend, 1920, 1080);
+    }
+  } else {
+    server->backend = wlr_backend_autocreate(server->wl_display, NULL);
+  }
 
   if (!server->backend) {
     fprintf(stderr, "Failed to create backend\n");
   }
 
+  server->record = wm_record_create(server);
+
   fprintf(stdout, "Created backend\n");
 
   server->data_device_manager = wlr_data_device_manager_create(server->wl_display);
@@ -156,18 +268,26 @@ struct wm_server* wm_server_create() {
   server->xdg_output_manager = wlr_xdg_output_manager_create(server->wl_display, server->layout);
   server->compositor = wlr_compositor_create(server->wl_display, server->renderer);
 
+  server->release_shm_buffers = wm_buffer_release_enabled();
+  server->resize_snapshot = wm_window_resize_snapshot_mode();
+
+  if (server->release_shm_buffers) {
+    printf("Releasing shm buffers after upload\n");
+  }
+
+  server->new_surface.notify = new_surface_notify;
+  wl_signal_add(&server->compositor->events.new_surface, &server->new_surface);
+
   struct wm_shell* xdg_shell = wm_shell_xdg_create(server);
   wl_list_insert(&server->shells, &xdg_shell->link);
 
   struct wm_shell* xdg_shell_v6 = wm_shell_xdg_v6_create(server);
   wl_list_insert(&server->shells, &xdg_shell_v6->link);
 
-  server->xcursor_manager = wlr_xcursor_manager_create("default", 24);
+  server->input = wm_input_create(server);
 
-  if (!server->xcursor_manager) {
-    wlr_log(L_ERROR, "Failed to load cursor");
-    return NULL;
-  }
+  // Themes load per output scale on first use
+  server->cursors = wm_cursors_create(server, "default", 24);
 
   server->server_decoration_manager = wlr_server_decoration_manager_create(server->wl_display);
   wlr_server_decoration_manager_set_default_mode(server->server_decoration_manager,
@@ -178,6 +298,28 @@ struct wm_server* wm_server_create() {
 
   server->linux_dmabuf = wlr_linux_dmabuf_create(server->wl_display, server->renderer);
 
+  server->index = wm_index_create();
+  server->window_store = wm_window_store_create();
+  server->bindings = wm_bindings_create();
+  server->keymaps = wm_keymaps_create(server);
+
+  // Compile the environment's keymap before the first keyboard shows up
+  struct xkb_rule_names rules;
+  wm_keymaps_default_rules(&rules);
+  wm_keymaps_get(server->keymaps, &rules);
+
+  server->screencopy = wm_screencopy_create(server);
+  server->timestamps = wm_timestamps_create(server);
+  server->constraints = wm_constraints_create(server);
+  server->cursor_shape = wm_cursor_shape_create(server);
+  server->virtual = wm_virtual_create(server);
+  server->vnc = wm_vnc_create(server);
+  server->mirror = wm_mirror_create(server);
+  server->debug_mode = wm_debug_mode_from_env();
+  server->hud = wm_hud_create(server);
+  server->export_dmabuf_manager =
+    wlr_export_dmabuf_manager_v1_create(server->wl_display);
+
   server->socket = wl_display_add_socket_auto(server->wl_display);
 
   if (!server->socket) {
@@ -192,109 +334,179 @@ struct wm_server* wm_server_create() {
   server->new_output.notify = new_output_notify;
   wl_signal_add(&server->backend->events.new_output, &server->new_output);
 
-  wm_server_set_cursors(server);
-
   return server;
 }
 
 struct wm_window* wm_server_window_at_point(struct wm_server* server, int x, int y) {
-  struct wm_window* window;
-  wl_list_for_each(window, &server->windows, link) {
-    bool intersects = wm_window_intersects_point(window, x, y);
+  struct wm_window *windows[WM_INDEX_MAX_RESULTS];
+  int count = wm_index_query(server->index, x, y, windows, WM_INDEX_MAX_RESULTS);
+
+  for (int i = 0; i < count; i++) {
+    bool intersects = wm_window_intersects_point(windows[i], x, y);
     if (intersects) {
-      return window;
+      return windows[i];
     }
   }
   return NULL;
 }
 
-void wm_server_maximize_focused_window(struct wm_server* server) {
-  bool has_window = !wl_list_empty(&server->windows);
-  if (has_window) {
-    struct wm_window *window = wl_list_first(&server->windows, window, link);
-    wm_window_maximize(window, true);
+void wm_server_maximize_focused_window(struct wm_server* server,
+  struct wm_seat* seat) {
+  (void)server;
+  if (seat->focused_window) {
+    wm_window_maximize(seat->focused_window, true);
   }
 }
 
-void wm_server_add_window(struct wm_server* server,
-  struct wm_window* window, struct wm_seat* seat) {
+void wm_server_damage_box(struct wm_server* server, struct wlr_box* box) {
+  if (box->width <= 0 || box->height <= 0) {
+    return;
+  }
 
-  struct wm_window *old_window;
-  wl_list_for_each(old_window, &server->windows, link) {
+  struct wm_output *output;
+  wl_list_for_each(output, &server->outputs, link) {
+    if (wlr_output_layout_intersects(server->layout, output->wlr_output, box)) {
+      wm_output_damage_box(output, box);
+    }
+  }
+}
+
+// A lock or confinement only holds while its window has keyboard focus
+static void server_release_constraint(struct wm_seat *seat,
+  struct wm_window *window) {
+  struct wm_pointer *pointer = seat->pointer;
+  if (pointer && pointer->constraint && pointer->constraint->window != window) {
+    wm_constraints_deactivate(pointer);
+  }
+}
+
+// Only the seat's previous window is deactivated, whatever the window count
+static void server_set_focus(struct wm_seat *seat, struct wm_window *window) {
+  struct wm_window *old_window = seat->focused_window;
+  server_release_constraint(seat, window);
+
+  if (old_window && old_window != window) {
     old_window->surface->toplevel_set_focused(old_window->surface, seat, false);
   }
 
-  wl_list_insert(&server->windows, &window->link);
+  seat->focused_window = window;
   window->surface->toplevel_set_focused(window->surface, seat, true);
 }
 
-void wm_server_switch_window(struct wm_server* server) {
-  bool has_windows = !wl_list_empty(&server->windows);
-  if (!has_windows) {
-    return;
-  }
+void wm_server_add_window(struct wm_server* server,
+  struct wm_window* window, struct wm_seat* seat) {
+  wl_list_init(&window->focus_entries);
+  wl_list_insert(&server->windows, &window->link);
+  wm_window_store_add(server->window_store, window);
+  wm_workspace_add_window(seat, window);
+  server_set_focus(seat, window);
+  wm_seat_focus_promote(seat, window);
 
-  int window_count = wl_list_length(&server->windows);
+  window->id = ++server->next_window_id;
+  window->z = ++server->next_z;
 
-  if (window_count < 2) {
-    return;
+  wm_window_damage_whole(window);
+  wm_screencopy_window_add(server->screencopy, window);
+}
+
+void wm_server_switch_window(struct wm_server* server, struct wm_seat* seat) {
+  (void)server;
+  struct wm_window *window = wm_seat_focus_step(seat);
+
+  if (window) {
+    printf("Focus switch %s\n", window->name);
   }
+}
 
-  server->pending_focus_index++;
+void wm_server_focus_window(struct wm_server* server,
+  struct wm_window* window, struct wm_seat* seat) {
+  wl_list_remove(&window->link);
+  wl_list_insert(&server->windows, &window->link);
+  wm_window_store_raise(server->window_store, window);
+  wm_workspace_raise_window(window);
+  server_set_focus(seat, window);
+  wm_seat_focus_promote(seat, window);
+  window->z = ++server->next_z;
 
-  if (server->pending_focus_index == window_count) {
-    server->pending_focus_index = 0;
+  wm_window_damage_whole(window);
+}
+
+// Focus falls back to the most recently used window still on screen
+void wm_server_refocus(struct wm_server* server, struct wm_seat* seat) {
+  struct wm_window *focused = seat->focused_window;
+  if (focused && wm_workspace_window_visible(focused)) {
+    return;
   }
 
-  int i = 0;
-  struct wm_window *window;
-  wl_list_for_each(window, &server->windows, link) {
-    if (i++ == server->pending_focus_index) {
-      printf("Focus switch %s\n", window->name);
-      break;
+  struct wm_seat_focus *focus;
+  wl_list_for_each(focus, &seat->focus_order, link) {
+    if (wm_workspace_window_visible(focus->window)) {
+      wm_server_focus_window(server, focus->window, seat);
+      return;
     }
   }
-}
-
-static void wm_server_focus_window(struct wm_server* server,
-  struct wm_window* window, struct wm_seat* seat) {
 
-  struct wm_window* old_window;
-  wl_list_for_each(old_window, &server->windows, link) {
-    window->surface->toplevel_set_focused(window->surface, seat, false);
+  if (focused) {
+    focused->surface->toplevel_set_focused(focused->surface, seat, false);
+    seat->focused_window = NULL;
   }
 
-  wl_list_remove(&window->link);
-  wl_list_insert(&server->windows, &window->link);
-  window->surface->toplevel_set_focused(window->surface, seat, true);
+  server_release_constraint(seat, NULL);
+
+  wlr_seat_keyboard_clear_focus(seat->seat);
 }
 
 void wm_server_commit_window_switch(struct wm_server* server,
   struct wm_seat* seat) {
-  int i = 0;
-  struct wm_window *window, *tmp;
-  wl_list_for_each_safe(window, tmp, &seat->server->windows, link) {
-    if (i++ == server->pending_focus_index) {
-      wm_server_focus_window(server, window, seat);
-      break;
-    }
+  struct wm_seat_focus *focus = seat->focus_switch;
+  if (focus == NULL) {
+    return;
   }
-  server->pending_focus_index = 0;
+
+  seat->focus_switch = NULL;
+  wm_server_focus_window(server, focus->window, seat);
 }
 
 void wm_server_focus_window_under_point(struct wm_server* server,
   struct wm_seat* seat, double x, double y) {
-  struct wm_window *window, *tmp;
-  wl_list_for_each_safe(window, tmp, &seat->server->windows, link) {
-    struct wlr_box geometry = wm_window_geometry(window);
-    bool under_mouse = wlr_box_contains_point(&geometry, x, y);
+  struct wm_window *windows[WM_INDEX_MAX_RESULTS];
+  int count = wm_index_query(server->index, x, y, windows, WM_INDEX_MAX_RESULTS);
+
+  for (int i = 0; i < count; i++) {
+    struct wlr_box *geometry = wm_window_store_geometry(server->window_store,
+      windows[i]);
+    bool under_mouse = geometry && wlr_box_contains_point(geometry, x, y);
     if (under_mouse) {
-      wm_server_focus_window(server, window, seat);
+      wm_server_focus_window(server, windows[i], seat);
       break;
     }
   }
 }
 
 void wm_server_remove_window(struct wm_window* window) {
+  struct wm_server* server = window->surface->server;
+  bool visible = wm_workspace_window_visible(window);
   wl_list_remove(&window->link);
+  wm_index_remove(server->index, window);
+  wm_window_store_remove(server->window_store, window);
+  wm_workspace_remove_window(window);
+
+  struct wm_seat *seat;
+  wl_list_for_each(seat, &server->seats, link) {
+    wm_seat_focus_remove(seat, window);
+
+    if (seat->focused_window == window) {
+      seat->focused_window = NULL;
+      wm_server_refocus(server, seat);
+    }
+
+    if (seat->pointer) {
+      wm_pointer_forget_window(seat->pointer, window);
+    }
+  }
+
+  if (visible) {
+    wm_server_damage_box(server, &window->extents);
+  }
+  wm_screencopy_window_remove(server->screencopy, window);
 }
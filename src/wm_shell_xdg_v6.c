@@ -52,6 +52,8 @@ static void handle_xdg_v6_commit(struct wl_listener *listener, void *data) {
   struct wlr_box geometry;
 	wlr_xdg_surface_v6_get_geometry(xdg_surface_v6, &geometry);
   wm_window_commit_pending_movement(surface->window, geometry.width, geometry.height);
+  wm_window_commit_configure(surface->window);
+  wm_window_damage_commit(surface->window);
 }
 
 static void handle_xdg_v6_maximize(struct wl_listener *listener, void *data) {
@@ -74,6 +76,13 @@ void wm_surface_xdg_v6_render(struct wm_surface* this,
     render_surface, data);
 }
 
+void wm_surface_xdg_v6_for_each_surface(struct wm_surface* this,
+  wm_surface_iterator iterator, void *data) {
+  struct wlr_xdg_surface_v6* xdg_surface_v6 =
+    wlr_xdg_surface_v6_from_wlr_surface(this->surface);
+  wlr_xdg_surface_v6_for_each_surface(xdg_surface_v6, iterator, data);
+}
+
 void wm_surface_xdg_v6_frame_done(struct wm_surface* this,
   wm_surface_frame_done_handler send_frame_done,  struct timespec* now) {
   struct wlr_xdg_popup_v6 *popup;
@@ -101,7 +110,7 @@ void wm_surface_xdg_toplevel_v6_set_maximized(struct wm_surface* this, bool maxi
   wlr_xdg_toplevel_v6_set_maximized(xdg_surface_v6, maximized);
 }
 
-void wm_surface_xdg_v6_constrained_set_size(struct wm_surface* this,
+uint32_t wm_surface_xdg_v6_constrained_set_size(struct wm_surface* this,
   int width, int height) {
   struct wlr_xdg_surface_v6* xdg_surface_v6 =
     wlr_xdg_surface_v6_from_wlr_surface(this->surface);
@@ -114,10 +123,16 @@ void wm_surface_xdg_v6_constrained_set_size(struct wm_surface* this,
   int constrained_width = width >= (int)state.min_width
     ? width : (int)state.min_width;
 
-  wlr_xdg_toplevel_v6_set_size(xdg_surface_v6,
+  return wlr_xdg_toplevel_v6_set_size(xdg_surface_v6,
     constrained_width, constrained_height);
 }
 
+uint32_t wm_surface_xdg_v6_configure_serial(struct wm_surface* this) {
+  struct wlr_xdg_surface_v6* xdg_surface_v6 =
+    wlr_xdg_surface_v6_from_wlr_surface(this->surface);
+  return xdg_surface_v6->configure_serial;
+}
+
 void wm_surface_xdg_v6_toplevel_set_focused(struct wm_surface* this,
   struct wm_seat* seat, bool focused) {
   struct wlr_xdg_surface_v6* xdg_surface_v6 =
@@ -150,10 +165,12 @@ struct wm_surface* wm_surface_xdg_v6_create(struct wlr_xdg_surface_v6* xdg_surfa
   wm_surface->server = server;
   wm_surface->surface = xdg_surface_v6->surface;
   wm_surface->render = wm_surface_xdg_v6_render;
+  wm_surface->for_each_surface = wm_surface_xdg_v6_for_each_surface;
   wm_surface->frame_done = wm_surface_xdg_v6_frame_done;
   wm_surface->toplevel_set_size = wm_surface_xdg_v6_toplevel_set_size;
   wm_surface->toplevel_set_maximized = wm_surface_xdg_toplevel_v6_set_maximized;
   wm_surface->toplevel_constrained_set_size = wm_surface_xdg_v6_constrained_set_size;
+  wm_surface->configure_serial = wm_surface_xdg_v6_configure_serial;
   wm_surface->toplevel_set_focused = wm_surface_xdg_v6_toplevel_set_focused;
   wm_surface->wlr_surface_at = wm_surface_xdg_v6_wlr_surface_at;
 
@@ -41,19 +41,6 @@ void handle_unmap(struct wl_listener *listener, void *data) {
   wl_list_remove(&wm_surface->unmap.link);
   wl_list_remove(&wm_surface->map.link);
 
-  int list_length = wl_list_length(&wm_surface->server->windows);
-
-  if (list_length > 0) {
-    struct wm_window *window = wl_list_first(&wm_surface->server->windows,
-      window, link);
-
-    struct wm_seat *seat = wm_seat_find_or_create(window->surface->server,
-      WM_DEFAULT_SEAT);
-
-    wm_server_switch_window(window->surface->server);
-    wm_server_commit_window_switch(window->surface->server, seat);
-  }
-
   wm_server_remove_window(wm_surface->window);
 
   free(wm_surface->window);
@@ -72,6 +59,7 @@ void handle_move(struct wl_listener *listener, void *data) {
     seat->pointer->window_y = surface->window->y;
     seat->pointer->window_width = surface->window->width;
     seat->pointer->window_height = surface->window->height;
+    seat->pointer->grabbed_window = surface->window;
     seat->pointer->mode = WM_POINTER_MODE_MOVE;
   }
 }
@@ -91,6 +79,7 @@ void handle_resize(struct wl_listener *listener, void *data) {
     seat->pointer->window_y = surface->window->y;
     seat->pointer->window_width = surface->window->width;
     seat->pointer->window_height = surface->window->height;
+    seat->pointer->grabbed_window = surface->window;
 
     wm_pointer_set_mode(seat->pointer, WM_POINTER_MODE_RESIZE);
     wm_pointer_set_resize_edge(seat->pointer, e->edges);
@@ -0,0 +1,231 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_timestamps.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wlr/types/wlr_seat.h>
+
+#include "input-timestamps-unstable-v1-protocol.h"
+
+#include "wm_seat.h"
+#include "wm_server.h"
+
+#define TIMESTAMPS_MANAGER_VERSION 1
+
+static const struct zwp_input_timestamps_v1_interface timestamps_impl;
+
+static void subscription_clear_input(struct wm_timestamps_subscription *sub) {
+  if (sub->input_resource == NULL) {
+    return;
+  }
+
+  sub->input_resource = NULL;
+  wl_list_remove(&sub->input_destroy.link);
+}
+
+static void subscription_handle_input_destroy(struct wl_listener *listener,
+  void *data) {
+  (void)data;
+  struct wm_timestamps_subscription *sub =
+    wl_container_of(listener, sub, input_destroy);
+  subscription_clear_input(sub);
+}
+
+static void subscription_handle_resource_destroy(struct wl_resource *resource) {
+  assert(wl_resource_instance_of(resource,
+    &zwp_input_timestamps_v1_interface, &timestamps_impl));
+  struct wm_timestamps_subscription *sub = wl_resource_get_user_data(resource);
+
+  subscription_clear_input(sub);
+  wl_list_remove(&sub->link);
+  free(sub);
+}
+
+static void timestamps_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct zwp_input_timestamps_v1_interface timestamps_impl = {
+  .destroy = timestamps_handle_destroy,
+};
+
+static void manager_subscribe(struct wl_client *wl_client,
+  struct wl_resource *manager_resource, uint32_t id,
+  struct wl_resource *input_resource, int type) {
+  struct wm_timestamps *timestamps = wl_resource_get_user_data(manager_resource);
+
+  struct wm_timestamps_subscription *sub =
+    calloc(1, sizeof(struct wm_timestamps_subscription));
+
+  sub->resource = wl_resource_create(wl_client,
+    &zwp_input_timestamps_v1_interface,
+    wl_resource_get_version(manager_resource), id);
+
+  if (sub->resource == NULL) {
+    free(sub);
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  sub->type = type;
+  sub->input_resource = input_resource;
+  sub->input_destroy.notify = subscription_handle_input_destroy;
+  wl_resource_add_destroy_listener(input_resource, &sub->input_destroy);
+
+  wl_list_insert(&timestamps->subscriptions, &sub->link);
+
+  wl_resource_set_implementation(sub->resource, &timestamps_impl, sub,
+    subscription_handle_resource_destroy);
+}
+
+static void manager_handle_get_keyboard_timestamps(struct wl_client *client,
+  struct wl_resource *resource, uint32_t id, struct wl_resource *keyboard) {
+  manager_subscribe(client, resource, id, keyboard, WM_TIMESTAMPS_KEYBOARD);
+}
+
+static void manager_handle_get_pointer_timestamps(struct wl_client *client,
+  struct wl_resource *resource, uint32_t id, struct wl_resource *pointer) {
+  manager_subscribe(client, resource, id, pointer, WM_TIMESTAMPS_POINTER);
+}
+
+static void manager_handle_get_touch_timestamps(struct wl_client *client,
+  struct wl_resource *resource, uint32_t id, struct wl_resource *touch) {
+  // There is no touch input yet, the subscription just never fires
+  manager_subscribe(client, resource, id, touch, WM_TIMESTAMPS_TOUCH);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct zwp_input_timestamps_manager_v1_interface manager_impl = {
+  .destroy = manager_handle_destroy,
+  .get_keyboard_timestamps = manager_handle_get_keyboard_timestamps,
+  .get_pointer_timestamps = manager_handle_get_pointer_timestamps,
+  .get_touch_timestamps = manager_handle_get_touch_timestamps,
+};
+
+static void manager_bind(struct wl_client *wl_client, void *data,
+  uint32_t version, uint32_t id) {
+  struct wm_timestamps *timestamps = data;
+
+  struct wl_resource *resource = wl_resource_create(wl_client,
+    &zwp_input_timestamps_manager_v1_interface, version, id);
+
+  if (resource == NULL) {
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wl_resource_set_implementation(resource, &manager_impl, timestamps, NULL);
+}
+
+// Backends only hand over milliseconds, the upper bits come from the clock
+static void timestamp_from_msec(uint32_t time_msec, struct timespec *ts) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  uint64_t now_msec = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+  uint64_t msec = now_msec - (uint32_t)((uint32_t)now_msec - time_msec);
+
+  ts->tv_sec = msec / 1000;
+  ts->tv_nsec = (msec % 1000) * 1000000;
+}
+
+static bool resource_in_list(struct wl_resource *resource, struct wl_list *list) {
+  struct wl_resource *entry;
+  wl_resource_for_each(entry, list) {
+    if (entry == resource) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void timestamps_send(struct wm_timestamps *timestamps, int type,
+  struct wl_list *resources, uint32_t time_msec) {
+  struct timespec ts;
+  bool converted = false;
+
+  struct wm_timestamps_subscription *sub;
+  wl_list_for_each(sub, &timestamps->subscriptions, link) {
+    if (sub->type != type || sub->input_resource == NULL ||
+        !resource_in_list(sub->input_resource, resources)) {
+      continue;
+    }
+
+    if (!converted) {
+      timestamp_from_msec(time_msec, &ts);
+      converted = true;
+    }
+
+    uint64_t sec = ts.tv_sec;
+    zwp_input_timestamps_v1_send_timestamp(sub->resource,
+      sec >> 32, sec & 0xffffffff, ts.tv_nsec);
+  }
+}
+
+void wm_timestamps_keyboard(struct wm_timestamps* timestamps,
+  struct wm_seat* seat, uint32_t time_msec) {
+  if (timestamps == NULL || wl_list_empty(&timestamps->subscriptions)) {
+    return;
+  }
+
+  struct wlr_seat_client *client = seat->seat->keyboard_state.focused_client;
+  if (client == NULL) {
+    return;
+  }
+
+  timestamps_send(timestamps, WM_TIMESTAMPS_KEYBOARD,
+    &client->keyboards, time_msec);
+}
+
+void wm_timestamps_pointer(struct wm_timestamps* timestamps,
+  struct wm_seat* seat, uint32_t time_msec) {
+  if (timestamps == NULL || wl_list_empty(&timestamps->subscriptions)) {
+    return;
+  }
+
+  struct wlr_seat_client *client = seat->seat->pointer_state.focused_client;
+  if (client == NULL) {
+    return;
+  }
+
+  timestamps_send(timestamps, WM_TIMESTAMPS_POINTER,
+    &client->pointers, time_msec);
+}
+
+struct wm_timestamps* wm_timestamps_create(struct wm_server* server) {
+  struct wm_timestamps *timestamps = calloc(1, sizeof(struct wm_timestamps));
+  timestamps->server = server;
+
+  wl_list_init(&timestamps->subscriptions);
+
+  timestamps->global = wl_global_create(server->wl_display,
+    &zwp_input_timestamps_manager_v1_interface, TIMESTAMPS_MANAGER_VERSION,
+    timestamps, manager_bind);
+
+  return timestamps;
+}
+
+void wm_timestamps_destroy(struct wm_timestamps* timestamps) {
+  if (timestamps == NULL) {
+    return;
+  }
+
+  struct wm_timestamps_subscription *sub, *tmp;
+  wl_list_for_each_safe(sub, tmp, &timestamps->subscriptions, link) {
+    subscription_clear_input(sub);
+    wl_list_remove(&sub->link);
+    wl_list_init(&sub->link);
+  }
+
+  wl_global_destroy(timestamps->global);
+  free(timestamps);
+}
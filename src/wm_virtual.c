@@ -0,0 +1,482 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_virtual.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wlr/interfaces/wlr_input_device.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_pointer.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/log.h>
+
+#include "virtual-keyboard-unstable-v1-protocol.h"
+#include "wlr-virtual-pointer-unstable-v1-protocol.h"
+
+#include "wm_keyboard.h"
+#include "wm_keymap.h"
+#include "wm_seat.h"
+#include "wm_server.h"
+
+#define VIRTUAL_KEYBOARD_MANAGER_VERSION 1
+#define VIRTUAL_POINTER_MANAGER_VERSION 1
+
+static const struct zwp_virtual_keyboard_v1_interface keyboard_impl;
+static const struct zwlr_virtual_pointer_v1_interface pointer_impl;
+
+// The devices are embedded in their wm_virtual_* and freed with it
+static void virtual_device_destroy(struct wlr_input_device *device) {
+  (void)device;
+}
+
+static struct wlr_input_device_impl virtual_device_impl = {
+  .destroy = virtual_device_destroy
+};
+
+static void virtual_keyboard_destroy(struct wlr_keyboard *keyboard) {
+  (void)keyboard;
+}
+
+static struct wlr_keyboard_impl virtual_keyboard_impl = {
+  .destroy = virtual_keyboard_destroy
+};
+
+static void virtual_pointer_destroy(struct wlr_pointer *pointer) {
+  (void)pointer;
+}
+
+static struct wlr_pointer_impl virtual_pointer_impl = {
+  .destroy = virtual_pointer_destroy
+};
+
+static struct wm_seat* seat_from_resource(struct wm_server *server,
+  struct wl_resource *seat_resource) {
+  if (seat_resource != NULL) {
+    struct wlr_seat_client *client = wlr_seat_client_from_resource(seat_resource);
+
+    struct wm_seat *seat;
+    wl_list_for_each(seat, &server->seats, link) {
+      if (seat->seat == client->seat) {
+        return seat;
+      }
+    }
+  }
+
+  return wm_seat_find_or_create(server, WM_DEFAULT_SEAT);
+}
+
+static struct wm_virtual_keyboard* keyboard_from_resource(
+  struct wl_resource *resource) {
+  assert(wl_resource_instance_of(resource,
+    &zwp_virtual_keyboard_v1_interface, &keyboard_impl));
+  return wl_resource_get_user_data(resource);
+}
+
+// The seat's wrapper for the device, NULL if it never attached
+static struct wm_keyboard* keyboard_seat_keyboard(
+  struct wm_virtual_keyboard *keyboard) {
+  struct wm_keyboard *seat_keyboard;
+  wl_list_for_each(seat_keyboard, &keyboard->seat->keyboards, link) {
+    if (seat_keyboard->device == &keyboard->device) {
+      return seat_keyboard;
+    }
+  }
+  return NULL;
+}
+
+static void keyboard_handle_keymap(struct wl_client *client,
+  struct wl_resource *resource, uint32_t format, int32_t fd, uint32_t size) {
+  (void)client;
+  struct wm_virtual_keyboard *keyboard = keyboard_from_resource(resource);
+
+  void *data = MAP_FAILED;
+  if (format == WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1 && size > 0) {
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    wlr_log(L_ERROR, "Virtual keyboard sent an unusable keymap");
+    return;
+  }
+
+  char *string = strndup(data, size);
+  munmap(data, size);
+  keyboard->has_keymap = true;
+
+  // Compiled on the keymap thread, keys wait in the seat keyboard until then
+  struct wm_keymaps *keymaps = keyboard->seat->server->keymaps;
+  struct wm_keymap *keymap = wm_keymaps_get_string(keymaps, string);
+  free(string);
+
+  struct wm_keyboard *seat_keyboard = keyboard_seat_keyboard(keyboard);
+  if (seat_keyboard) {
+    wm_keyboard_use_keymap(seat_keyboard, keymap);
+  }
+}
+
+static void keyboard_handle_key(struct wl_client *client,
+  struct wl_resource *resource, uint32_t time, uint32_t key, uint32_t state) {
+  (void)client;
+  struct wm_virtual_keyboard *keyboard = keyboard_from_resource(resource);
+
+  if (!keyboard->has_keymap) {
+    wl_resource_post_error(resource, ZWP_VIRTUAL_KEYBOARD_V1_ERROR_NO_KEYMAP,
+      "Cannot send a key before a keymap");
+    return;
+  }
+
+  struct wm_keyboard *seat_keyboard = keyboard_seat_keyboard(keyboard);
+  if (seat_keyboard == NULL) {
+    return;
+  }
+
+  struct wlr_event_keyboard_key event = {
+    .time_msec = time,
+    .keycode = key,
+    .update_state = true,
+    .state = state
+  };
+  wm_keyboard_notify_key(seat_keyboard, &event);
+}
+
+static void keyboard_handle_modifiers(struct wl_client *client,
+  struct wl_resource *resource, uint32_t mods_depressed, uint32_t mods_latched,
+  uint32_t mods_locked, uint32_t group) {
+  (void)client;
+  struct wm_virtual_keyboard *keyboard = keyboard_from_resource(resource);
+
+  if (!keyboard->has_keymap) {
+    wl_resource_post_error(resource, ZWP_VIRTUAL_KEYBOARD_V1_ERROR_NO_KEYMAP,
+      "Cannot send modifiers before a keymap");
+    return;
+  }
+
+  struct wm_keyboard *seat_keyboard = keyboard_seat_keyboard(keyboard);
+  if (seat_keyboard == NULL) {
+    return;
+  }
+
+  struct wlr_keyboard_modifiers modifiers = {
+    .depressed = mods_depressed,
+    .latched = mods_latched,
+    .locked = mods_locked,
+    .group = group
+  };
+  wm_keyboard_notify_modifiers(seat_keyboard, &modifiers);
+}
+
+static void keyboard_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct zwp_virtual_keyboard_v1_interface keyboard_impl = {
+  .keymap = keyboard_handle_keymap,
+  .key = keyboard_handle_key,
+  .modifiers = keyboard_handle_modifiers,
+  .destroy = keyboard_handle_destroy,
+};
+
+static void keyboard_handle_resource_destroy(struct wl_resource *resource) {
+  struct wm_virtual_keyboard *keyboard = keyboard_from_resource(resource);
+
+  wlr_input_device_destroy(&keyboard->device);
+  free(keyboard);
+}
+
+static void keyboard_manager_handle_create(struct wl_client *wl_client,
+  struct wl_resource *manager_resource, struct wl_resource *seat_resource,
+  uint32_t id) {
+  struct wm_virtual *virtual = wl_resource_get_user_data(manager_resource);
+
+  struct wm_virtual_keyboard *keyboard =
+    calloc(1, sizeof(struct wm_virtual_keyboard));
+
+  keyboard->resource = wl_resource_create(wl_client,
+    &zwp_virtual_keyboard_v1_interface,
+    wl_resource_get_version(manager_resource), id);
+
+  if (keyboard->resource == NULL) {
+    free(keyboard);
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wlr_input_device_init(&keyboard->device, WLR_INPUT_DEVICE_KEYBOARD,
+    &virtual_device_impl, "virtual keyboard", 0, 0);
+  wlr_keyboard_init(&keyboard->keyboard, &virtual_keyboard_impl);
+  keyboard->device.keyboard = &keyboard->keyboard;
+
+  wl_resource_set_implementation(keyboard->resource, &keyboard_impl, keyboard,
+    keyboard_handle_resource_destroy);
+
+  keyboard->seat = seat_from_resource(virtual->server, seat_resource);
+  wm_server_connect_seat_input(virtual->server, keyboard->seat,
+    &keyboard->device);
+}
+
+static const struct zwp_virtual_keyboard_manager_v1_interface
+  keyboard_manager_impl = {
+  .create_virtual_keyboard = keyboard_manager_handle_create,
+};
+
+static void keyboard_manager_bind(struct wl_client *wl_client, void *data,
+  uint32_t version, uint32_t id) {
+  struct wm_virtual *virtual = data;
+
+  struct wl_resource *resource = wl_resource_create(wl_client,
+    &zwp_virtual_keyboard_manager_v1_interface, version, id);
+
+  if (resource == NULL) {
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wl_resource_set_implementation(resource, &keyboard_manager_impl,
+    virtual, NULL);
+}
+
+static struct wm_virtual_pointer* pointer_from_resource(
+  struct wl_resource *resource) {
+  assert(wl_resource_instance_of(resource,
+    &zwlr_virtual_pointer_v1_interface, &pointer_impl));
+  return wl_resource_get_user_data(resource);
+}
+
+static bool pointer_check_axis(struct wl_resource *resource, uint32_t axis) {
+  if (axis > WL_POINTER_AXIS_HORIZONTAL_SCROLL) {
+    wl_resource_post_error(resource, ZWLR_VIRTUAL_POINTER_V1_ERROR_INVALID_AXIS,
+      "Invalid enumeration value for axis");
+    return false;
+  }
+  return true;
+}
+
+static void pointer_handle_motion(struct wl_client *client,
+  struct wl_resource *resource, uint32_t time, wl_fixed_t dx, wl_fixed_t dy) {
+  (void)client;
+  struct wm_virtual_pointer *pointer = pointer_from_resource(resource);
+
+  struct wlr_event_pointer_motion event = {
+    .device = &pointer->device,
+    .time_msec = time,
+    .delta_x = wl_fixed_to_double(dx),
+    .delta_y = wl_fixed_to_double(dy)
+  };
+  wl_signal_emit(&pointer->pointer.events.motion, &event);
+}
+
+static void pointer_handle_motion_absolute(struct wl_client *client,
+  struct wl_resource *resource, uint32_t time, uint32_t x, uint32_t y,
+  uint32_t x_extent, uint32_t y_extent) {
+  (void)client;
+  struct wm_virtual_pointer *pointer = pointer_from_resource(resource);
+
+  if (x_extent == 0 || y_extent == 0) {
+    return;
+  }
+
+  struct wlr_event_pointer_motion_absolute event = {
+    .device = &pointer->device,
+    .time_msec = time,
+    .x = (double)x / x_extent,
+    .y = (double)y / y_extent
+  };
+  wl_signal_emit(&pointer->pointer.events.motion_absolute, &event);
+}
+
+static void pointer_handle_button(struct wl_client *client,
+  struct wl_resource *resource, uint32_t time, uint32_t button,
+  uint32_t state) {
+  (void)client;
+  struct wm_virtual_pointer *pointer = pointer_from_resource(resource);
+
+  struct wlr_event_pointer_button event = {
+    .device = &pointer->device,
+    .time_msec = time,
+    .button = button,
+    .state = state == WL_POINTER_BUTTON_STATE_PRESSED ?
+      WLR_BUTTON_PRESSED : WLR_BUTTON_RELEASED
+  };
+  wl_signal_emit(&pointer->pointer.events.button, &event);
+}
+
+static void pointer_emit_axis(struct wm_virtual_pointer *pointer,
+  uint32_t time, uint32_t axis, wl_fixed_t value) {
+  struct wlr_event_pointer_axis event = {
+    .device = &pointer->device,
+    .time_msec = time,
+    .source = pointer->axis_source,
+    .orientation = axis,
+    .delta = wl_fixed_to_double(value)
+  };
+  wl_signal_emit(&pointer->pointer.events.axis, &event);
+}
+
+static void pointer_handle_axis(struct wl_client *client,
+  struct wl_resource *resource, uint32_t time, uint32_t axis,
+  wl_fixed_t value) {
+  (void)client;
+  struct wm_virtual_pointer *pointer = pointer_from_resource(resource);
+
+  if (pointer_check_axis(resource, axis)) {
+    pointer_emit_axis(pointer, time, axis, value);
+  }
+}
+
+static void pointer_handle_frame(struct wl_client *client,
+  struct wl_resource *resource) {
+  // Every request is delivered as it arrives, there is nothing to group
+  (void)client;
+  (void)resource;
+}
+
+static void pointer_handle_axis_source(struct wl_client *client,
+  struct wl_resource *resource, uint32_t axis_source) {
+  (void)client;
+  struct wm_virtual_pointer *pointer = pointer_from_resource(resource);
+
+  if (axis_source > WL_POINTER_AXIS_SOURCE_WHEEL_TILT) {
+    wl_resource_post_error(resource,
+      ZWLR_VIRTUAL_POINTER_V1_ERROR_INVALID_AXIS_SOURCE,
+      "Invalid enumeration value for axis source");
+    return;
+  }
+
+  pointer->axis_source = axis_source;
+}
+
+static void pointer_handle_axis_stop(struct wl_client *client,
+  struct wl_resource *resource, uint32_t time, uint32_t axis) {
+  (void)client;
+  struct wm_virtual_pointer *pointer = pointer_from_resource(resource);
+
+  if (pointer_check_axis(resource, axis)) {
+    pointer_emit_axis(pointer, time, axis, 0);
+  }
+}
+
+static void pointer_handle_axis_discrete(struct wl_client *client,
+  struct wl_resource *resource, uint32_t time, uint32_t axis,
+  wl_fixed_t value, int32_t discrete) {
+  (void)client;
+  (void)discrete;
+  struct wm_virtual_pointer *pointer = pointer_from_resource(resource);
+
+  if (pointer_check_axis(resource, axis)) {
+    pointer_emit_axis(pointer, time, axis, value);
+  }
+}
+
+static void pointer_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct zwlr_virtual_pointer_v1_interface pointer_impl = {
+  .motion = pointer_handle_motion,
+  .motion_absolute = pointer_handle_motion_absolute,
+  .button = pointer_handle_button,
+  .axis = pointer_handle_axis,
+  .frame = pointer_handle_frame,
+  .axis_source = pointer_handle_axis_source,
+  .axis_stop = pointer_handle_axis_stop,
+  .axis_discrete = pointer_handle_axis_discrete,
+  .destroy = pointer_handle_destroy,
+};
+
+static void pointer_handle_resource_destroy(struct wl_resource *resource) {
+  struct wm_virtual_pointer *pointer = pointer_from_resource(resource);
+
+  wlr_input_device_destroy(&pointer->device);
+  free(pointer);
+}
+
+static void pointer_manager_handle_create(struct wl_client *wl_client,
+  struct wl_resource *manager_resource, struct wl_resource *seat_resource,
+  uint32_t id) {
+  struct wm_virtual *virtual = wl_resource_get_user_data(manager_resource);
+
+  struct wm_virtual_pointer *pointer =
+    calloc(1, sizeof(struct wm_virtual_pointer));
+
+  pointer->resource = wl_resource_create(wl_client,
+    &zwlr_virtual_pointer_v1_interface,
+    wl_resource_get_version(manager_resource), id);
+
+  if (pointer->resource == NULL) {
+    free(pointer);
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wlr_input_device_init(&pointer->device, WLR_INPUT_DEVICE_POINTER,
+    &virtual_device_impl, "virtual pointer", 0, 0);
+  wlr_pointer_init(&pointer->pointer, &virtual_pointer_impl);
+  pointer->device.pointer = &pointer->pointer;
+
+  wl_resource_set_implementation(pointer->resource, &pointer_impl, pointer,
+    pointer_handle_resource_destroy);
+
+  struct wm_seat *seat = seat_from_resource(virtual->server, seat_resource);
+  wm_server_connect_seat_input(virtual->server, seat, &pointer->device);
+}
+
+static void pointer_manager_handle_destroy(struct wl_client *client,
+  struct wl_resource *resource) {
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct zwlr_virtual_pointer_manager_v1_interface
+  pointer_manager_impl = {
+  .create_virtual_pointer = pointer_manager_handle_create,
+  .destroy = pointer_manager_handle_destroy,
+};
+
+static void pointer_manager_bind(struct wl_client *wl_client, void *data,
+  uint32_t version, uint32_t id) {
+  struct wm_virtual *virtual = data;
+
+  struct wl_resource *resource = wl_resource_create(wl_client,
+    &zwlr_virtual_pointer_manager_v1_interface, version, id);
+
+  if (resource == NULL) {
+    wl_client_post_no_memory(wl_client);
+    return;
+  }
+
+  wl_resource_set_implementation(resource, &pointer_manager_impl,
+    virtual, NULL);
+}
+
+struct wm_virtual* wm_virtual_create(struct wm_server* server) {
+  struct wm_virtual *virtual = calloc(1, sizeof(struct wm_virtual));
+  virtual->server = server;
+
+  virtual->keyboard_global = wl_global_create(server->wl_display,
+    &zwp_virtual_keyboard_manager_v1_interface,
+    VIRTUAL_KEYBOARD_MANAGER_VERSION, virtual, keyboard_manager_bind);
+
+  virtual->pointer_global = wl_global_create(server->wl_display,
+    &zwlr_virtual_pointer_manager_v1_interface,
+    VIRTUAL_POINTER_MANAGER_VERSION, virtual, pointer_manager_bind);
+
+  return virtual;
+}
+
+void wm_virtual_destroy(struct wm_virtual* virtual) {
+  if (virtual == NULL) {
+    return;
+  }
+
+  wl_global_destroy(virtual->keyboard_global);
+  wl_global_destroy(virtual->pointer_global);
+  free(virtual);
+}
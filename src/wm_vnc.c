@@ -0,0 +1,1172 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wm_vnc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input-event-codes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <xkbcommon/xkbcommon.h>
+#include <wlr/backend.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/log.h>
+
+#include "wm_output.h"
+#include "wm_pointer.h"
+#include "wm_seat.h"
+#include "wm_server.h"
+
+#define VNC_SERVER_NAME "boxy"
+#define VNC_PROTOCOL_VERSION "RFB 003.008\n"
+#define VNC_PROTOCOL_VERSION_LENGTH 12
+
+#define VNC_SECURITY_NONE 1
+
+#define VNC_ENCODING_RAW 0
+#define VNC_ENCODING_ZLIB 6
+
+#define VNC_MAX_RECTS 256
+#define VNC_WHEEL_DELTA 15
+
+static const struct wm_vnc_pixel_format native_format = {
+  .bits_per_pixel = 32,
+  .depth = 24,
+  .big_endian = 0,
+  .true_colour = 1,
+  .red_max = 255,
+  .green_max = 255,
+  .blue_max = 255,
+  .red_shift = 16,
+  .green_shift = 8,
+  .blue_shift = 0,
+};
+
+struct vnc_rect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+static uint32_t vnc_now_msec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint16_t get_u16(const uint8_t *data) {
+  return (data[0] << 8) | data[1];
+}
+
+static uint32_t get_u32(const uint8_t *data) {
+  return ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static void vnc_buffer_reserve(struct wm_vnc_buffer *buffer, size_t size) {
+  if (buffer->length + size <= buffer->capacity) {
+    return;
+  }
+
+  size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+  while (capacity < buffer->length + size) {
+    capacity *= 2;
+  }
+
+  buffer->data = realloc(buffer->data, capacity);
+  buffer->capacity = capacity;
+}
+
+static void vnc_buffer_put_u8(struct wm_vnc_buffer *buffer, uint8_t value) {
+  vnc_buffer_reserve(buffer, 1);
+  buffer->data[buffer->length++] = value;
+}
+
+static void vnc_buffer_put_u16(struct wm_vnc_buffer *buffer, uint16_t value) {
+  vnc_buffer_put_u8(buffer, value >> 8);
+  vnc_buffer_put_u8(buffer, value & 0xFF);
+}
+
+static void vnc_buffer_put_u32(struct wm_vnc_buffer *buffer, uint32_t value) {
+  vnc_buffer_put_u16(buffer, value >> 16);
+  vnc_buffer_put_u16(buffer, value & 0xFFFF);
+}
+
+static void vnc_buffer_put_bytes(struct wm_vnc_buffer *buffer,
+  const void *data, size_t length) {
+  vnc_buffer_reserve(buffer, length);
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
+
+static bool vnc_format_is_native(const struct wm_vnc_pixel_format *format) {
+  return format->bits_per_pixel == native_format.bits_per_pixel &&
+    format->big_endian == native_format.big_endian &&
+    format->red_max == native_format.red_max &&
+    format->green_max == native_format.green_max &&
+    format->blue_max == native_format.blue_max &&
+    format->red_shift == native_format.red_shift &&
+    format->green_shift == native_format.green_shift &&
+    format->blue_shift == native_format.blue_shift;
+}
+
+static void vnc_buffer_put_pixels(struct wm_vnc_buffer *buffer,
+  const struct wm_vnc_pixel_format *format, const uint32_t *pixels,
+  size_t count) {
+  vnc_buffer_reserve(buffer, count * 4);
+  uint8_t *out = buffer->data + buffer->length;
+
+  if (vnc_format_is_native(format)) {
+    memcpy(out, pixels, count * 4);
+    buffer->length += count * 4;
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    uint32_t r = (pixels[i] >> 16) & 0xFF;
+    uint32_t g = (pixels[i] >> 8) & 0xFF;
+    uint32_t b = pixels[i] & 0xFF;
+
+    uint32_t value =
+      ((r * format->red_max / 255) << format->red_shift) |
+      ((g * format->green_max / 255) << format->green_shift) |
+      ((b * format->blue_max / 255) << format->blue_shift);
+
+    if (format->big_endian) {
+      out[0] = value >> 24;
+      out[1] = value >> 16;
+      out[2] = value >> 8;
+      out[3] = value;
+    } else {
+      out[0] = value;
+      out[1] = value >> 8;
+      out[2] = value >> 16;
+      out[3] = value >> 24;
+    }
+
+    out += 4;
+  }
+
+  buffer->length += count * 4;
+}
+
+static bool vnc_buffer_put_zlib(struct wm_vnc_buffer *buffer, z_stream *zstream,
+  const uint8_t *data, size_t length) {
+  size_t header = buffer->length;
+  vnc_buffer_put_u32(buffer, 0);
+
+  zstream->next_in = (Bytef *)data;
+  zstream->avail_in = length;
+
+  do {
+    vnc_buffer_reserve(buffer, deflateBound(zstream, zstream->avail_in) + 64);
+
+    size_t available = buffer->capacity - buffer->length;
+    zstream->next_out = buffer->data + buffer->length;
+    zstream->avail_out = available;
+
+    int ret = deflate(zstream, Z_SYNC_FLUSH);
+    buffer->length += available - zstream->avail_out;
+
+    if (ret == Z_BUF_ERROR) {
+      break;
+    }
+
+    if (ret != Z_OK) {
+      return false;
+    }
+  } while (zstream->avail_in > 0 || zstream->avail_out == 0);
+
+  uint32_t compressed = buffer->length - header - 4;
+  buffer->data[header] = compressed >> 24;
+  buffer->data[header + 1] = compressed >> 16;
+  buffer->data[header + 2] = compressed >> 8;
+  buffer->data[header + 3] = compressed;
+
+  return true;
+}
+
+static bool vnc_encode_update(struct wm_vnc_buffer *out, struct wm_vnc_buffer *raw,
+  z_stream *zstream, const struct wm_vnc_pixel_format *format, bool zlib,
+  const struct vnc_rect *rects, int nrects, const uint32_t *pixels) {
+  vnc_buffer_put_u8(out, 0);
+  vnc_buffer_put_u8(out, 0);
+  vnc_buffer_put_u16(out, nrects);
+
+  for (int i = 0; i < nrects; i++) {
+    const struct vnc_rect *rect = &rects[i];
+    size_t count = rect->width * rect->height;
+
+    vnc_buffer_put_u16(out, rect->x);
+    vnc_buffer_put_u16(out, rect->y);
+    vnc_buffer_put_u16(out, rect->width);
+    vnc_buffer_put_u16(out, rect->height);
+    vnc_buffer_put_u32(out, zlib ? VNC_ENCODING_ZLIB : VNC_ENCODING_RAW);
+
+    if (zlib) {
+      raw->length = 0;
+      vnc_buffer_put_pixels(raw, format, pixels, count);
+      if (!vnc_buffer_put_zlib(out, zstream, raw->data, raw->length)) {
+        return false;
+      }
+    } else {
+      vnc_buffer_put_pixels(out, format, pixels, count);
+    }
+
+    pixels += count;
+  }
+
+  return true;
+}
+
+static int vnc_collect_rects(struct wm_vnc *vnc, struct wm_vnc_client *client,
+  struct vnc_rect *rects, uint32_t **pixels, size_t *pixels_size) {
+  int width = client->width < vnc->width ? client->width : vnc->width;
+  int height = client->height < vnc->height ? client->height : vnc->height;
+
+  pixman_region32_t region;
+  pixman_region32_init(&region);
+  pixman_region32_intersect_rect(&region, &client->damage, 0, 0, width, height);
+  pixman_region32_clear(&client->damage);
+
+  int nboxes;
+  pixman_box32_t *boxes = pixman_region32_rectangles(&region, &nboxes);
+
+  if (nboxes > VNC_MAX_RECTS) {
+    boxes = pixman_region32_extents(&region);
+    nboxes = 1;
+  }
+
+  size_t total = 0;
+  for (int i = 0; i < nboxes; i++) {
+    rects[i].x = boxes[i].x1;
+    rects[i].y = boxes[i].y1;
+    rects[i].width = boxes[i].x2 - boxes[i].x1;
+    rects[i].height = boxes[i].y2 - boxes[i].y1;
+    total += rects[i].width * rects[i].height;
+  }
+
+  if (total > *pixels_size) {
+    *pixels = realloc(*pixels, total * sizeof(uint32_t));
+    *pixels_size = total;
+  }
+
+  uint32_t *out = *pixels;
+  for (int i = 0; i < nboxes; i++) {
+    for (int y = rects[i].y; y < rects[i].y + rects[i].height; y++) {
+      memcpy(out, vnc->framebuffer + y * vnc->width + rects[i].x,
+        rects[i].width * sizeof(uint32_t));
+      out += rects[i].width;
+    }
+  }
+
+  pixman_region32_fini(&region);
+  return nboxes;
+}
+
+static struct wm_vnc_client* vnc_next_client(struct wm_vnc *vnc) {
+  struct wm_vnc_client *client;
+  wl_list_for_each(client, &vnc->clients, link) {
+    bool ready = client->state == WM_VNC_CLIENT_NORMAL &&
+      !client->closed && client->update_requested &&
+      client->output.length == 0 &&
+      pixman_region32_not_empty(&client->damage);
+
+    if (ready) {
+      return client;
+    }
+  }
+  return NULL;
+}
+
+static void* vnc_encoder_thread(void *data) {
+  struct wm_vnc *vnc = data;
+
+  struct wm_vnc_buffer out = { 0 };
+  struct wm_vnc_buffer raw = { 0 };
+  struct vnc_rect rects[VNC_MAX_RECTS];
+  uint32_t *pixels = NULL;
+  size_t pixels_size = 0;
+
+  pthread_mutex_lock(&vnc->lock);
+
+  while (vnc->running) {
+    struct wm_vnc_client *client = vnc_next_client(vnc);
+
+    if (client == NULL) {
+      pthread_cond_wait(&vnc->cond, &vnc->lock);
+      continue;
+    }
+
+    client->busy = true;
+    client->update_requested = false;
+
+    int nrects = vnc_collect_rects(vnc, client, rects, &pixels, &pixels_size);
+    struct wm_vnc_pixel_format format = client->format;
+    bool zlib = client->zlib;
+
+    pthread_mutex_unlock(&vnc->lock);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    out.length = 0;
+    bool ok = vnc_encode_update(&out, &raw, &client->zstream, &format, zlib,
+      rects, nrects, pixels);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long encode_usec = (end.tv_sec - start.tv_sec) * 1000000 +
+      (end.tv_nsec - start.tv_nsec) / 1000;
+
+    if (vnc->stats) {
+      wlr_log(L_INFO, "VNC update: %d rects, %zu bytes, encoded in %ld us",
+        nrects, out.length, encode_usec);
+    }
+
+    pthread_mutex_lock(&vnc->lock);
+
+    client->busy = false;
+    if (!ok) {
+      client->closed = true;
+    } else if (!client->closed) {
+      vnc_buffer_put_bytes(&client->output, out.data, out.length);
+    }
+
+    // The main loop owns the socket, it sends and reaps closed clients
+    uint64_t one = 1;
+    if (write(vnc->ready_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+      wlr_log(L_ERROR, "Failed to wake the main loop for VNC");
+    }
+
+    pthread_cond_broadcast(&vnc->cond);
+  }
+
+  pthread_mutex_unlock(&vnc->lock);
+
+  free(out.data);
+  free(raw.data);
+  free(pixels);
+
+  return NULL;
+}
+
+static void vnc_client_destroy(struct wm_vnc_client *client) {
+  struct wm_vnc *vnc = client->vnc;
+
+  wl_event_source_remove(client->source);
+  shutdown(client->fd, SHUT_RDWR);
+
+  // The encoder never touches the socket, busy only covers encoding
+  pthread_mutex_lock(&vnc->lock);
+  client->closed = true;
+  while (client->busy) {
+    pthread_cond_wait(&vnc->cond, &vnc->lock);
+  }
+  wl_list_remove(&client->link);
+  pthread_mutex_unlock(&vnc->lock);
+
+  if (client->state == WM_VNC_CLIENT_NORMAL) {
+    deflateEnd(&client->zstream);
+  }
+
+  printf("VNC client disconnected\n");
+
+  pixman_region32_fini(&client->damage);
+  free(client->output.data);
+  close(client->fd);
+  free(client);
+}
+
+// Sends what the socket takes now and waits for it to drain otherwise
+static void vnc_client_flush(struct wm_vnc_client *client) {
+  struct wm_vnc *vnc = client->vnc;
+
+  pthread_mutex_lock(&vnc->lock);
+
+  struct wm_vnc_buffer *output = &client->output;
+  size_t sent = 0;
+
+  while (sent < output->length && !client->closed) {
+    ssize_t written = send(client->fd, output->data + sent,
+      output->length - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        client->closed = true;
+      }
+      break;
+    }
+
+    sent += written;
+  }
+
+  memmove(output->data, output->data + sent, output->length - sent);
+  output->length -= sent;
+
+  bool pending = output->length > 0 && !client->closed;
+
+  if (!pending) {
+    pthread_cond_broadcast(&vnc->cond);
+  }
+
+  pthread_mutex_unlock(&vnc->lock);
+
+  wl_event_source_fd_update(client->source,
+    WL_EVENT_READABLE | (pending ? WL_EVENT_WRITABLE : 0));
+}
+
+static void vnc_client_send(struct wm_vnc_client *client, const void *data,
+  size_t length) {
+  pthread_mutex_lock(&client->vnc->lock);
+  vnc_buffer_put_bytes(&client->output, data, length);
+  pthread_mutex_unlock(&client->vnc->lock);
+
+  vnc_client_flush(client);
+}
+
+static bool vnc_client_closed(struct wm_vnc_client *client) {
+  pthread_mutex_lock(&client->vnc->lock);
+  bool closed = client->closed;
+  pthread_mutex_unlock(&client->vnc->lock);
+  return closed;
+}
+
+// BOXY_VNC_OUTPUT names the output to serve, otherwise it is the one at the
+// layout origin, where the first output is placed
+static struct wm_output* vnc_output(struct wm_vnc *vnc) {
+  if (vnc->output) {
+    return vnc->output;
+  }
+
+  struct wm_server *server = vnc->server;
+  struct wlr_output *origin = wlr_output_layout_output_at(server->layout, 0, 0);
+
+  struct wm_output *output;
+  wl_list_for_each(output, &server->outputs, link) {
+    struct wlr_output *wlr_output = output->wlr_output;
+    bool match = vnc->output_name ?
+      strcmp(wlr_output->name, vnc->output_name) == 0 : wlr_output == origin;
+
+    if (match) {
+      vnc->output = output;
+      break;
+    }
+  }
+
+  return vnc->output;
+}
+
+static void vnc_send_server_init(struct wm_vnc_client *client) {
+  struct wm_output *output = vnc_output(client->vnc);
+
+  client->width = output ? output->wlr_output->width : 0;
+  client->height = output ? output->wlr_output->height : 0;
+
+  struct wm_vnc_buffer buffer = { 0 };
+  vnc_buffer_put_u16(&buffer, client->width);
+  vnc_buffer_put_u16(&buffer, client->height);
+
+  vnc_buffer_put_u8(&buffer, native_format.bits_per_pixel);
+  vnc_buffer_put_u8(&buffer, native_format.depth);
+  vnc_buffer_put_u8(&buffer, native_format.big_endian);
+  vnc_buffer_put_u8(&buffer, native_format.true_colour);
+  vnc_buffer_put_u16(&buffer, native_format.red_max);
+  vnc_buffer_put_u16(&buffer, native_format.green_max);
+  vnc_buffer_put_u16(&buffer, native_format.blue_max);
+  vnc_buffer_put_u8(&buffer, native_format.red_shift);
+  vnc_buffer_put_u8(&buffer, native_format.green_shift);
+  vnc_buffer_put_u8(&buffer, native_format.blue_shift);
+  vnc_buffer_put_u8(&buffer, 0);
+  vnc_buffer_put_u8(&buffer, 0);
+  vnc_buffer_put_u8(&buffer, 0);
+
+  vnc_buffer_put_u32(&buffer, strlen(VNC_SERVER_NAME));
+  vnc_buffer_reserve(&buffer, strlen(VNC_SERVER_NAME));
+  memcpy(buffer.data + buffer.length, VNC_SERVER_NAME, strlen(VNC_SERVER_NAME));
+  buffer.length += strlen(VNC_SERVER_NAME);
+
+  vnc_client_send(client, buffer.data, buffer.length);
+  free(buffer.data);
+}
+
+static struct wm_pointer* vnc_pointer(struct wm_vnc *vnc) {
+  struct wm_seat *seat = wm_seat_find_or_create(vnc->server, WM_DEFAULT_SEAT);
+
+  if (seat->pointer == NULL) {
+    seat->pointer = wm_pointer_create(vnc->server, seat);
+    seat->seat->capabilities |= WL_SEAT_CAPABILITY_POINTER;
+    wlr_seat_set_capabilities(seat->seat, seat->seat->capabilities);
+  }
+
+  return seat->pointer;
+}
+
+static void vnc_pointer_event(struct wm_vnc *vnc, uint8_t mask, int x, int y) {
+  struct wm_output *output = vnc_output(vnc);
+  if (output == NULL) {
+    return;
+  }
+
+  struct wm_pointer *pointer = vnc_pointer(vnc);
+  uint32_t time = vnc_now_msec();
+
+  struct wlr_box *box = wlr_output_layout_get_box(vnc->server->layout,
+    output->wlr_output);
+  double scale = output->wlr_output->scale;
+
+  wlr_cursor_warp(pointer->cursor, NULL, box->x + x / scale, box->y + y / scale);
+  wm_pointer_queue_motion(pointer, NULL, time);
+
+  static const uint32_t buttons[] = { BTN_LEFT, BTN_MIDDLE, BTN_RIGHT };
+
+  for (int i = 0; i < 3; i++) {
+    uint8_t bit = 1 << i;
+    if ((mask ^ vnc->buttons) & bit) {
+      wm_pointer_button(pointer, time, buttons[i],
+        mask & bit ? WLR_BUTTON_PRESSED : WLR_BUTTON_RELEASED);
+    }
+  }
+
+  // Buttons 4 to 7 are wheel clicks, acted on as they are pressed
+  for (int i = 3; i < 7; i++) {
+    uint8_t bit = 1 << i;
+    if ((mask & bit) && !(vnc->buttons & bit)) {
+      bool vertical = i < 5;
+      double delta = (i == 3 || i == 5) ? -VNC_WHEEL_DELTA : VNC_WHEEL_DELTA;
+      wm_pointer_axis(pointer, time,
+        vertical ? WLR_AXIS_ORIENTATION_VERTICAL : WLR_AXIS_ORIENTATION_HORIZONTAL,
+        delta, WLR_AXIS_SOURCE_WHEEL);
+    }
+  }
+
+  vnc->buttons = mask;
+}
+
+struct keysym_lookup {
+  xkb_keysym_t keysym;
+  xkb_keycode_t keycode;
+};
+
+static void find_keycode(struct xkb_keymap *keymap, xkb_keycode_t keycode,
+  void *data) {
+  struct keysym_lookup *lookup = data;
+
+  if (lookup->keycode != XKB_KEYCODE_INVALID) {
+    return;
+  }
+
+  for (xkb_level_index_t level = 0; level < 2; level++) {
+    const xkb_keysym_t *syms;
+    int nsyms = xkb_keymap_key_get_syms_by_level(keymap, keycode, 0,
+      level, &syms);
+
+    for (int i = 0; i < nsyms; i++) {
+      if (syms[i] == lookup->keysym) {
+        lookup->keycode = keycode;
+        return;
+      }
+    }
+  }
+}
+
+static void vnc_key_event(struct wm_vnc *vnc, bool down, xkb_keysym_t keysym) {
+  struct wm_seat *seat = wm_seat_find_or_create(vnc->server, WM_DEFAULT_SEAT);
+  struct wlr_keyboard *keyboard = wlr_seat_get_keyboard(seat->seat);
+
+  if (keyboard == NULL || keyboard->keymap == NULL) {
+    wlr_log(L_DEBUG, "VNC key event dropped, seat has no keyboard");
+    return;
+  }
+
+  if (vnc->keymap != keyboard->keymap) {
+    xkb_state_unref(vnc->xkb_state);
+    xkb_keymap_unref(vnc->keymap);
+    vnc->keymap = xkb_keymap_ref(keyboard->keymap);
+    vnc->xkb_state = xkb_state_new(vnc->keymap);
+  }
+
+  struct keysym_lookup lookup = {
+    .keysym = keysym,
+    .keycode = XKB_KEYCODE_INVALID
+  };
+  xkb_keymap_key_for_each(vnc->keymap, find_keycode, &lookup);
+
+  if (lookup.keycode == XKB_KEYCODE_INVALID) {
+    wlr_log(L_DEBUG, "VNC keysym 0x%x has no keycode", keysym);
+    return;
+  }
+
+  xkb_state_update_key(vnc->xkb_state, lookup.keycode,
+    down ? XKB_KEY_DOWN : XKB_KEY_UP);
+
+  struct wlr_keyboard_modifiers modifiers = {
+    .depressed = xkb_state_serialize_mods(vnc->xkb_state,
+      XKB_STATE_MODS_DEPRESSED),
+    .latched = xkb_state_serialize_mods(vnc->xkb_state,
+      XKB_STATE_MODS_LATCHED),
+    .locked = xkb_state_serialize_mods(vnc->xkb_state,
+      XKB_STATE_MODS_LOCKED),
+    .group = xkb_state_serialize_layout(vnc->xkb_state,
+      XKB_STATE_LAYOUT_EFFECTIVE)
+  };
+
+  wlr_seat_keyboard_notify_modifiers(seat->seat, &modifiers);
+  wlr_seat_keyboard_notify_key(seat->seat, vnc_now_msec(), lookup.keycode - 8,
+    down ? WLR_KEY_PRESSED : WLR_KEY_RELEASED);
+}
+
+static ssize_t vnc_client_handshake(struct wm_vnc_client *client,
+  const uint8_t *data, size_t length) {
+  struct wm_vnc *vnc = client->vnc;
+
+  if (client->state == WM_VNC_CLIENT_VERSION) {
+    if (length < VNC_PROTOCOL_VERSION_LENGTH) {
+      return 0;
+    }
+
+    char version[VNC_PROTOCOL_VERSION_LENGTH + 1] = { 0 };
+    memcpy(version, data, VNC_PROTOCOL_VERSION_LENGTH);
+
+    int major, minor;
+    if (sscanf(version, "RFB %03d.%03d\n", &major, &minor) != 2) {
+      return -1;
+    }
+
+    client->minor_version = minor;
+
+    if (minor >= 7) {
+      uint8_t security[] = { 1, VNC_SECURITY_NONE };
+      vnc_client_send(client, security, sizeof(security));
+      client->state = WM_VNC_CLIENT_SECURITY;
+    } else {
+      uint8_t security[] = { 0, 0, 0, VNC_SECURITY_NONE };
+      vnc_client_send(client, security, sizeof(security));
+      client->state = WM_VNC_CLIENT_INIT;
+    }
+
+    return VNC_PROTOCOL_VERSION_LENGTH;
+  }
+
+  if (client->state == WM_VNC_CLIENT_SECURITY) {
+    if (length < 1) {
+      return 0;
+    }
+
+    if (data[0] != VNC_SECURITY_NONE) {
+      return -1;
+    }
+
+    if (client->minor_version >= 8) {
+      uint8_t result[] = { 0, 0, 0, 0 };
+      vnc_client_send(client, result, sizeof(result));
+    }
+
+    client->state = WM_VNC_CLIENT_INIT;
+    return 1;
+  }
+
+  if (length < 1) {
+    return 0;
+  }
+
+  vnc_send_server_init(client);
+
+  pthread_mutex_lock(&vnc->lock);
+  deflateInit(&client->zstream, Z_BEST_SPEED);
+  client->format = native_format;
+  client->full_update = true;
+  client->state = WM_VNC_CLIENT_NORMAL;
+  pthread_mutex_unlock(&vnc->lock);
+
+  // The shadow framebuffer is not kept up to date without clients, the
+  // first update waits for the next frame to read all of it back
+  struct wm_output *output = vnc_output(vnc);
+  if (output) {
+    if (output->mirror_of) {
+      wm_output_damage_whole(output);
+    }
+    wlr_output_schedule_frame(output->wlr_output);
+  }
+
+  printf("VNC client connected (%dx%d)\n", client->width, client->height);
+
+  return 1;
+}
+
+static ssize_t vnc_client_message(struct wm_vnc_client *client,
+  const uint8_t *data, size_t length) {
+  struct wm_vnc *vnc = client->vnc;
+
+  switch (data[0]) {
+    case 0: {
+      if (length < 20) {
+        return 0;
+      }
+
+      struct wm_vnc_pixel_format format = {
+        .bits_per_pixel = data[4],
+        .depth = data[5],
+        .big_endian = data[6] != 0,
+        .true_colour = data[7] != 0,
+        .red_max = get_u16(data + 8),
+        .green_max = get_u16(data + 10),
+        .blue_max = get_u16(data + 12),
+        .red_shift = data[14],
+        .green_shift = data[15],
+        .blue_shift = data[16],
+      };
+
+      if (format.bits_per_pixel != 32 || !format.true_colour) {
+        wlr_log(L_ERROR, "VNC client requested unsupported %d bpp format",
+          format.bits_per_pixel);
+        return -1;
+      }
+
+      pthread_mutex_lock(&vnc->lock);
+      client->format = format;
+      pthread_mutex_unlock(&vnc->lock);
+      return 20;
+    }
+    case 2: {
+      if (length < 4) {
+        return 0;
+      }
+
+      size_t count = get_u16(data + 2);
+      if (length < 4 + count * 4) {
+        return 0;
+      }
+
+      bool zlib = false;
+      for (size_t i = 0; i < count; i++) {
+        if ((int32_t)get_u32(data + 4 + i * 4) == VNC_ENCODING_ZLIB) {
+          zlib = true;
+        }
+      }
+
+      pthread_mutex_lock(&vnc->lock);
+      client->zlib = zlib;
+      pthread_mutex_unlock(&vnc->lock);
+      return 4 + count * 4;
+    }
+    case 3: {
+      if (length < 10) {
+        return 0;
+      }
+
+      bool incremental = data[1] != 0;
+
+      pthread_mutex_lock(&vnc->lock);
+      if (!incremental) {
+        pixman_region32_union_rect(&client->damage, &client->damage,
+          get_u16(data + 2), get_u16(data + 4),
+          get_u16(data + 6), get_u16(data + 8));
+      }
+      client->update_requested = true;
+      pthread_cond_broadcast(&vnc->cond);
+      pthread_mutex_unlock(&vnc->lock);
+      return 10;
+    }
+    case 4: {
+      if (length < 8) {
+        return 0;
+      }
+
+      vnc_key_event(vnc, data[1] != 0, get_u32(data + 4));
+      return 8;
+    }
+    case 5: {
+      if (length < 6) {
+        return 0;
+      }
+
+      vnc_pointer_event(vnc, data[1], get_u16(data + 2), get_u16(data + 4));
+      return 6;
+    }
+    case 6: {
+      if (length < 8) {
+        return 0;
+      }
+
+      client->skip = get_u32(data + 4);
+      return 8;
+    }
+    default:
+      wlr_log(L_ERROR, "Unknown VNC client message %d", data[0]);
+      return -1;
+  }
+}
+
+static ssize_t vnc_client_process(struct wm_vnc_client *client,
+  const uint8_t *data, size_t length) {
+  if (length == 0) {
+    return 0;
+  }
+
+  if (client->skip > 0) {
+    size_t skipped = client->skip < length ? client->skip : length;
+    client->skip -= skipped;
+    return skipped;
+  }
+
+  if (client->state != WM_VNC_CLIENT_NORMAL) {
+    return vnc_client_handshake(client, data, length);
+  }
+
+  return vnc_client_message(client, data, length);
+}
+
+// Processes whole messages in the buffer, false if the client went away
+static bool vnc_client_consume(struct wm_vnc_client *client) {
+  size_t consumed = 0;
+  while (consumed < client->buffer_length) {
+    ssize_t used = vnc_client_process(client, client->buffer + consumed,
+      client->buffer_length - consumed);
+
+    if (used < 0) {
+      vnc_client_destroy(client);
+      return false;
+    }
+
+    if (used == 0) {
+      break;
+    }
+
+    consumed += used;
+  }
+
+  if (consumed == 0 && client->buffer_length == WM_VNC_BUFFER_SIZE) {
+    wlr_log(L_ERROR, "VNC client message too large");
+    vnc_client_destroy(client);
+    return false;
+  }
+
+  memmove(client->buffer, client->buffer + consumed,
+    client->buffer_length - consumed);
+  client->buffer_length -= consumed;
+
+  return true;
+}
+
+static int vnc_client_event(int fd, uint32_t mask, void *data) {
+  struct wm_vnc_client *client = data;
+
+  if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+    vnc_client_destroy(client);
+    return 0;
+  }
+
+  if (mask & WL_EVENT_WRITABLE) {
+    vnc_client_flush(client);
+  }
+
+  if (!(mask & WL_EVENT_READABLE)) {
+    if (vnc_client_closed(client)) {
+      vnc_client_destroy(client);
+    }
+    return 0;
+  }
+
+  ssize_t received = recv(fd, client->buffer + client->buffer_length,
+    WM_VNC_BUFFER_SIZE - client->buffer_length, MSG_DONTWAIT);
+
+  if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return 0;
+  }
+
+  if (received <= 0) {
+    vnc_client_destroy(client);
+    return 0;
+  }
+
+  client->buffer_length += received;
+
+  if (!vnc_client_consume(client)) {
+    return 0;
+  }
+
+  if (vnc_client_closed(client)) {
+    vnc_client_destroy(client);
+  }
+
+  return 0;
+}
+
+// Sends the updates the encoder queued and reaps clients it closed
+static int vnc_ready(int fd, uint32_t mask, void *data) {
+  (void)mask;
+  struct wm_vnc *vnc = data;
+
+  uint64_t count;
+  if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    wlr_log(L_ERROR, "Failed to read VNC eventfd");
+  }
+
+  struct wm_vnc_client *client, *tmp;
+  wl_list_for_each_safe(client, tmp, &vnc->clients, link) {
+    vnc_client_flush(client);
+
+    if (vnc_client_closed(client)) {
+      vnc_client_destroy(client);
+    }
+  }
+
+  return 0;
+}
+
+static int vnc_accept(int fd, uint32_t mask, void *data) {
+  (void)mask;
+  struct wm_vnc *vnc = data;
+
+  int client_fd = accept(fd, NULL, NULL);
+  if (client_fd < 0) {
+    wlr_log(L_ERROR, "Failed to accept VNC client");
+    return 0;
+  }
+
+  fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+  fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK);
+
+  int nodelay = 1;
+  setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  struct wm_vnc_client *client = calloc(1, sizeof(struct wm_vnc_client));
+  client->vnc = vnc;
+  client->fd = client_fd;
+  client->state = WM_VNC_CLIENT_VERSION;
+  pixman_region32_init(&client->damage);
+
+  struct wl_event_loop *loop = wl_display_get_event_loop(vnc->server->wl_display);
+  client->source = wl_event_loop_add_fd(loop, client_fd, WL_EVENT_READABLE,
+    vnc_client_event, client);
+
+  pthread_mutex_lock(&vnc->lock);
+  wl_list_insert(&vnc->clients, &client->link);
+  pthread_mutex_unlock(&vnc->lock);
+
+  vnc_client_send(client, VNC_PROTOCOL_VERSION, VNC_PROTOCOL_VERSION_LENGTH);
+
+  if (vnc_client_closed(client)) {
+    vnc_client_destroy(client);
+  }
+
+  return 0;
+}
+
+void wm_vnc_output_frame(struct wm_vnc* vnc, struct wm_output* output) {
+  if (vnc == NULL || wl_list_empty(&vnc->clients)) {
+    return;
+  }
+
+  if (vnc_output(vnc) != output) {
+    return;
+  }
+
+  struct wlr_output *wlr_output = output->wlr_output;
+  struct wlr_renderer *renderer = wlr_backend_get_renderer(wlr_output->backend);
+  int width = wlr_output->width;
+  int height = wlr_output->height;
+
+  pixman_region32_t damage;
+  pixman_region32_init(&damage);
+  pixman_region32_copy(&damage, &output->damage);
+
+  // Client state and the framebuffer size only change on the main loop
+  bool resized = vnc->width != width || vnc->height != height;
+  bool full = resized;
+
+  struct wm_vnc_client *client;
+  wl_list_for_each(client, &vnc->clients, link) {
+    if (client->state == WM_VNC_CLIENT_NORMAL && client->full_update) {
+      full = true;
+    }
+  }
+
+  if (full) {
+    pixman_region32_union_rect(&damage, &damage, 0, 0, width, height);
+  }
+
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+
+  size_t total = 0;
+  for (int i = 0; i < nrects; i++) {
+    total += (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+  }
+
+  if (total > vnc->scratch_size) {
+    vnc->scratch = realloc(vnc->scratch, total * sizeof(uint32_t));
+    vnc->scratch_size = total;
+  }
+
+  // The readback may stall on the GPU, so the encoder is not locked out
+  // until the pixels are in scratch
+  uint32_t *pixels = vnc->scratch;
+  for (int i = 0; i < nrects; i++) {
+    int rect_width = rects[i].x2 - rects[i].x1;
+    int rect_height = rects[i].y2 - rects[i].y1;
+
+    if (!wlr_renderer_read_pixels(renderer, WL_SHM_FORMAT_XRGB8888,
+        rect_width * 4, rect_width, rect_height, rects[i].x1,
+        height - rects[i].y2, 0, 0, pixels)) {
+      wlr_log(L_ERROR, "Failed to read pixels for VNC");
+      pixman_region32_fini(&damage);
+      return;
+    }
+
+    pixels += rect_width * rect_height;
+  }
+
+  pthread_mutex_lock(&vnc->lock);
+
+  if (resized) {
+    free(vnc->framebuffer);
+    vnc->width = width;
+    vnc->height = height;
+    vnc->framebuffer = calloc(vnc->width * vnc->height, sizeof(uint32_t));
+  }
+
+  // GL rows are bottom up, the RFB framebuffer is top down
+  pixels = vnc->scratch;
+  for (int i = 0; i < nrects; i++) {
+    int rect_width = rects[i].x2 - rects[i].x1;
+    for (int y = rects[i].y2 - 1; y >= rects[i].y1; y--) {
+      memcpy(vnc->framebuffer + y * vnc->width + rects[i].x1, pixels,
+        rect_width * sizeof(uint32_t));
+      pixels += rect_width;
+    }
+  }
+
+  wl_list_for_each(client, &vnc->clients, link) {
+    if (client->state != WM_VNC_CLIENT_NORMAL) {
+      continue;
+    }
+
+    if (client->full_update) {
+      pixman_region32_union_rect(&client->damage, &client->damage,
+        0, 0, vnc->width, vnc->height);
+      client->full_update = false;
+    } else {
+      pixman_region32_union(&client->damage, &client->damage, &damage);
+    }
+  }
+
+  pthread_cond_broadcast(&vnc->cond);
+  pthread_mutex_unlock(&vnc->lock);
+
+  pixman_region32_fini(&damage);
+}
+
+void wm_vnc_output_destroy(struct wm_vnc* vnc, struct wm_output* output) {
+  if (vnc && vnc->output == output) {
+    vnc->output = NULL;
+  }
+}
+
+struct wm_vnc* wm_vnc_create(struct wm_server* server) {
+  const char *port = getenv("BOXY_VNC_PORT");
+  if (port == NULL) {
+    return NULL;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    wlr_log(L_ERROR, "Failed to create VNC socket");
+    return NULL;
+  }
+
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in address = { 0 };
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(atoi(port));
+
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(fd, 4) < 0) {
+    wlr_log(L_ERROR, "Failed to listen for VNC clients on port %s", port);
+    close(fd);
+    return NULL;
+  }
+
+  struct wm_vnc *vnc = calloc(1, sizeof(struct wm_vnc));
+  vnc->server = server;
+  vnc->listen_fd = fd;
+  vnc->running = true;
+  vnc->output_name = getenv("BOXY_VNC_OUTPUT");
+  vnc->stats = getenv("BOXY_VNC_STATS") != NULL;
+  wl_list_init(&vnc->clients);
+
+  pthread_mutex_init(&vnc->lock, NULL);
+  pthread_cond_init(&vnc->cond, NULL);
+
+  struct wl_event_loop *loop = wl_display_get_event_loop(server->wl_display);
+
+  vnc->ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (vnc->ready_fd < 0) {
+    wlr_log(L_ERROR, "Failed to create VNC eventfd");
+    exit(1);
+  }
+
+  vnc->ready_source = wl_event_loop_add_fd(loop, vnc->ready_fd,
+    WL_EVENT_READABLE, vnc_ready, vnc);
+
+  pthread_create(&vnc->encoder, NULL, vnc_encoder_thread, vnc);
+
+  vnc->listen_source = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+    vnc_accept, vnc);
+
+  printf("VNC server listening on 127.0.0.1:%s\n", port);
+
+  return vnc;
+}
+
+void wm_vnc_destroy(struct wm_vnc* vnc) {
+  if (vnc == NULL) {
+    return;
+  }
+
+  struct wm_vnc_client *client, *tmp;
+  wl_list_for_each_safe(client, tmp, &vnc->clients, link) {
+    vnc_client_destroy(client);
+  }
+
+  pthread_mutex_lock(&vnc->lock);
+  vnc->running = false;
+  pthread_cond_broadcast(&vnc->cond);
+  pthread_mutex_unlock(&vnc->lock);
+
+  pthread_join(vnc->encoder, NULL);
+  pthread_mutex_destroy(&vnc->lock);
+  pthread_cond_destroy(&vnc->cond);
+
+  wl_event_source_remove(vnc->listen_source);
+  close(vnc->listen_fd);
+
+  wl_event_source_remove(vnc->ready_source);
+  close(vnc->ready_fd);
+
+  xkb_state_unref(vnc->xkb_state);
+  xkb_keymap_unref(vnc->keymap);
+
+  free(vnc->scratch);
+  free(vnc->framebuffer);
+  free(vnc);
+}
@@ -1,13 +1,20 @@
 #include "wm_window.h"
 
+#include <stdlib.h>
+#include <string.h>
 #include <wlr/xwayland.h>
+#include <wlr/types/wlr_surface.h>
 #include <wlr/types/wlr_xdg_shell_v6.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/types/wlr_cursor.h>
 
+#include "wm_index.h"
 #include "wm_server.h"
 #include "wm_surface.h"
 #include "wm_pointer.h"
+#include "wm_screencopy.h"
+#include "wm_window_store.h"
+#include "wm_workspace.h"
 
 struct wlr_box wm_window_geometry(struct wm_window* window) {
   struct wlr_box geometry = {
@@ -40,6 +47,18 @@ void wm_window_commit_pending_movement(struct wm_window* window, int width, int
   }
 }
 
+static void damage_snapshot(struct wm_window *window) {
+  struct wm_server *server = window->surface->server;
+  wm_server_damage_box(server, &window->snapshot);
+
+  if (!wm_window_snapshot_box(window, &window->snapshot)) {
+    memset(&window->snapshot, 0, sizeof(struct wlr_box));
+    return;
+  }
+
+  wm_server_damage_box(server, &window->snapshot);
+}
+
 void wm_window_resize(struct wm_window* window, struct wm_pointer* pointer) {
     int dx = pointer->cursor->x - pointer->offset_x;
 		int dy = pointer->cursor->y - pointer->offset_y;
@@ -104,13 +123,98 @@ void wm_window_resize(struct wm_window* window, struct wm_pointer* pointer) {
     window->pending_y = y;
     window->pending_height = height;
 
-    window->surface->toplevel_constrained_set_size(
-      window->surface, width, height);
+    window->resize_width = width;
+    window->resize_height = height;
+    window->resize_pending = true;
+
+    if (window->configure_serial == 0) {
+      wm_window_finish_resize(window);
+    }
+
+    damage_snapshot(window);
+}
+
+void wm_window_finish_resize(struct wm_window* window) {
+  if (!window->resize_pending) {
+    return;
+  }
+
+  window->resize_pending = false;
+  window->configure_serial = window->surface->toplevel_constrained_set_size(
+    window->surface, window->resize_width, window->resize_height);
+}
+
+void wm_window_commit_configure(struct wm_window* window) {
+  if (window->configure_serial == 0) {
+    return;
+  }
+
+  uint32_t acked = window->surface->configure_serial(window->surface);
+  if ((int32_t)(acked - window->configure_serial) < 0) {
+    return;
+  }
+
+  window->configure_serial = 0;
+  wm_window_finish_resize(window);
+  damage_snapshot(window);
+}
+
+int wm_window_resize_snapshot_mode() {
+  const char *mode = getenv("BOXY_RESIZE_SNAPSHOT");
+  if (mode == NULL) {
+    return WM_RESIZE_SNAPSHOT_OFF;
+  }
+
+  if (strcmp(mode, "stretch") == 0) {
+    return WM_RESIZE_SNAPSHOT_STRETCH;
+  }
+
+  if (strcmp(mode, "crop") == 0) {
+    return WM_RESIZE_SNAPSHOT_CROP;
+  }
+
+  return WM_RESIZE_SNAPSHOT_OFF;
+}
+
+// The pending geometry, when the old buffer should be drawn into it
+// because the client has not caught up with the resize yet
+bool wm_window_snapshot_box(struct wm_window* window, struct wlr_box* box) {
+  if (window->surface->server->resize_snapshot == WM_RESIZE_SNAPSHOT_OFF) {
+    return false;
+  }
+
+  if (window->configure_serial == 0 && !window->resize_pending) {
+    return false;
+  }
+
+  if (window->width <= 0 || window->height <= 0 ||
+      window->pending_width <= 0 || window->pending_height <= 0) {
+    return false;
+  }
+
+  if (window->width == window->pending_width &&
+      window->height == window->pending_height) {
+    return false;
+  }
+
+  box->x = window->pending_x;
+  box->y = window->pending_y;
+  box->width = window->pending_width;
+  box->height = window->pending_height;
+
+  return true;
 }
 
 void wm_window_move(struct wm_window* window, int x, int y) {
+  if (window->x == x && window->y == y) {
+    return;
+  }
+
   window->x = x;
   window->y = y;
+
+  wm_window_damage_whole(window);
+  wm_workspace_window_moved(window);
 }
 
 void wm_window_maximize(struct wm_window* window, bool maximized) {
@@ -160,3 +264,122 @@ struct wlr_output* wm_window_find_output(struct wm_window* window) {
 
   return output;
 }
+
+static void add_surface_extents(struct wlr_surface *surface,
+  int sx, int sy, void *data) {
+  struct wlr_box *extents = data;
+
+  int x1 = sx;
+  int y1 = sy;
+  int x2 = sx + surface->current->width;
+  int y2 = sy + surface->current->height;
+
+  if (extents->width > 0 && extents->height > 0) {
+    x1 = x1 < extents->x ? x1 : extents->x;
+    y1 = y1 < extents->y ? y1 : extents->y;
+    x2 = x2 > extents->x + extents->width ? x2 : extents->x + extents->width;
+    y2 = y2 > extents->y + extents->height ? y2 : extents->y + extents->height;
+  }
+
+  extents->x = x1;
+  extents->y = y1;
+  extents->width = x2 - x1;
+  extents->height = y2 - y1;
+}
+
+struct wlr_box wm_window_extents(struct wm_window* window) {
+  struct wlr_box extents = { 0 };
+  window->surface->for_each_surface(window->surface,
+    add_surface_extents, &extents);
+
+  extents.x += window->x;
+  extents.y += window->y;
+
+  return extents;
+}
+
+void wm_window_damage_whole(struct wm_window* window) {
+  struct wm_server* server = window->surface->server;
+  struct wlr_box old = window->extents;
+
+  // Hidden workspaces stay out of output damage and hit tests
+  bool visible = wm_workspace_window_visible(window);
+
+  if (visible) {
+    wm_server_damage_box(server, &window->extents);
+  }
+
+  int old_origin_x = window->extents_origin_x;
+  int old_origin_y = window->extents_origin_y;
+
+  window->extents = wm_window_extents(window);
+  window->extents_origin_x = window->x;
+  window->extents_origin_y = window->y;
+
+  if (visible) {
+    wm_server_damage_box(server, &window->extents);
+    wm_index_update(server->index, window);
+    wm_window_store_update(server->window_store, window);
+  }
+
+  // Window captures are relative to the extents so a plain move keeps them
+  bool reshaped = old.width != window->extents.width ||
+    old.height != window->extents.height ||
+    old.x - old_origin_x != window->extents.x - window->x ||
+    old.y - old_origin_y != window->extents.y - window->y;
+
+  if (reshaped) {
+    struct wlr_box local = {
+      .x = 0,
+      .y = 0,
+      .width = window->extents.width,
+      .height = window->extents.height
+    };
+    wm_screencopy_window_damage(server->screencopy, window, &local);
+  }
+}
+
+static void damage_surface(struct wlr_surface *surface,
+  int sx, int sy, void *data) {
+  struct wm_window *window = data;
+
+  int nrects;
+  pixman_box32_t *rects = pixman_region32_rectangles(
+    &surface->current->surface_damage, &nrects);
+
+  for (int i = 0; i < nrects; i++) {
+    struct wlr_box box = {
+      .x = window->x + sx + rects[i].x1,
+      .y = window->y + sy + rects[i].y1,
+      .width = rects[i].x2 - rects[i].x1,
+      .height = rects[i].y2 - rects[i].y1
+    };
+    wm_server_damage_box(window->surface->server, &box);
+
+    box.x -= window->extents.x;
+    box.y -= window->extents.y;
+    wm_screencopy_window_damage(window->surface->server->screencopy,
+      window, &box);
+  }
+}
+
+void wm_window_damage_commit(struct wm_window* window) {
+  window->commits++;
+
+  struct wlr_box extents = wm_window_extents(window);
+
+  if (memcmp(&extents, &window->extents, sizeof(struct wlr_box)) != 0) {
+    wm_window_damage_whole(window);
+    return;
+  }
+
+  if (!wm_workspace_window_visible(window)) {
+    return;
+  }
+
+  window->surface->for_each_surface(window->surface, damage_surface, window);
+
+  // The geometry can change without the surfaces growing or shrinking
+  wm_index_update(window->surface->server->index, window);
+  wm_window_store_update(window->surface->server->window_store, window);
+}
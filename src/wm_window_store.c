@@ -0,0 +1,184 @@
+#include "wm_window_store.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wm_window.h"
+
+static bool store_contains(struct wm_window_store *store,
+  struct wm_window *window) {
+  int handle = window->handle;
+  return handle >= 0 && handle < store->next_handle &&
+    store->slots[handle] >= 0 && store->windows[store->slots[handle]] == window;
+}
+
+static int store_slot(struct wm_window_store *store, struct wm_window *window) {
+  return store_contains(store, window) ? store->slots[window->handle] : -1;
+}
+
+static int store_take_handle(struct wm_window_store *store) {
+  if (store->free_count > 0) {
+    return store->free_handles[--store->free_count];
+  }
+
+  if (store->next_handle == store->handle_capacity) {
+    store->handle_capacity *= 2;
+    store->slots = realloc(store->slots, store->handle_capacity * sizeof(int));
+    store->free_handles = realloc(store->free_handles,
+      store->handle_capacity * sizeof(int));
+  }
+
+  return store->next_handle++;
+}
+
+static void store_grow(struct wm_window_store *store) {
+  store->capacity *= 2;
+  store->windows = realloc(store->windows,
+    store->capacity * sizeof(struct wm_window *));
+  store->geometry = realloc(store->geometry,
+    store->capacity * sizeof(struct wlr_box));
+  store->extents = realloc(store->extents,
+    store->capacity * sizeof(struct wlr_box));
+  store->culled = realloc(store->culled, store->capacity * sizeof(bool));
+}
+
+static void store_set(struct wm_window_store *store, int slot,
+  struct wm_window *window, struct wlr_box *geometry, struct wlr_box *extents,
+  bool culled) {
+  store->windows[slot] = window;
+  store->geometry[slot] = *geometry;
+  store->extents[slot] = *extents;
+  store->culled[slot] = culled;
+  store->slots[window->handle] = slot;
+}
+
+// Moves every window down over the holes, keeping the stack order
+static void store_compact(struct wm_window_store *store) {
+  int count = 0;
+
+  for (int i = 0; i < store->count; i++) {
+    if (store->windows[i] == NULL) {
+      continue;
+    }
+
+    if (i != count) {
+      store_set(store, count, store->windows[i], &store->geometry[i],
+        &store->extents[i], store->culled[i]);
+    }
+    count++;
+  }
+
+  store->count = count;
+  store->holes = 0;
+}
+
+// Frees the window's slot, trimming it away when it was on top
+static void store_clear_slot(struct wm_window_store *store, int slot) {
+  store->windows[slot] = NULL;
+  store->culled[slot] = true;
+  store->holes++;
+
+  while (store->count > 0 && store->windows[store->count - 1] == NULL) {
+    store->count--;
+    store->holes--;
+  }
+
+  if (store->holes * 2 > store->count) {
+    store_compact(store);
+  }
+}
+
+static void store_push(struct wm_window_store *store,
+  struct wm_window *window, struct wlr_box *geometry, struct wlr_box *extents,
+  bool culled) {
+  if (store->count == store->capacity) {
+    if (store->holes > 0) {
+      store_compact(store);
+    } else {
+      store_grow(store);
+    }
+  }
+
+  store_set(store, store->count++, window, geometry, extents, culled);
+}
+
+void wm_window_store_add(struct wm_window_store* store,
+  struct wm_window* window) {
+  struct wlr_box geometry = wm_window_geometry(window);
+  window->handle = store_take_handle(store);
+  store_push(store, window, &geometry, &window->extents, false);
+}
+
+void wm_window_store_remove(struct wm_window_store* store,
+  struct wm_window* window) {
+  int slot = store_slot(store, window);
+  if (slot < 0) {
+    return;
+  }
+
+  store_clear_slot(store, slot);
+  store->slots[window->handle] = -1;
+  store->free_handles[store->free_count++] = window->handle;
+  window->handle = -1;
+}
+
+void wm_window_store_raise(struct wm_window_store* store,
+  struct wm_window* window) {
+  int slot = store_slot(store, window);
+  if (slot < 0 || slot == store->count - 1) {
+    return;
+  }
+
+  struct wlr_box geometry = store->geometry[slot];
+  struct wlr_box extents = store->extents[slot];
+  bool culled = store->culled[slot];
+
+  // Either step may compact, the copies above outlive the old slot
+  store_clear_slot(store, slot);
+  store_push(store, window, &geometry, &extents, culled);
+}
+
+void wm_window_store_update(struct wm_window_store* store,
+  struct wm_window* window) {
+  int slot = store_slot(store, window);
+  if (slot < 0) {
+    return;
+  }
+
+  store->geometry[slot] = wm_window_geometry(window);
+  store->extents[slot] = window->extents;
+}
+
+struct wlr_box* wm_window_store_geometry(struct wm_window_store* store,
+  struct wm_window* window) {
+  int slot = store_slot(store, window);
+  return slot < 0 ? NULL : &store->geometry[slot];
+}
+
+struct wm_window_store* wm_window_store_create() {
+  struct wm_window_store *store = calloc(1, sizeof(struct wm_window_store));
+  store->capacity = WM_WINDOW_STORE_INITIAL_CAPACITY;
+  store->windows = calloc(store->capacity, sizeof(struct wm_window *));
+  store->geometry = calloc(store->capacity, sizeof(struct wlr_box));
+  store->extents = calloc(store->capacity, sizeof(struct wlr_box));
+  store->culled = calloc(store->capacity, sizeof(bool));
+
+  store->handle_capacity = WM_WINDOW_STORE_INITIAL_CAPACITY;
+  store->slots = calloc(store->handle_capacity, sizeof(int));
+  store->free_handles = calloc(store->handle_capacity, sizeof(int));
+  return store;
+}
+
+void wm_window_store_destroy(struct wm_window_store* store) {
+  if (store == NULL) {
+    return;
+  }
+
+  free(store->windows);
+  free(store->geometry);
+  free(store->extents);
+  free(store->culled);
+  free(store->slots);
+  free(store->free_handles);
+  free(store);
+}
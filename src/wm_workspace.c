@@ -0,0 +1,244 @@
+#include "wm_workspace.h"
+
+#include <stdio.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layout.h>
+
+#include "wm_constraints.h"
+#include "wm_index.h"
+#include "wm_output.h"
+#include "wm_pointer.h"
+#include "wm_seat.h"
+#include "wm_server.h"
+#include "wm_surface.h"
+#include "wm_window.h"
+#include "wm_window_store.h"
+
+static struct wm_output* workspace_output(struct wm_server *server,
+  struct wlr_output *wlr_output) {
+  struct wm_output *output;
+  wl_list_for_each(output, &server->outputs, link) {
+    if (output->wlr_output == wlr_output && output->mirror_of == NULL) {
+      return output;
+    }
+  }
+  return NULL;
+}
+
+static struct wm_output* workspace_first_output(struct wm_server *server) {
+  struct wm_output *output;
+  wl_list_for_each(output, &server->outputs, link) {
+    if (output->mirror_of == NULL) {
+      return output;
+    }
+  }
+  return NULL;
+}
+
+static void workspace_hide_window(struct wm_server *server,
+  struct wm_window *window) {
+  wm_server_damage_box(server, &window->extents);
+  wm_index_remove(server->index, window);
+  wm_window_store_remove(server->window_store, window);
+
+  struct wm_seat *seat;
+  wl_list_for_each(seat, &server->seats, link) {
+    struct wm_pointer *pointer = seat->pointer;
+    if (pointer == NULL) {
+      continue;
+    }
+
+    wm_pointer_forget_window(pointer, window);
+    if (pointer->constraint && pointer->constraint->window == window) {
+      wm_constraints_deactivate(pointer);
+    }
+  }
+}
+
+// The store add puts it on top, callers show windows bottom first
+static void workspace_show_window(struct wm_server *server,
+  struct wm_window *window) {
+  wm_window_store_add(server->window_store, window);
+  wm_window_damage_whole(window);
+}
+
+static void workspace_refocus(struct wm_server *server) {
+  struct wm_seat *seat;
+  wl_list_for_each(seat, &server->seats, link) {
+    wm_server_refocus(server, seat);
+  }
+}
+
+void wm_workspace_init(struct wm_workspace* workspace,
+  struct wm_output* output, int index) {
+  workspace->output = output;
+  workspace->index = index;
+  wl_list_init(&workspace->windows);
+}
+
+void wm_workspace_output_destroy(struct wm_output* output) {
+  struct wm_server *server = output->server;
+  struct wm_output *target = workspace_first_output(server);
+
+  for (int i = 0; i < WM_WORKSPACE_COUNT; i++) {
+    struct wm_workspace *workspace = &output->workspaces[i];
+    bool hidden = workspace != output->workspace;
+
+    // Bottom first so the windows keep their order on top of the target
+    struct wm_window *window, *tmp;
+    wl_list_for_each_reverse_safe(window, tmp, &workspace->windows,
+      workspace_link) {
+      wm_workspace_remove_window(window);
+
+      if (target) {
+        window->workspace = target->workspace;
+        wl_list_insert(&target->workspace->windows, &window->workspace_link);
+      }
+
+      if (hidden) {
+        workspace_show_window(server, window);
+      } else {
+        wm_window_store_raise(server->window_store, window);
+        wm_window_damage_whole(window);
+      }
+    }
+  }
+}
+
+void wm_workspace_output_added(struct wm_output* output) {
+  if (output->mirror_of) {
+    return;
+  }
+
+  struct wm_window *window;
+  wl_list_for_each_reverse(window, &output->server->windows, link) {
+    if (window->workspace == NULL) {
+      window->workspace = output->workspace;
+      wl_list_insert(&output->workspace->windows, &window->workspace_link);
+    }
+  }
+}
+
+void wm_workspace_add_window(struct wm_seat* seat, struct wm_window* window) {
+  struct wm_output *output = workspace_output(seat->server,
+    wm_window_find_output(window));
+
+  if (output == NULL) {
+    output = wm_workspace_seat_output(seat);
+  }
+
+  if (output == NULL) {
+    window->workspace = NULL;
+    wl_list_init(&window->workspace_link);
+    return;
+  }
+
+  window->workspace = output->workspace;
+  wl_list_insert(&output->workspace->windows, &window->workspace_link);
+}
+
+void wm_workspace_remove_window(struct wm_window* window) {
+  wl_list_remove(&window->workspace_link);
+  wl_list_init(&window->workspace_link);
+  window->workspace = NULL;
+}
+
+void wm_workspace_raise_window(struct wm_window* window) {
+  if (window->workspace == NULL) {
+    return;
+  }
+
+  wl_list_remove(&window->workspace_link);
+  wl_list_insert(&window->workspace->windows, &window->workspace_link);
+}
+
+void wm_workspace_window_moved(struct wm_window* window) {
+  struct wm_workspace *old = window->workspace;
+  struct wm_server *server = window->surface->server;
+  struct wm_output *output = workspace_output(server,
+    wm_window_find_output(window));
+
+  if (output == NULL || (old && output == old->output)) {
+    return;
+  }
+
+  bool was_visible = wm_workspace_window_visible(window);
+
+  wl_list_remove(&window->workspace_link);
+  wl_list_insert(&output->workspace->windows, &window->workspace_link);
+  window->workspace = output->workspace;
+
+  if (!was_visible) {
+    workspace_show_window(server, window);
+  }
+}
+
+bool wm_workspace_window_visible(struct wm_window* window) {
+  struct wm_workspace *workspace = window->workspace;
+  return workspace == NULL || workspace->output->workspace == workspace;
+}
+
+struct wm_output* wm_workspace_seat_output(struct wm_seat* seat) {
+  struct wm_server *server = seat->server;
+
+  if (seat->pointer) {
+    struct wlr_output *wlr_output = wlr_output_layout_output_at(server->layout,
+      seat->pointer->cursor->x, seat->pointer->cursor->y);
+    struct wm_output *output = workspace_output(server, wlr_output);
+    if (output) {
+      return output;
+    }
+  }
+
+  return workspace_first_output(server);
+}
+
+void wm_workspace_switch(struct wm_output* output, int index) {
+  struct wm_server *server = output->server;
+  struct wm_workspace *old = output->workspace;
+  struct wm_workspace *workspace = &output->workspaces[index];
+
+  if (workspace == old) {
+    return;
+  }
+
+  output->workspace = workspace;
+
+  struct wm_window *window;
+  wl_list_for_each(window, &old->windows, workspace_link) {
+    workspace_hide_window(server, window);
+  }
+
+  wl_list_for_each_reverse(window, &workspace->windows, workspace_link) {
+    workspace_show_window(server, window);
+  }
+
+  printf("Workspace %d on %s\n", index + 1, output->wlr_output->name);
+
+  workspace_refocus(server);
+}
+
+void wm_workspace_move_window(struct wm_window* window, int index) {
+  struct wm_workspace *old = window->workspace;
+  if (old == NULL || old->index == index) {
+    return;
+  }
+
+  struct wm_server *server = window->surface->server;
+  struct wm_workspace *workspace = &old->output->workspaces[index];
+  bool was_visible = wm_workspace_window_visible(window);
+
+  wl_list_remove(&window->workspace_link);
+  wl_list_insert(&workspace->windows, &window->workspace_link);
+  window->workspace = workspace;
+
+  bool visible = wm_workspace_window_visible(window);
+
+  if (was_visible && !visible) {
+    workspace_hide_window(server, window);
+    workspace_refocus(server);
+  } else if (!was_visible && visible) {
+    workspace_show_window(server, window);
+  }
+}